@@ -0,0 +1,100 @@
+#include "activity.hpp"
+#include "morton.hpp"
+
+#include <algorithm>
+
+void ActivityTracker::resize(size_t count)
+{
+    quietTicks.assign(count, 0);
+    awakeBlocks = std::make_unique<std::atomic<uint8_t>[]>(blockCount());
+    dirtyBlocks = std::make_unique<std::atomic<uint8_t>[]>(blockCount());
+
+    wakeAll();
+    allDirty = true;
+}
+
+bool ActivityTracker::settle(size_t i, const glm::vec3 &velocity, const glm::vec3 &acceleration, float deltaTime)
+{
+    float motion = glm::length(velocity) + glm::length(acceleration) * deltaTime;
+    if(motion >= settings.threshold || !settings.enabled) {
+        quietTicks[i] = 0;
+        return false;
+    }
+
+    quietTicks[i]++;
+    return quietTicks[i] == sleepTicks();
+}
+
+void ActivityTracker::wake(size_t i)
+{
+    quietTicks[i] = 0;
+    awakeBlocks[i / BLOCK_SIZE].store(1, std::memory_order_relaxed);
+}
+
+void ActivityTracker::wakeAll()
+{
+    std::fill(quietTicks.begin(), quietTicks.end(), 0);
+    for(size_t block = 0; block < blockCount(); block++) {
+        awakeBlocks[block].store(1, std::memory_order_relaxed);
+    }
+    awakeCount = quietTicks.size();
+}
+
+void ActivityTracker::refreshBlock(size_t block)
+{
+    size_t begin = block * BLOCK_SIZE;
+    size_t end = std::min(begin + BLOCK_SIZE, quietTicks.size());
+    uint16_t limit = sleepTicks();
+
+    bool awake = std::any_of(quietTicks.begin() + begin, quietTicks.begin() + end,
+        [&](uint16_t ticks) { return ticks < limit; });
+    awakeBlocks[block].store(awake, std::memory_order_relaxed);
+}
+
+void ActivityTracker::takeDirtySpans(std::vector<Span> &spans, size_t mergeGap, size_t maxSpans)
+{
+    spans.clear();
+    size_t count = quietTicks.size();
+    if(count == 0)
+        return;
+
+    if(allDirty.exchange(false)) {
+        for(size_t block = 0; block < blockCount(); block++) {
+            dirtyBlocks[block].store(0, std::memory_order_relaxed);
+        }
+        spans.push_back(Span { 0, count });
+        return;
+    }
+
+    for(size_t block = 0; block < blockCount(); block++) {
+        if(!dirtyBlocks[block].exchange(0, std::memory_order_acquire))
+            continue;
+
+        size_t first = block * BLOCK_SIZE;
+        size_t last = std::min(first + BLOCK_SIZE, count);
+
+        if(!spans.empty() && first - (spans.back().first + spans.back().count) <= mergeGap) {
+            spans.back().count = last - spans.back().first;
+        } else {
+            spans.push_back(Span { first, last - first });
+        }
+    }
+
+    // Many small uploads cost more than one larger one
+    if(spans.size() > maxSpans) {
+        Span merged = { spans.front().first, spans.back().first + spans.back().count - spans.front().first };
+        spans.assign(1, merged);
+    }
+}
+
+void ActivityTracker::permute(const std::vector<uint32_t> &order, ThreadPool &pool)
+{
+    if(order.size() != quietTicks.size())
+        return;
+
+    morton::permute(quietTicks, order, pool);
+    for(size_t block = 0; block < blockCount(); block++) {
+        refreshBlock(block);
+    }
+    allDirty = true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "threadpool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct SleepSettings {
+    bool enabled = true;
+    // A particle is quiet while |v| + |a| * dt stays below this
+    float threshold = 0.05f;
+    // Quiet ticks before it falls asleep
+    int ticksToSleep = 60;
+};
+
+// Tracks which particles are asleep and which parts of the particle
+// arrays changed since they were last uploaded.
+//
+// Both are kept per block of BLOCK_SIZE particles, so blocks without
+// awake particles can be skipped wholesale and uploads are made of a
+// few contiguous spans instead of the whole array.
+class ActivityTracker {
+public:
+    static constexpr size_t BLOCK_SIZE = 256;
+
+    struct Span {
+        size_t first;
+        size_t count;
+    };
+
+    // Wakes everything and marks it dirty
+    void resize(size_t count);
+    size_t getCount() const { return quietTicks.size(); }
+
+    bool isAwake(size_t i) const { return quietTicks[i] < sleepTicks(); }
+    bool isBlockAwake(size_t block) const { return awakeBlocks[block].load(std::memory_order_relaxed) != 0; }
+
+    // Counts a tick of motion for an awake particle. Returns true if it
+    // just fell asleep, in which case the caller should stop it.
+    bool settle(size_t i, const glm::vec3 &velocity, const glm::vec3 &acceleration, float deltaTime);
+    void wake(size_t i);
+    void wakeAll();
+    // Recomputes a block's awake flag after its particles were stepped
+    void refreshBlock(size_t block);
+
+    // Call after writing the particle, it publishes the write to takeDirtySpans
+    void markDirty(size_t i) { dirtyBlocks[i / BLOCK_SIZE].store(1, std::memory_order_release); }
+    void markAllDirty() { allDirty = true; }
+
+    // Takes the dirty ranges since the last call. Spans closer than
+    // mergeGap particles are joined, and if more than maxSpans remain
+    // they collapse into a single span.
+    void takeDirtySpans(std::vector<Span> &spans, size_t mergeGap = 4 * BLOCK_SIZE, size_t maxSpans = 64);
+
+    // Keeps sleep state with reordered particles; everything becomes dirty
+    void permute(const std::vector<uint32_t> &order, ThreadPool &pool);
+
+    void setAwakeCount(size_t count) { awakeCount = count; }
+    size_t getAwakeCount() const { return awakeCount; }
+
+    SleepSettings settings;
+
+private:
+    uint16_t sleepTicks() const {
+        return settings.enabled ? (uint16_t)std::clamp(settings.ticksToSleep, 1, 65535) : UINT16_MAX;
+    }
+
+    size_t blockCount() const { return (quietTicks.size() + BLOCK_SIZE - 1) / BLOCK_SIZE; }
+
+    std::vector<uint16_t> quietTicks;
+    std::unique_ptr<std::atomic<uint8_t>[]> awakeBlocks;
+    std::unique_ptr<std::atomic<uint8_t>[]> dirtyBlocks;
+    std::atomic<bool> allDirty = true;
+    std::atomic<size_t> awakeCount = 0;
+};
@@ -14,12 +14,26 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
+#include <cfloat>
 #include <thread>
+#include <utility>
+
+// Ticks to wait after a reorder before sampling the "after" timings
+constexpr int REORDER_SETTLE_TICKS = 64;
+constexpr float TIMING_SMOOTHING = 0.05f;
+// Ticks of diagnostics kept for the graphs
+constexpr size_t DIAGNOSTICS_HISTORY_SIZE = 240;
+
+constexpr float BENCHMARK_TIME_STEP = 1.0f / 60.0f;
+// One scheduler thread for the particle stages and one for the particle
+// systems. Both hand their loops to the ThreadPool and join in, so the
+// pool's threads are the only other workers.
+constexpr size_t TICK_THREADS = 2;
 
 #define RANDF(MIN, MAX) (static_cast<float>(std::rand()) / (static_cast<float>(RAND_MAX / (MAX - MIN))) + MIN)
 
-Application::Application() : Window("My window"), imguiInstance(getWindow()), cameraRotation(0.0) {
-    std::srand(time(nullptr));
+Application::Application(const LaunchOptions &options) : Window("My window"), imguiInstance(getWindow()), scheduler(TICK_THREADS), grid(2.0f), cameraRotation(0.0) {
+    std::srand(options.seeded ? options.seed : time(nullptr));
 
     GLFWimage icons[1];
     icons[0].pixels = stbi_load("assets/appicon.png", &icons[0].width, &icons[0].height, nullptr, 4);
@@ -37,27 +51,71 @@ Application::Application() : Window("My window"), imguiInstance(getWindow()), ca
 
     glfwGetCursorPos(getWindow(), &prevMouseX, &prevMouseY);
     
-    constexpr size_t cubeCount = 100000;
+    size_t cubeCount = options.particleCount;
+
+    if(options.isPlayback()) {
+        playback = std::make_unique<TrajectoryReader>(options.playPath);
+        if(playback->getFrameCount() == 0)
+            throw std::runtime_error(fmt::format("{} has no recorded frames", options.playPath));
+        cubeCount = playback->getParticleCount();
+    }
 
     cubePositions = generateRandomVectors(cubeCount, -1000.0, 1000.0);
     cubeVelocities = generateRandomVectors(cubeCount, -10.0, 10.0);
 
-    glGenBuffers(1, &instanceVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * cubePositions->size(), cubePositions->data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    activity.resize(cubeCount);
+
+    if(playback)
+        playback->readFrame(0, *cubePositions);
+
+    // Fed instances go straight from shared memory to the GPU
+    if(options.isFeed()) {
+        feed = std::make_unique<FeedConsumer>(options.feedName);
+        cubePositions->clear();
+        cubeVelocities->clear();
+    }
+
+    // Color and scale belong to the particle, not its position, so
+    // they're generated and uploaded once
+    // Out of core datasets are streamed in around the camera instead
+    if(options.isOutOfCore()) {
+        chunkedData = std::make_unique<ChunkedDataset>(options.datasetPath);
+        residency = std::make_unique<ChunkResidency>(*chunkedData, ResidencySettings());
+        cubePositions->clear();
+        cubeVelocities->clear();
+    }
+
+    size_t attributeCount = cubeCount;
+    if(feed)
+        attributeCount = feed->getCapacity();
+    else if(residency)
+        attributeCount = residency->getInstanceCapacity();
+    cubeAttributes = generateAttributes(attributeCount);
+
+    static_assert(sizeof(InstanceOffset) == sizeof(glm::vec3), "Positions are uploaded as InstanceOffset");
+
+    positionStream = InstanceStream::create<InstanceOffset>(StreamFrequency::Dynamic);
+    attributeStream = InstanceStream::create<InstanceAttributes>(StreamFrequency::Static);
+    positionStream->upload(*cubePositions);
+    attributeStream->upload(cubeAttributes);
+    if(feed)
+        feedStream = InstanceStream::create<InstanceOffset>(StreamFrequency::Dynamic);
 
-    cubeMesh = Mesh::createFromVertexArrayInstanced(
+    geometry = GeometryArena::create<Vertex>(4096, 16384);
+    geometry->attachStream(*positionStream);
+    geometry->attachStream(*attributeStream);
+
+    cubeMesh = geometry->addMesh<Vertex>(
     { // vertices
-        -1, -1, -1, -0.57735026919, -0.57735026919, -0.57735026919,
-        1, -1, -1, 10.57735026919, -0.57735026919, -0.57735026919,
-        1, 1, -1, 10.57735026919, 10.57735026919, -0.57735026919,
-        -1, 1, -1, -0.57735026919, 10.57735026919, -0.57735026919,
+        {{-1, -1, -1}, {-0.57735026919, -0.57735026919, -0.57735026919}},
+        {{1, -1, -1}, {10.57735026919, -0.57735026919, -0.57735026919}},
+        {{1, 1, -1}, {10.57735026919, 10.57735026919, -0.57735026919}},
+        {{-1, 1, -1}, {-0.57735026919, 10.57735026919, -0.57735026919}},
         
-        -1, -1, 1, -0.57735026919, -0.57735026919, 0.57735026919,
-        1, -1, 1, 0.57735026919, -0.57735026919, 0.57735026919,
-        1, 1, 1, 0.57735026919, 0.57735026919, 0.57735026919,
-        -1, 1, 1, -0.57735026919, 0.57735026919, 0.57735026919,
+        {{-1, -1, 1}, {-0.57735026919, -0.57735026919, 0.57735026919}},
+        {{1, -1, 1}, {0.57735026919, -0.57735026919, 0.57735026919}},
+        {{1, 1, 1}, {0.57735026919, 0.57735026919, 0.57735026919}},
+        {{-1, 1, 1}, {-0.57735026919, 0.57735026919, 0.57735026919}},
     },
     { // indices
         0, 2, 1,
@@ -77,44 +135,272 @@ Application::Application() : Window("My window"), imguiInstance(getWindow()), ca
 
         0, 1, 4,
         1, 5, 4
-    }, instanceVBO);
+    });
 
-    auto vertShader = shaderFromGlslFile("shaders/cube.vert", GL_VERTEX_SHADER);
-    auto fragShader = shaderFromGlslFile("shaders/cube.frag", GL_FRAGMENT_SHADER);
-    
-    mat = MaterialBuilder()
-        .attachShader(vertShader)
-        .attachShader(fragShader)
-        .buildMaterial();
+    if(options.systemCount > 0)
+        addParticleSystems(options.systemCount, options.systemSize);
+
+    culler = std::make_unique<OcclusionCuller>();
+    culler->setStaticStream(attributeStream->getBuffer(), attributeStream->getStride());
+    splatter = std::make_unique<PointSplatter>();
+
+    renderTarget = std::make_unique<RenderTarget>();
+    resolution = std::make_unique<ResolutionController>();
+    overdraw = std::make_unique<OverdrawCounter>();
+    msaaSamples = std::min(options.msaaSamples, RenderTarget::getMaxSamples());
+
+    cubeMaterials = std::make_unique<MaterialVariants>("shaders/cube.vert.spv", "shaders/cube.frag.spv");
+    // Dataset chunks have no attributes of their own
+    if(residency)
+        cubeVariant.format = InstanceFormat::Offset;
+    mat = cubeMaterials->get(cubeVariant);
 
     camera.origin = glm::vec3(0.0, 0.0, -10.0);
     camera.direction = glm::vec3(0.0, 0.0, 1.0);
     
     // glClearColor(0.2, 0.2, 0.3, 1.0); // This is a pleasant color
     glClearColor(0.0, 0.0, 0.0, 1.0);
+
+    if(options.isBenchmark()) {
+        cameraPath = std::make_unique<CameraPath>(CameraPath::loadFromFile(options.benchmarkPath));
+        benchmark = std::make_unique<Benchmark>(options);
+
+        // Don't let vsync hide frame times
+        glfwSwapInterval(0);
+        // Nor a changing resolution
+        resolution->settings.dynamic = false;
+    }
+
+    if(!options.recordPath.empty()) {
+        recordPath = options.recordPath;
+        startRecording();
+    }
+
+    diagnosticsOn = options.diagnostics;
+
+    if(!options.metricsPath.empty())
+        metricsExporter = std::make_unique<MetricsExporter>(options.metricsPath, options.metricsInterval);
+
+    if(options.autotune) {
+        tuner = std::make_unique<AutoTuner>(options.tuneCachePath);
+        tuneBudget = options.tuneBudget;
+
+        std::optional<TunedConfig> cached = options.retune ? std::nullopt : tuner->load();
+        if(cached) {
+            applyTuning(*cached);
+            LOG_INFO("Using tuned config from {}: {} threads, chunks of {}, {} uploads", options.tuneCachePath,
+                cached->threadCount, cached->integratorChunkSize, uploadStrategyName(cached->upload));
+        } else {
+            runAutoTune();
+        }
+    }
 }
 
 void Application::run()
 {
-    double prevTime = glfwGetTime();
+    if(benchmark) {
+        runBenchmark();
+        return;
+    }
 
-    std::thread thread(&Application::updateThread, this);
-    LOG_DEBUG("Dispatched update thread");
+    double prevTime = glfwGetTime();
 
     while(!shouldClose()) {
-        pollEvents();
-
         double time = glfwGetTime();
         double deltaTime = time - prevTime;
         prevTime = time;
 
-        update(deltaTime);
-        render(deltaTime);
+        runFrame(deltaTime);
+    }
+
+    // A tick may still be running for the frame that never came
+    if(nextTick.valid())
+        scheduler.runMainUntil(nextTick);
+    if(lastRecord.valid())
+        scheduler.runMainUntil(lastRecord);
+}
+
+void Application::runFrame(double deltaTime)
+{
+    averageFrameTime += ((float)deltaTime - averageFrameTime) * TIMING_SMOOTHING;
+
+    if(tuneRequested.exchange(false)) {
+        // The tick in flight is using the pool
+        if(nextTick.valid())
+            scheduler.runMainUntil(nextTick);
+        if(lastRecord.valid())
+            scheduler.runMainUntil(lastRecord);
+        runAutoTune();
+    }
+
+    scheduler.beginFrame();
+
+    // The tick spawned by last frame's upload has been running since then
+    Task tick = std::exchange(nextTick, Task());
+
+    Task input = scheduler.spawn("input", Affinity::Main, inputTask(deltaTime));
+    Task upload = scheduler.spawn("upload", Affinity::Main, uploadTask(tick, deltaTime));
+    Task draw = scheduler.spawn("draw", Affinity::Main, drawTask(input, upload));
+    Task ui = scheduler.spawn("ui", Affinity::Main, uiTask(draw, deltaTime));
+    Task submit = scheduler.spawn("submit", Affinity::Main, submitTask(ui));
+
+    scheduler.runMainUntil(submit);
+    frameStats = scheduler.endFrame(submit, workers.takeWorkerBusyTime());
+    recordFrameMetrics(deltaTime);
+}
+
+void Application::recordFrameMetrics(double frameTime)
+{
+    frameCounter.add();
+    frameTimes.record(frameTime);
+    instanceGauge.set(getInstanceCount());
+    scaleGauge.set(resolutionScale);
+
+    if(metricsExporter)
+        metricsExporter->update(glfwGetTime());
+}
+
+Task Application::spawnTick(double deltaTime)
+{
+    if(deltaTime > 1.0) deltaTime = 0.0001;
+    lastUpdateTickTime = deltaTime;
+    // Systems keep their own rates in real time
+    double realDeltaTime = deltaTime;
+    deltaTime *= timeScale;
+
+    applyControls();
+
+    // The stages only wait on the ones whose data they use. The particle
+    // chain and the particle systems share nothing, so they run side by
+    // side and the frame waits for both.
+    Task reorder = scheduler.spawn("reorder", Affinity::Workers, reorderTask(lastRecord));
+    Task integrate = scheduler.spawn("integrate", Affinity::Workers, integrateTask(reorder, deltaTime));
+    Task collide = scheduler.spawn("collide", Affinity::Workers, collideTask(integrate, deltaTime));
+    lastRecord = scheduler.spawn("record", Affinity::Workers, recordTask(collide));
+
+    if(!systems)
+        return collide;
+    Task systemsTick = scheduler.spawn("systems", Affinity::Workers, systemsTask(realDeltaTime, timeScale));
+    return scheduler.spawn("tick", Affinity::Workers, joinTask(collide, systemsTick));
+}
+
+Task Application::inputTask(double deltaTime)
+{
+    pollEvents();
+    update(deltaTime);
+    co_return;
+}
+
+Task Application::uploadTask(Task tick, double deltaTime)
+{
+    if(tick.valid()) {
+        co_await tick;
+        publishTick();
+    }
+
+    uploadInstances();
+
+    // Positions are on the GPU now, so the next tick can overlap with
+    // the rest of this frame
+    if(simRunning && isSimulated())
+        nextTick = spawnTick(deltaTime);
+}
+
+Task Application::drawTask(Task input, Task upload)
+{
+    co_await input;
+    co_await upload;
+    drawScene();
+}
+
+Task Application::uiTask(Task draw, double deltaTime)
+{
+    co_await draw;
+    render_ui(deltaTime);
+}
+
+Task Application::submitTask(Task ui)
+{
+    co_await ui;
+    swapBuffers();
+}
+
+Task Application::reorderTask(Task previous)
+{
+    // Recording reads the positions the next tick would overwrite
+    if(previous.valid())
+        co_await previous;
+
+    tickStartTime = glfwGetTime();
+    reorderStage();
+}
+
+Task Application::integrateTask(Task reorder, double deltaTime)
+{
+    co_await reorder;
+    integrateStage(deltaTime);
+}
+
+Task Application::collideTask(Task integrate, double deltaTime)
+{
+    co_await integrate;
+    collideStage();
+    finishTick(deltaTime);
+}
+
+Task Application::recordTask(Task collide)
+{
+    co_await collide;
+    recordStage();
+}
+
+Task Application::systemsTask(double deltaTime, float timeScale)
+{
+    systems->update((float)deltaTime, timeScale, workers);
+    co_return;
+}
+
+Task Application::joinTask(Task first, Task second)
+{
+    co_await first;
+    co_await second;
+}
+
+void Application::runBenchmark()
+{
+    // Fixed timestep with the simulation ticking in lockstep on this
+    // thread, so every run sees exactly the same frames
+    float duration = cameraPath->getDuration();
+    size_t frameCount = benchmark->getFrameCount();
+
+    while(!shouldClose() && !benchmark->isFinished()) {
+        pollEvents();
+
+        double start = glfwGetTime();
+
+        size_t frame = benchmark->getFrameIndex();
+        float pathTime = frameCount > 1 ? duration * frame / (frameCount - 1) : 0.0f;
+        cameraPath->sample(pathTime, camera.origin, cameraRotation);
+        updateCameraDirection();
+
+        if(playback)
+            advancePlayback();
+        else if(isSimulated())
+            tick(BENCHMARK_TIME_STEP * timeScale);
+        if(systems && isSimulated())
+            systems->update(BENCHMARK_TIME_STEP, timeScale, workers);
+        publishTick();
+
+        benchmark->beginFrame();
+        render(BENCHMARK_TIME_STEP);
+        bool diagnosed = !playback && isSimulated() && diagnosticsOn;
+        benchmark->endFrame(glfwGetTime() - start, diagnosed ? &integrator.getDiagnostics() : nullptr);
+
+        swapBuffers();
+        recordFrameMetrics(glfwGetTime() - start);
     }
 
-    simCondition.notify_all();
-    thread.join();
-    LOG_DEBUG("Joined update thread");
+    benchmark->finish();
 }
 
 void Application::resize(int width, int height)
@@ -127,21 +413,177 @@ void Application::resize(int width, int height)
 
 void Application::render(double deltaTime)
 {
-    if(simRunning) {
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * cubePositions->size(), cubePositions->data(), GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    averageFrameTime += ((float)deltaTime - averageFrameTime) * TIMING_SMOOTHING;
+
+    uploadInstances();
+    drawScene();
+    render_ui(deltaTime);
+}
+
+void Application::uploadInstances()
+{
+    // Going back from sorted order needs both streams in particle order
+    bool restoreOrder = streamsSorted && !depthSortOn;
+    if(restoreOrder)
+        attributesDirty = true;
+    streamsSorted = false;
+
+    if(attributesDirty.exchange(false))
+        attributeStream->upload(cubeAttributes);
+
+    if(residency) {
+        residency->update(camera.origin, camera.direction, getProjectionView());
+        residency->upload(*positionStream);
+    } else if(feed) {
+        if(simRunning) {
+            // Read into the spare buffer, which is only drawn from once the
+            // frame turned out whole
+            bool intact = feed->read([&](const void *data, size_t count) {
+                feedStream->upload(data, count);
+            });
+            if(intact) {
+                std::swap(positionStream, feedStream);
+                geometry->attachStream(*positionStream);
+            }
+        }
+    } else if(playback) {
+        if(depthSortOn)
+            uploadSorted();
+        else
+            positionStream->upload(*cubePositions);
+    } else {
+        // Only what the simulation touched since the last frame
+        activity.takeDirtySpans(dirtySpans);
+        if(depthSortOn) {
+            uploadSorted();
+        } else if(restoreOrder || positionStream->getCount() != cubePositions->size()) {
+            positionStream->upload(*cubePositions);
+        } else {
+            for(const ActivityTracker::Span &span : dirtySpans) {
+                positionStream->uploadRange(cubePositions->data() + span.first, span.first, span.count);
+            }
+        }
+        lastUploadSpans = dirtySpans.size();
     }
+    lastUploadBytes = positionStream->takeUploadedBytes() + attributeStream->takeUploadedBytes();
+    if(feedStream)
+        lastUploadBytes += feedStream->takeUploadedBytes();
+
+    if(systems)
+        systems->upload();
+}
+
+void Application::uploadSorted()
+{
+    // Positions hold still here, the next tick starts after the upload
+    depthSorter.sort(*cubePositions, camera.viewMatrix(), getProjectionView(), camera.nearPlane, camera.farPlane, workers);
+    depthSorter.gather(*cubePositions, sortedPositions, workers);
+    depthSorter.gather(cubeAttributes, sortedAttributes, workers);
+
+    positionStream->upload(sortedPositions);
+    attributeStream->upload(sortedAttributes);
+    streamsSorted = true;
+}
+
+void Application::bindPulledInstances(GLuint indices)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, variant::PULL_POSITIONS_BINDING, positionStream->getBuffer());
+    if(cubeVariant.format == InstanceFormat::Attributes)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, variant::PULL_RECORDS_BINDING, attributeStream->getBuffer());
+    if(indices)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, variant::PULL_INDICES_BINDING, indices);
+}
+
+void Application::drawScene()
+{
+    renderTarget->configure(width, height, resolutionScale, msaaSamples);
+    renderTarget->bind();
+    resolution->beginFrame();
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    mat->use();
-    mat->uniform4x4("projection_view", camera.projectionMatrix(width / (float)height) * camera.viewMatrix());
-    cubeMesh->drawInstanced(cubePositions->size());
-    
-    render_ui(deltaTime);
+    glm::mat4 projectionView = getProjectionView();
+    // The culler compacts survivors in any order, so sorting skips it.
+    // Chunk slots aren't contiguous, so it can't walk them either.
+    bool splatting = splattingOn && !residency;
+    bool culling = occlusionCullingOn && !streamsSorted && !residency && !splatting;
 
-    swapBuffers();
+    ShaderVariant drawVariant = cubeVariant;
+    drawVariant.indexed = culling || splatting;
+    // The near list is indices, drawn by pulling
+    drawVariant.pulling |= splatting;
+    mat = cubeMaterials->get(drawVariant);
+
+    if(measureOverdraw) {
+        size_t sampleCount = (size_t)renderTarget->getWidth() * renderTarget->getHeight() * renderTarget->getSamples();
+        overdraw->begin(streamsSorted ? 1 : 0, sampleCount);
+    }
+
+    if(residency) {
+        mat->use();
+        mat->uniform4x4("projection_view", projectionView);
+        if(drawVariant.pulling)
+            bindPulledInstances(0);
+        for(const ChunkResidency::Draw &draw : residency->getDraws()) {
+            geometry->queueDraw(cubeMesh, draw.firstInstance, draw.count);
+        }
+        geometry->drawQueued();
+    } else if(splatting) {
+        GLuint records = cubeVariant.format == InstanceFormat::Attributes ? attributeStream->getBuffer() : 0;
+        splatter->splat(positionStream->getBuffer(), records, getInstanceCount(), geometry->getRange(cubeMesh),
+            projectionView, renderTarget->getWidth(), renderTarget->getHeight());
+
+        mat->use();
+        mat->uniform4x4("projection_view", projectionView);
+        bindPulledInstances(splatter->getNearIndices());
+        geometry->drawIndirectPulled(splatter->getNearCommand());
+        splatter->composite();
+    } else if(culling) {
+        const MeshRange &range = geometry->getRange(cubeMesh);
+        culler->setIndexOutput(drawVariant.pulling);
+
+        // The cull passes use the same storage buffer bindings
+        culler->cullEarly(positionStream->getBuffer(), getInstanceCount(), range, projectionView);
+        mat->use();
+        mat->uniform4x4("projection_view", projectionView);
+        if(drawVariant.pulling) {
+            bindPulledInstances(culler->getEarlyIndices());
+            geometry->drawIndirectPulled(culler->getEarlyCommand());
+        } else {
+            geometry->drawIndirect(culler->getEarlyInstances(), culler->getEarlyCommand(), 1, culler->getEarlyStatic());
+        }
+
+        culler->buildPyramid(renderTarget->getFramebuffer(), renderTarget->getWidth(), renderTarget->getHeight());
+
+        culler->cullLate(positionStream->getBuffer(), getInstanceCount(), range, projectionView);
+        mat->use();
+        if(drawVariant.pulling) {
+            bindPulledInstances(culler->getLateIndices());
+            geometry->drawIndirectPulled(culler->getLateCommand());
+        } else {
+            geometry->drawIndirect(culler->getLateInstances(), culler->getLateCommand(), 1, culler->getLateStatic());
+        }
+    } else {
+        mat->use();
+        mat->uniform4x4("projection_view", projectionView);
+        if(drawVariant.pulling)
+            bindPulledInstances(0);
+        geometry->queueDraw(cubeMesh, 0, getInstanceCount());
+        geometry->drawQueued();
+    }
+
+    if(systems) {
+        systems->draw(*geometry, *cubeMaterials, projectionView);
+        geometry->attachStream(*positionStream);
+        geometry->attachStream(*attributeStream);
+    }
+
+    if(measureOverdraw)
+        overdraw->end();
+
+    renderTarget->present(upscaleFilter, sharpness);
+    resolution->endFrame();
+    resolutionScale = resolution->update(resolutionScale);
 }
 
 void Application::render_ui(double deltaTime)
@@ -149,16 +591,279 @@ void Application::render_ui(double deltaTime)
     imguiInstance.newFrame();
 
     ImGui::Begin("Stats");
-    ImGui::Text("Instance count: %lu", cubePositions->size());
+    ImGui::Text("Instance count: %lu", getInstanceCount());
     ImGui::Text("Frametime: %lfms", deltaTime * 1000.0);
+    ImGui::Text("Draw commands: %lu (%lu meshes)", geometry->getLastDrawCount(), geometry->getMeshCount());
+    ImGui::Text("Instance upload: %.2f MB in %lu spans", lastUploadBytes / 1e6, lastUploadSpans);
     ImGui::Text("Last Update Tick Time: %fms", lastUpdateTickTime * 1000.0);
-    ImGui::Text("Virtual time passed: %fs", timePassed);
+    ImGui::Text("Tick work time: %fms", report.workTime * 1000.0);
+    if(!benchmark && ImGui::CollapsingHeader("Task graph")) {
+        ImGui::Text("Workers: %lu", scheduler.getWorkerCount());
+        ImGui::Text("Tasks: %lu", frameStats.taskCount);
+        ImGui::Text("Frame: %.3fms, critical path: %.3fms", frameStats.wallTime * 1000.0, frameStats.criticalPath * 1000.0);
+        ImGui::Text("Core utilization: %.1f%%", frameStats.utilization * 100.0f);
+    }
+    ImGui::Text("Virtual time passed: %fs", report.timePassed);
     ImGui::DragFloat(
         "Time scale",
         &timeScale,
         0.0001, 0.0001, 2.0,
         "%.4f"
     );
+    if(ImGui::CollapsingHeader("Gravity")) {
+        GravitySettings &gravity = controls.gravity;
+        bool changed = false;
+        changed |= ImGui::DragFloat("Strength", &gravity.strength, 1000.0f, 0.0f, 1e9f, "%.0f", ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::DragFloat("Softening", &gravity.softening, 0.1f, 0.01f, 1000.0f);
+        changed |= ImGui::DragFloat3("Second attractor", &gravity.secondAttractor.x, 1.0f);
+        changed |= ImGui::DragFloat("Second strength", &gravity.secondStrength, 1000.0f, -1e9f, 1e9f, "%.0f");
+        changed |= ImGui::DragFloat("Drag", &gravity.drag, 0.001f, 0.0f, 10.0f, "%.3f");
+        changed |= ImGui::DragFloat("Noise", &gravity.noise, 0.1f, 0.0f, 10000.0f);
+        changed |= ImGui::DragFloat("Wrap boundary", &gravity.boundary, 1.0f, 0.0f, 100000.0f);
+        // Sleeping particles wouldn't notice the new field
+        if(changed)
+            wakeRequested = true;
+        ImGui::DragFloat("Step accuracy", &gravity.accuracy, 0.001f, 0.001f, 1.0f, "%.3f");
+        ImGui::SliderInt("Max timestep level", &gravity.maxLevel, 0, MAX_TIMESTEP_LEVELS - 1);
+
+        const BlockIntegrator::Stats &stats = report.integrator;
+        ImGui::Text("Kernel: attractor%s%s%s%s",
+            stats.forceTerms & FORCE_SECOND_ATTRACTOR ? " + second" : "",
+            stats.forceTerms & FORCE_DRAG ? " + drag" : "",
+            stats.forceTerms & FORCE_NOISE ? " + noise" : "",
+            stats.forceTerms & FORCE_WRAP ? " + wrap" : "");
+        ImGui::Text("Force evaluations: %lu (shared step: %lu)", stats.forceEvaluations, stats.sharedStepEvaluations);
+        for(int level = 0; level < MAX_TIMESTEP_LEVELS; level++) {
+            if(stats.levelCounts[level] > 0)
+                ImGui::Text("  dt/%d: %lu particles", 1 << level, stats.levelCounts[level]);
+        }
+    }
+    if(ImGui::CollapsingHeader("Sleeping")) {
+        SleepSettings &sleep = controls.sleep;
+        if(ImGui::Checkbox("Sleep when settled", &sleep.enabled) && !sleep.enabled)
+            wakeRequested = true;
+        ImGui::DragFloat("Motion threshold", &sleep.threshold, 0.001f, 0.0f, 10.0f, "%.3f");
+        ImGui::DragInt("Quiet ticks to sleep", &sleep.ticksToSleep, 1.0f, 1, 10000);
+        if(ImGui::Button("Wake all"))
+            wakeRequested = true;
+
+        ImGui::Text("Awake: %lu, sleeping: %lu", report.awake, report.particles - std::min(report.awake, report.particles));
+    }
+    ImGui::Checkbox("Collisions", &controls.collisionsOn);
+    if(controls.collisionsOn) {
+        ImGui::DragFloat("Particle radius", &controls.particleRadius, 0.01f, 0.01f, 100.0f);
+        ImGui::DragFloat("Restitution", &controls.restitution, 0.01f, 0.0f, 1.0f);
+        ImGui::Text("Grid build: %fms", report.gridBuildTime * 1000.0);
+        ImGui::Text("Grid query: %fms", report.gridQueryTime * 1000.0);
+        ImGui::Text("Contacts: %lu", report.contacts);
+    }
+    ImGui::Checkbox("Occlusion culling", &occlusionCullingOn);
+    if(occlusionCullingOn) {
+        const OcclusionCuller::Stats &stats = culler->getStats();
+        ImGui::Text("Drawn: %u early + %u late", stats.drawnEarly, stats.drawnLate);
+        ImGui::Text("Occluded: %u", stats.occluded);
+        ImGui::Text("Outside frustum: %u", stats.frustumCulled);
+        ImGui::Text("Compaction writes: %.2f MB", culler->getCompactedBytes() / 1e6);
+    }
+    ImGui::Checkbox("Point splatting", &splattingOn);
+    if(splattingOn) {
+        float radius = splatter->getMaxSplatRadius();
+        if(ImGui::DragFloat("Max splat radius (px)", &radius, 0.05f, 0.0f, 8.0f))
+            splatter->setMaxSplatRadius(radius);
+        const PointSplatter::Stats &stats = splatter->getStats();
+        ImGui::Text("Splatted: %u, triangles: %u", stats.splatted, stats.near);
+        ImGui::Text("Atomics: %d-bit", splatter->hasWideAtomics() ? 64 : 32);
+        if(occlusionCullingOn)
+            ImGui::Text("Occlusion culling is off while splatting");
+    }
+    if(systems && ImGui::CollapsingHeader("Particle systems")) {
+        const ParticleSystems::Stats &stats = report.systems;
+        ImGui::Text("Systems: %lu, particles: %lu", systems->getSystemCount(), systems->getInstanceCount());
+        ImGui::Text("Ticked: %lu systems, %lu particles in %lu chunks", stats.systemsTicked, stats.particlesTicked, stats.chunks);
+        ImGui::Text("Update: %.3fms", stats.updateTime * 1e3);
+        ImGui::Text("Draw calls: %lu", stats.drawCalls);
+
+        for(const auto &[handle, system] : systems->getSystems()) {
+            float tickRate = system.settings.tickRate;
+            std::string label = fmt::format("{} ({} particles) Hz", system.settings.name, system.count);
+            if(ImGui::DragFloat(label.c_str(), &tickRate, 1.0f, 0.0f, 1000.0f, "%.0f"))
+                controls.tickRates.push_back({ handle, tickRate });
+        }
+    }
+    if(ImGui::CollapsingHeader("Metrics")) {
+        metricRates.update(glfwGetTime());
+
+        for(auto [label, histogram] : {std::pair {"Frame", &frameTimes}, std::pair {"Tick", &tickTimes}}) {
+            metrics::Histogram::Summary s = histogram->summarizeRecent();
+            histogram->recent(metricValues);
+            std::string overlay = fmt::format("p50 {:.2f}ms p99 {:.2f}ms max {:.2f}ms", s.p50 * 1e3, s.p99 * 1e3, s.max * 1e3);
+            ImGui::PlotLines(label, metricValues.data(), (int)metricValues.size(), 0, overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0, 60));
+        }
+
+        double frames = std::max(metricRates.get("frames"), 1e-6);
+        ImGui::Text("Ticks/s: %.1f", metricRates.get("ticks"));
+        ImGui::Text("Draw calls/frame: %.1f (%.1f commands)", metricRates.get("draw_calls") / frames, metricRates.get("draw_commands") / frames);
+        ImGui::Text("Uploaded: %.2f MB/s", metricRates.get("upload_bytes") / 1e6);
+        ImGui::Text("Allocations/frame: %.1f", metricRates.get("allocations") / frames);
+        if(metricsExporter)
+            ImGui::Text("Exporting to %s (%lu written)", metricsExporter->getPath().c_str(), metricsExporter->getWriteCount());
+    }
+    if(tuner && ImGui::CollapsingHeader("Auto-tune")) {
+        ImGui::Text("Machine: %s", tuner->getFingerprint().c_str());
+        ImGui::Text("Threads: %lu, chunks of %lu, %s uploads",
+            workers.getThreadCount(), integrator.chunkSize, uploadStrategyName(positionStream->getUploadStrategy()));
+        if(lastTuning) {
+            ImGui::Text("Tuned in %.2fs over %lu candidates", lastTuning->elapsed, lastTuning->candidates);
+            ImGui::Text("Tick %.2fms, upload %.2fms", lastTuning->tickTime * 1e3, lastTuning->uploadTime * 1e3);
+        } else {
+            ImGui::Text("Loaded from %s", tuner->getCachePath().c_str());
+        }
+        if(ImGui::Button("Tune again"))
+            tuneRequested = true;
+    }
+    if(isSimulated() && ImGui::CollapsingHeader("Diagnostics")) {
+        bool on = diagnosticsOn;
+        if(ImGui::Checkbox("Track every tick", &on))
+            diagnosticsOn = on;
+        ImGui::SameLine();
+        // Changing the field changes the energy too
+        if(ImGui::Button("Reset energy reference"))
+            resetEnergyReference = true;
+
+        std::lock_guard<std::mutex> lock(diagnosticsMutex);
+        const SimulationDiagnostics &d = lastDiagnostics;
+        if(!energyDriftHistory.empty()) {
+            std::string overlay = fmt::format("{:+.3e}", energyDriftHistory.back());
+            ImGui::PlotLines("Energy drift", energyDriftHistory.data(), (int)energyDriftHistory.size(), 0, overlay.c_str(), FLT_MAX, FLT_MAX, ImVec2(0, 60));
+            overlay = fmt::format("{:.2f}", maxSpeedHistory.back());
+            ImGui::PlotLines("Max speed", maxSpeedHistory.data(), (int)maxSpeedHistory.size(), 0, overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0, 60));
+        }
+        ImGui::Text("Energy: %.6g (kinetic %.6g, potential %.6g)", d.totalEnergy(), d.kineticEnergy, d.potentialEnergy);
+        ImGui::Text("Momentum: %.4g %.4g %.4g", d.momentum.x, d.momentum.y, d.momentum.z);
+        if(d.count > 0) {
+            ImGui::Text("Bounds: %.1f %.1f %.1f to %.1f %.1f %.1f",
+                d.boundsMin.x, d.boundsMin.y, d.boundsMin.z, d.boundsMax.x, d.boundsMax.y, d.boundsMax.z);
+        }
+        ImGui::Text("Unbound: %lu", d.unboundCount);
+        ImGui::Text("NaN: %lu, Inf: %lu", d.nanCount, d.infCount);
+    }
+    if(!feed && !residency && ImGui::CollapsingHeader("Depth sort")) {
+        ImGui::Checkbox("Sort front to back", &depthSortOn);
+        ImGui::Checkbox("Incremental", &controls.depthSort.incremental);
+        if(depthSortOn) {
+            const DepthSorter::Stats &stats = depthSorter.getStats();
+            ImGui::Text("Sort time: %.3fms", stats.sortTime * 1000.0);
+            ImGui::Text("Visible: %lu", stats.visibleCount);
+            if(stats.incremental)
+                ImGui::Text("Repaired last order, %lu moves", stats.moves);
+            else
+                ImGui::Text("Radix sorted, %lu passes", stats.radixPasses);
+            if(occlusionCullingOn)
+                ImGui::Text("Occlusion culling is off while sorting");
+        }
+
+        ImGui::Checkbox("Measure overdraw", &measureOverdraw);
+        if(measureOverdraw) {
+            double unsorted = overdraw->getOverdraw(0), sorted = overdraw->getOverdraw(1);
+            ImGui::Text("Overdraw unsorted: %.2fx, sorted: %.2fx", unsorted, sorted);
+            if(unsorted > 0.0 && sorted > 0.0)
+                ImGui::Text("Reduction: %.1f%%", (1.0 - sorted / unsorted) * 100.0);
+        }
+    }
+    if(ImGui::CollapsingHeader("Shading")) {
+        bool attributes = cubeVariant.format == InstanceFormat::Attributes;
+        if(ImGui::Checkbox("Per-instance attributes", &attributes))
+            cubeVariant.format = attributes ? InstanceFormat::Attributes : InstanceFormat::Offset;
+        ImGui::Checkbox("Lighting", &cubeVariant.lighting);
+        ImGui::Checkbox("Vertex pulling", &cubeVariant.pulling);
+        int lod = (int)cubeVariant.lod;
+        if(ImGui::SliderInt("Shading LOD", &lod, 0, (int)variant::MAX_LOD_LEVEL))
+            cubeVariant.lod = lod;
+        ImGui::Text("Variant %#x, %lu linked", cubeVariant.key(), cubeMaterials->getLinkedCount());
+    }
+    if(ImGui::CollapsingHeader("Resolution")) {
+        ResolutionSettings &settings = resolution->settings;
+        ImGui::Checkbox("Dynamic", &settings.dynamic);
+        if(settings.dynamic) {
+            ImGui::DragFloat("Target GPU time (ms)", &settings.targetMs, 0.1f, 1.0f, 100.0f);
+            ImGui::DragFloatRange2("Scale range", &settings.minScale, &settings.maxScale, 0.01f, 0.1f, 2.0f);
+        } else {
+            ImGui::SliderFloat("Scale", &resolutionScale, 0.1f, 2.0f);
+        }
+        ImGui::SliderInt("MSAA samples", &msaaSamples, 1, RenderTarget::getMaxSamples());
+        int filter = (int)upscaleFilter;
+        if(ImGui::Combo("Upscale", &filter, "Bilinear\0Sharpen\0"))
+            upscaleFilter = (UpscaleFilter)filter;
+        if(upscaleFilter == UpscaleFilter::Sharpen)
+            ImGui::SliderFloat("Sharpness", &sharpness, 0.0f, 1.0f);
+
+        ImGui::Text("Internal: %dx%d (%.2fx), %d samples", renderTarget->getWidth(), renderTarget->getHeight(), resolutionScale, renderTarget->getSamples());
+        ImGui::Text("GPU time: %.3fms", resolution->getGpuTime() * 1000.0);
+    }
+    ImGui::Checkbox("Morton reordering", &controls.reorderOn);
+    if(controls.reorderOn) {
+        ImGui::Checkbox("63-bit keys", &controls.reorderWideKeys);
+        ImGui::DragInt("Reorder every N ticks", &controls.reorderInterval, 1.0f, 1, 100000);
+        ImGui::Text("Reorder time: %fms", report.reorderTime * 1000.0);
+        ImGui::Text("Tick before/after: %.3fms / %.3fms",
+            report.tickTimeBeforeReorder * 1000.0, report.tickTimeAfterReorder * 1000.0);
+        ImGui::Text("Frame before/after: %.3fms / %.3fms",
+            report.frameTimeBeforeReorder * 1000.0, report.frameTimeAfterReorder * 1000.0);
+    }
+    if(playback) {
+        if(ImGui::CollapsingHeader("Playback", ImGuiTreeNodeFlags_DefaultOpen)) {
+            int frame = (int)playbackFrame;
+            if(ImGui::SliderInt("Frame", &frame, 0, (int)playback->getFrameCount() - 1)) {
+                playbackFrame = frame;
+                playback->readFrame(playbackFrame, *cubePositions);
+            }
+            ImGui::Text("Recorded time: %fs", playback->getFrameTime(playbackFrame));
+        }
+    } else if(residency) {
+        if(ImGui::CollapsingHeader("Out of core", ImGuiTreeNodeFlags_DefaultOpen)) {
+            ResidencySettings &settings = residency->settings;
+            const ChunkResidency::Stats &stats = residency->getStats();
+
+            int hostBudget = (int)(settings.hostBudget >> 20);
+            if(ImGui::DragInt("Host budget (MB)", &hostBudget, 8.0f, 16, 1 << 20))
+                settings.hostBudget = (size_t)hostBudget << 20;
+            int uploadBudget = (int)(settings.uploadBudget >> 20);
+            if(ImGui::DragInt("Upload per frame (MB)", &uploadBudget, 1.0f, 1, 1024))
+                settings.uploadBudget = (size_t)uploadBudget << 20;
+            ImGui::DragFloat("Prefetch distance", &settings.prefetchDistance, 10.0f, 0.0f, 100000.0f);
+
+            ImGui::Text("Dataset: %s (%lu points, %lu chunks)", chunkedData->getPath().c_str(),
+                chunkedData->getPointCount(), chunkedData->getChunkCount());
+            ImGui::Text("Resident: %.1f / %.1f MB", stats.hostBytes / 1e6, settings.hostBudget / 1e6);
+            ImGui::Text("GPU: %lu / %lu chunks, %lu points", stats.gpuChunks, residency->getSlotCount(), stats.gpuPoints);
+            ImGui::Text("Visible: %lu chunks, wanted: %lu", stats.visibleChunks, stats.wantedChunks);
+            ImGui::Text("Read: %.1f MB/s, %lu loads pending", stats.readRate / 1e6, stats.pendingLoads);
+            ImGui::Text("Uploaded: %.2f MB, evictions: %lu", stats.uploadedBytes / 1e6, stats.evictions);
+        }
+    } else if(feed) {
+        if(ImGui::CollapsingHeader("Feed", ImGuiTreeNodeFlags_DefaultOpen)) {
+            ImGui::Text("Shared memory: %s (%lu instances max)", feed->getName().c_str(), feed->getCapacity());
+            ImGui::Text("Producer frame: %lu", feed->getLastFrame());
+            ImGui::Text("Skipped frames: %lu", feed->getSkippedFrames());
+            ImGui::Text("Torn reads: %lu", feed->getTornReads());
+        }
+    } else if(ImGui::CollapsingHeader("Recording")) {
+        if(!recorder) {
+            if(ImGui::Button("Start recording"))
+                startRecording();
+        } else {
+            if(ImGui::Button("Stop recording"))
+                stopRecording();
+        }
+        if(recorder) {
+            size_t written = recorder->getBytesWritten();
+            ImGui::Text("File: %s%s", recorder->getPath().c_str(), recorder->isDirectIo() ? " (O_DIRECT)" : "");
+            ImGui::Text("Frames: %lu recorded, %lu dropped", recorder->getRecordedFrames(), recorder->getDroppedFrames());
+            ImGui::Text("Queue: %lu / %lu", recorder->getQueueDepth(), recorder->getRingSize());
+            ImGui::Text("Written: %.1f MB (%.1fx smaller)", written / 1e6,
+                written > 0 ? recorder->getRawBytes() / (double)written : 0.0);
+        }
+    }
     ImGui::End();
 
     ImGui::Begin("Camera");
@@ -193,6 +898,20 @@ void Application::render_ui(double deltaTime)
     imguiInstance.renderFrame();
 }
 
+size_t Application::getInstanceCount() const
+{
+    if(streamsSorted)
+        return depthSorter.getVisibleCount();
+    if(residency)
+        return residency->getStats().gpuPoints;
+    return feed ? feed->getLastCount() : cubePositions->size();
+}
+
+glm::mat4 Application::getProjectionView()
+{
+    return camera.projectionMatrix(width / (float)height) * camera.viewMatrix();
+}
+
 std::unique_ptr<std::vector<glm::vec3>> Application::generateRandomVectors(size_t size, float min, float max)
 {
     std::unique_ptr<std::vector<glm::vec3>> positions = std::make_unique<std::vector<glm::vec3>>(size);
@@ -208,42 +927,288 @@ std::unique_ptr<std::vector<glm::vec3>> Application::generateRandomVectors(size_
     return std::move(positions);
 }
 
-void Application::updateThread()
+std::vector<InstanceAttributes> Application::generateAttributes(size_t size)
 {
-    double prevTime = glfwGetTime();
-    while(!shouldClose()) {
-        double time = glfwGetTime();
-        double deltaTime = time - prevTime;
-        prevTime = time;
+    std::vector<InstanceAttributes> attributes(size);
+
+    for(InstanceAttributes &attribute : attributes) {
+        glm::vec3 color = glm::normalize(glm::vec3(1.2f, 1.2f, 2.0f) + glm::vec3(
+            RANDF(0.0f, 1.0f),
+            RANDF(0.0f, 1.0f),
+            RANDF(0.0f, 1.0f)
+        ));
+        attribute.color = glm::u8vec4(glm::vec4(color, 1.0f) * 255.0f);
+        attribute.scale = RANDF(0.5f, 1.0f);
+        attribute.palette = std::rand() % 4;
+    }
+
+    return attributes;
+}
+
+void Application::addParticleSystems(size_t count, size_t size)
+{
+    octahedronMesh = geometry->addMesh<Vertex>(
+    { // vertices
+        {{1, 0, 0}, {1, 0, 0}},
+        {{-1, 0, 0}, {-1, 0, 0}},
+        {{0, 1, 0}, {0, 1, 0}},
+        {{0, -1, 0}, {0, -1, 0}},
+        {{0, 0, 1}, {0, 0, 1}},
+        {{0, 0, -1}, {0, 0, -1}},
+    },
+    { // indices
+        0, 2, 4,
+        1, 4, 2,
+        0, 4, 3,
+        1, 3, 4,
+        0, 5, 2,
+        1, 2, 5,
+        0, 3, 5,
+        1, 5, 3
+    });
+
+    systems = std::make_unique<ParticleSystems>();
+    const float tickRates[] = { 30.0f, 60.0f, 120.0f };
+
+    for(size_t i = 0; i < count; i++) {
+        // On a ring around the main cloud, each orbiting its own attractor
+        float angle = i * 6.2831853f / count;
+        glm::vec3 center = glm::vec3(std::cos(angle), 0.0f, std::sin(angle)) * 2500.0f;
 
-        if(deltaTime > 1.0) deltaTime = 0.0001;
+        ParticleSystemSettings settings;
+        settings.name = fmt::format("System {}", i);
+        settings.mesh = i % 2 == 0 ? cubeMesh : octahedronMesh;
+        settings.variant.lighting = i % 3 == 0;
+        settings.tickRate = tickRates[i % 3];
+        settings.gravity.attractor = center;
+        settings.gravity.strength = 100000.0f;
 
-        lastUpdateTickTime = deltaTime;
-        updateDesync(deltaTime * timeScale);
+        // Half to twice the given size
+        size_t particles = std::max<size_t>(size * (1 + i % 4) / 2, 1);
+        auto positions = generateRandomVectors(particles, -200.0, 200.0);
+        for(glm::vec3 &position : *positions) {
+            position += center;
+        }
+        auto velocities = generateRandomVectors(particles, -5.0, 5.0);
+
+        systems->add(settings, *positions, *velocities, generateAttributes(particles));
     }
+
+    LOG_INFO("Added {} particle systems with {} particles", systems->getSystemCount(), systems->getInstanceCount());
 }
 
-void Application::updateDesync(double deltaTime)
+void Application::applyControls()
 {
-    std::unique_lock<std::mutex> lock(simMutex);
-    simCondition.wait(lock);
+    integrator.settings = controls.gravity;
+    activity.settings = controls.sleep;
+    depthSorter.settings = controls.depthSort;
+    for(auto [handle, tickRate] : controls.tickRates) {
+        systems->setTickRate(handle, tickRate);
+    }
+    controls.tickRates.clear();
 
-    for(size_t i = 0; i < cubePositions->size(); i++) {
-        glm::vec3 &position = (*cubePositions)[i];
-        glm::vec3 &velocity = (*cubeVelocities)[i];
-        glm::vec3 heading = 0.0f - position;
-        glm::vec3 gravityVector = 1000000.0f * glm::normalize(heading) / ((float)heading.length() * heading.length());
-        velocity += (
-            glm::vec3(
-                RANDF(-1.0f, 1.0f),
-                RANDF(-1.0f, 1.0f),
-                RANDF(-1.0f, 1.0f)
-            ) * (float)deltaTime * 0.0f + gravityVector * (float)deltaTime
-        );
-        position += velocity * (float)deltaTime;
+    tickControls = controls;
+    tickFrameTime = averageFrameTime;
+}
+
+void Application::publishTick()
+{
+    report.timePassed = timePassed;
+    report.workTime = lastTickWorkTime;
+    report.integrator = integrator.getStats();
+    report.awake = activity.getAwakeCount();
+    report.particles = activity.getCount();
+
+    report.gridBuildTime = grid.getLastBuildTime();
+    report.gridQueryTime = grid.getLastQueryTime();
+    report.contacts = lastContactCount;
+
+    report.reorderTime = lastReorderTime;
+    report.tickTimeBeforeReorder = tickTimeBeforeReorder;
+    report.tickTimeAfterReorder = tickTimeAfterReorder;
+    report.frameTimeBeforeReorder = frameTimeBeforeReorder;
+    report.frameTimeAfterReorder = frameTimeAfterReorder;
+
+    if(systems)
+        report.systems = systems->getStats();
+}
+
+void Application::tick(double deltaTime)
+{
+    applyControls();
+    tickStartTime = glfwGetTime();
+
+    reorderStage();
+    integrateStage(deltaTime);
+    collideStage();
+    finishTick(deltaTime);
+    recordStage();
+}
+
+void Application::reorderStage()
+{
+    if(tickControls.reorderOn && ++ticksSinceReorder >= tickControls.reorderInterval) {
+        reorderParticles();
+    }
+    if(ticksSinceReorder == REORDER_SETTLE_TICKS) {
+        tickTimeAfterReorder = averageTickTime;
+        frameTimeAfterReorder = tickFrameTime;
+    }
+}
+
+void Application::integrateStage(double deltaTime)
+{
+    if(wakeRequested.exchange(false))
+        activity.wakeAll();
+
+    integrator.diagnosticsOn = diagnosticsOn;
+    integrator.step(*cubePositions, *cubeVelocities, deltaTime, workers, &activity);
+}
+
+void Application::collideStage()
+{
+    if(tickControls.collisionsOn) {
+        grid.setCellSize(tickControls.particleRadius * 2.0f);
+        grid.build(*cubePositions, workers);
+        lastContactCount = grid.resolveCollisions(*cubePositions, *cubeVelocities,
+            tickControls.particleRadius, tickControls.restitution, workers, &activity);
     }
+}
 
+void Application::finishTick(double deltaTime)
+{
     timePassed += deltaTime;
+    tickCount++;
+
+    lastTickWorkTime = glfwGetTime() - tickStartTime;
+    averageTickTime += (lastTickWorkTime - averageTickTime) * TIMING_SMOOTHING;
+    tickCounter.add();
+    tickTimes.record(lastTickWorkTime);
+
+    if(integrator.diagnosticsOn)
+        recordDiagnostics();
+}
+
+void Application::recordDiagnostics()
+{
+    const SimulationDiagnostics &d = integrator.getDiagnostics();
+    energyGauge.set(d.totalEnergy());
+    momentumGauge.set(glm::length(d.momentum));
+    maxSpeedGauge.set(d.maxSpeed());
+    unboundGauge.set(d.unboundCount);
+    nonFiniteGauge.set(d.nonFiniteCount());
+
+    std::lock_guard<std::mutex> lock(diagnosticsMutex);
+    lastDiagnostics = d;
+
+    if(resetEnergyReference.exchange(false) || !hasEnergyReference) {
+        energyReference = d.totalEnergy();
+        hasEnergyReference = true;
+    }
+    double drift = energyReference != 0.0 ? (d.totalEnergy() - energyReference) / std::abs(energyReference) : 0.0;
+
+    for(auto [history, value] : {std::pair {&energyDriftHistory, (float)drift}, std::pair {&maxSpeedHistory, d.maxSpeed()}}) {
+        if(history->size() >= DIAGNOSTICS_HISTORY_SIZE)
+            history->erase(history->begin());
+        history->push_back(value);
+    }
+}
+
+TunedConfig Application::currentTuning() const
+{
+    return { workers.getThreadCount(), integrator.chunkSize, positionStream->getUploadStrategy() };
+}
+
+void Application::applyTuning(const TunedConfig &config)
+{
+    workers.setThreadCount(config.threadCount);
+    integrator.chunkSize = config.integratorChunkSize;
+    positionStream->setUploadStrategy(config.upload);
+    if(feedStream)
+        feedStream->setUploadStrategy(config.upload);
+}
+
+void Application::runAutoTune()
+{
+    // Nothing here steps particles, so there is nothing to time
+    if(!isSimulated() || cubePositions->empty()) {
+        LOG_INFO("Skipping tuning, no simulated particles");
+        return;
+    }
+
+    lastTuning = tuner->tune(*cubePositions, *cubeVelocities, integrator.settings,
+        BENCHMARK_TIME_STEP * timeScale, currentTuning(), workers, tuneBudget);
+    // A budget too small to time anything leaves the defaults, not worth caching
+    if(lastTuning->candidates == 0)
+        return;
+    applyTuning(lastTuning->config);
+
+    try {
+        tuner->save(lastTuning->config);
+    } catch(std::runtime_error &e) {
+        LOG_ERROR("{}", e.what());
+    }
+}
+
+void Application::recordStage()
+{
+    // Never waits on disk; a full ring drops the snapshot
+    std::lock_guard<std::mutex> lock(recorderMutex);
+    if(recorder)
+        recorder->submit(*cubePositions, tickCount, timePassed);
+}
+
+void Application::reorderParticles()
+{
+    double start = glfwGetTime();
+
+    tickTimeBeforeReorder = averageTickTime;
+    frameTimeBeforeReorder = tickFrameTime;
+
+    morton::computeOrder(*cubePositions, tickControls.reorderWideKeys, workers, reorderIndices);
+    morton::permute(*cubePositions, reorderIndices, workers);
+    morton::permute(*cubeVelocities, reorderIndices, workers);
+    morton::permute(cubeAttributes, reorderIndices, workers);
+    attributesDirty = true;
+    integrator.permute(reorderIndices, workers);
+    activity.permute(reorderIndices, workers);
+    // Its last order refers to the old particle indices
+    depthSorter.reset();
+
+    ticksSinceReorder = 0;
+    lastReorderTime = glfwGetTime() - start;
+}
+
+void Application::advancePlayback()
+{
+    playbackFrame = (playbackFrame + 1) % playback->getFrameCount();
+    playback->readFrame(playbackFrame, *cubePositions);
+}
+
+void Application::startRecording()
+{
+    std::unique_ptr<TrajectoryRecorder> started;
+    try {
+        started = std::make_unique<TrajectoryRecorder>(recordPath, cubePositions->size());
+    } catch(std::runtime_error &e) {
+        LOG_ERROR("{}", e.what());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(recorderMutex);
+    recorder = std::move(started);
+}
+
+void Application::stopRecording()
+{
+    std::unique_ptr<TrajectoryRecorder> stopped;
+    {
+        std::lock_guard<std::mutex> lock(recorderMutex);
+        stopped = std::move(recorder);
+    }
+    // Waits for the writer to flush what is already queued, without
+    // holding up the tick
+    stopped.reset();
 }
 
 void Application::update(double deltaTime)
@@ -282,6 +1247,22 @@ void Application::update(double deltaTime)
         cameraRotation.x += -(float)dy / (float)height * sensitivity;
     }
     
+    updateCameraDirection();
+
+    if(glfwGetMouseButton(getWindow(), GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
+        glfwSetInputMode(getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetInputMode(getWindow(), GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+    } else {
+        glfwSetInputMode(getWindow(), GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+        glfwSetInputMode(getWindow(), GLFW_RAW_MOUSE_MOTION, GLFW_FALSE);
+    }
+
+    if(playback && simRunning)
+        advancePlayback();
+}
+
+void Application::updateCameraDirection()
+{
     constexpr float limitAngle = glm::half_pi<float>() - 0.01;
 
     cameraRotation.x = cameraRotation.x > limitAngle ? limitAngle :
@@ -295,17 +1276,6 @@ void Application::update(double deltaTime)
 
     camera.direction = glm::vec4(camera.direction, 1.0) *
         glm::rotate(cameraRotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
-
-    if(glfwGetMouseButton(getWindow(), GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
-        glfwSetInputMode(getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-        glfwSetInputMode(getWindow(), GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
-    } else {
-        glfwSetInputMode(getWindow(), GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-        glfwSetInputMode(getWindow(), GLFW_RAW_MOUSE_MOTION, GLFW_FALSE);
-    }
-
-    if(simRunning)
-        simCondition.notify_all();
 }
 
 void Application::mouseButton(int key, int action, int mod)
@@ -3,16 +3,79 @@
 #include "camera.hpp"
 #include "material.hpp"
 #include "mesh.hpp"
+#include "geometry.hpp"
+#include "spatialgrid.hpp"
+#include "threadpool.hpp"
+#include "morton.hpp"
+#include "options.hpp"
+#include "camerapath.hpp"
+#include "benchmark.hpp"
+#include "occlusion.hpp"
+#include "integrator.hpp"
+#include "trajectory.hpp"
+#include "sharedfeed.hpp"
+#include "taskgraph.hpp"
+#include "rendertarget.hpp"
+#include "resolution.hpp"
+#include "residency.hpp"
+#include "shadervariant.hpp"
+#include "depthsort.hpp"
+#include "overdraw.hpp"
+#include "splatting.hpp"
+#include "particlesystem.hpp"
+#include "metrics.hpp"
+#include "autotune.hpp"
 #include "window.hpp"
 #include "imgui.hpp"
 
+#include <atomic>
 #include <memory>
 #include <mutex>
-#include <condition_variable>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Simulation settings the UI edits. The tick gets a copy between ticks,
+// so it never sees one changing under it.
+struct SimControls {
+    GravitySettings gravity;
+    SleepSettings sleep;
+    DepthSortSettings depthSort;
+
+    bool collisionsOn = false;
+    float particleRadius = 1.0f;
+    float restitution = 0.5f;
+
+    bool reorderOn = false;
+    bool reorderWideKeys = false;
+    int reorderInterval = 500;
+
+    // Queued until the next tick
+    std::vector<std::pair<SystemHandle, float>> tickRates;
+};
+
+// What the UI shows of the last finished tick
+struct TickReport {
+    double timePassed;
+    float workTime;
+    BlockIntegrator::Stats integrator;
+    size_t awake;
+    size_t particles;
+
+    double gridBuildTime;
+    double gridQueryTime;
+    size_t contacts;
+
+    float reorderTime;
+    float tickTimeBeforeReorder, tickTimeAfterReorder;
+    float frameTimeBeforeReorder, frameTimeAfterReorder;
+
+    ParticleSystems::Stats systems;
+};
 
 class Application : public Window {
 public:
-    Application();
+    Application(const LaunchOptions &options);
     ~Application();
 
     void run();
@@ -24,19 +87,72 @@ protected:
     void keyboardCallback(int key, int action, int scancode, int mod) override;
 
 private: // methods
-    void updateThread();
+    void runFrame(double deltaTime);
+    void runBenchmark();
+    void recordFrameMetrics(double frameTime);
+
+    // Frame graph
+    Task spawnTick(double deltaTime);
+    Task inputTask(double deltaTime);
+    Task uploadTask(Task tick, double deltaTime);
+    Task drawTask(Task input, Task upload);
+    Task uiTask(Task draw, double deltaTime);
+    Task submitTask(Task ui);
+    Task reorderTask(Task previous);
+    Task integrateTask(Task reorder, double deltaTime);
+    Task collideTask(Task integrate, double deltaTime);
+    Task recordTask(Task collide);
+    Task systemsTask(double deltaTime, float timeScale);
+    Task joinTask(Task first, Task second);
+
+    // Only on the main thread, with no tick running
+    void applyControls();
+    void publishTick();
+
+    // A whole tick in one go, for lockstep benchmarks
+    void tick(double deltaTime);
+    void reorderStage();
+    void integrateStage(double deltaTime);
+    void collideStage();
+    void finishTick(double deltaTime);
+    void recordDiagnostics();
+
+    TunedConfig currentTuning() const;
+    void applyTuning(const TunedConfig &config);
+    // Only between frames, with no tick running
+    void runAutoTune();
+    void recordStage();
+
+    // Demo systems of varied sizes, meshes, materials and tick rates
+    void addParticleSystems(size_t count, size_t size);
 
-    void updateDesync(double deltaTime);
+    void reorderParticles();
+    void advancePlayback();
+    void startRecording();
+    void stopRecording();
     void update(double deltaTime);
+    void updateCameraDirection();
     void render(double deltaTime);
+    void uploadInstances();
+    void uploadSorted();
+    void drawScene();
+    void bindPulledInstances(GLuint indices);
 
     void render_ui(double deltaTime);
 
 private: // helpers
+    size_t getInstanceCount() const;
+    bool isSimulated() const { return !playback && !feed && !residency; }
+    glm::mat4 getProjectionView();
     static std::unique_ptr<std::vector<glm::vec3>> generateRandomVectors(size_t size, float min, float max);
+    static std::vector<InstanceAttributes> generateAttributes(size_t size);
 
 private: // stack allocated (default constructor)
     ImguiInstance imguiInstance;
+    ThreadPool workers;
+    TaskScheduler scheduler;
+    SpatialGrid grid;
+    DepthSorter depthSorter;
 
     // Camera
     Camera camera;
@@ -49,21 +165,131 @@ private: // stack allocated (default constructor)
     float lastUpdateTickTime = 0.0f;
     float timeScale = 0.01f;
     bool simRunning = true;
+    uint64_t tickCount = 0;
+    double tickStartTime = 0.0;
+    BlockIntegrator integrator;
+    ActivityTracker activity;
+    std::atomic<bool> wakeRequested = false;
 
-    // Buffers
-    GLuint instanceVBO;
+    // The UI's copy, the running tick's copy and what it reported back
+    SimControls controls;
+    SimControls tickControls;
+    TickReport report = {};
+    // averageFrameTime when the tick was started
+    float tickFrameTime = 0.0f;
 
-    // Threading
-    std::mutex simMutex;
-    std::condition_variable simCondition;
+    // Collisions
+    size_t lastContactCount = 0;
+
+    // Morton reordering
+    int ticksSinceReorder = 0;
+    float lastReorderTime = 0.0f;
+    std::vector<uint32_t> reorderIndices;
+
+    // Smoothed timings, to compare before and after a reorder
+    float lastTickWorkTime = 0.0f;
+    float averageTickTime = 0.0f;
+    float averageFrameTime = 0.0f;
+    float tickTimeBeforeReorder = 0.0f, tickTimeAfterReorder = 0.0f;
+    float frameTimeBeforeReorder = 0.0f, frameTimeAfterReorder = 0.0f;
+
+    // Trajectory recording
+    std::string recordPath = "trajectory.traj";
+    size_t playbackFrame = 0;
+
+    // Instance streams
+    std::atomic<bool> attributesDirty = false;
+    size_t lastUploadBytes = 0;
+    std::vector<ActivityTracker::Span> dirtySpans;
+    size_t lastUploadSpans = 0;
+
+    // Front-to-back order, only for instances kept in memory
+    bool depthSortOn = false;
+    bool streamsSorted = false;
+    bool measureOverdraw = false;
+    std::vector<glm::vec3> sortedPositions;
+    std::vector<InstanceAttributes> sortedAttributes;
+
+    // Threading. The stages are ordered by the task graph; this only
+    // guards the recorder, which the UI starts and stops.
+    std::mutex recorderMutex;
+    Task nextTick;
+    Task lastRecord;
+    TaskScheduler::FrameStats frameStats = {};
+
+    // Metrics
+    metrics::Counter &frameCounter = metrics::counter("frames");
+    metrics::Counter &tickCounter = metrics::counter("ticks");
+    metrics::Histogram &frameTimes = metrics::histogram("frame_time");
+    metrics::Histogram &tickTimes = metrics::histogram("tick_time");
+    metrics::Gauge &instanceGauge = metrics::gauge("instances");
+    metrics::Gauge &scaleGauge = metrics::gauge("resolution_scale");
+    metrics::CounterRates metricRates;
+    std::vector<float> metricValues;
+
+    // Simulation diagnostics, kept by the tick for the UI
+    std::atomic<bool> diagnosticsOn = false;
+    std::atomic<bool> resetEnergyReference = false;
+    std::mutex diagnosticsMutex;
+    SimulationDiagnostics lastDiagnostics;
+    double energyReference = 0.0;
+    bool hasEnergyReference = false;
+    std::vector<float> energyDriftHistory;
+    std::vector<float> maxSpeedHistory;
+    metrics::Gauge &energyGauge = metrics::gauge("sim_energy");
+    metrics::Gauge &momentumGauge = metrics::gauge("sim_momentum");
+    metrics::Gauge &maxSpeedGauge = metrics::gauge("sim_max_speed");
+    metrics::Gauge &unboundGauge = metrics::gauge("sim_unbound");
+    metrics::Gauge &nonFiniteGauge = metrics::gauge("sim_non_finite");
+
+    // Render resolution
+    float resolutionScale = 1.0f;
+    int msaaSamples = 8;
+    UpscaleFilter upscaleFilter = UpscaleFilter::Sharpen;
+    float sharpness = 0.5f;
+
+    // Cube shader features
+    ShaderVariant cubeVariant;
 
     // Additional
     bool wireframeOn = false;
+    bool occlusionCullingOn = false;
+    bool splattingOn = false;
+
+    // Auto-tuning
+    std::atomic<bool> tuneRequested = false;
+    double tuneBudget = 3.0;
+    std::optional<AutoTuner::Result> lastTuning;
 
 private: // smart ptrs / heap
-    std::shared_ptr<Mesh> cubeMesh;
+    std::unique_ptr<InstanceStream> positionStream;
+    std::unique_ptr<InstanceStream> feedStream; // spare for feed reads, swapped in when intact
+    std::unique_ptr<InstanceStream> attributeStream;
+    std::unique_ptr<GeometryArena> geometry;
+    std::unique_ptr<OcclusionCuller> culler;
+    std::unique_ptr<PointSplatter> splatter;
+    std::unique_ptr<RenderTarget> renderTarget;
+    std::unique_ptr<ResolutionController> resolution;
+    std::unique_ptr<OverdrawCounter> overdraw;
+    MeshHandle cubeMesh;
+    MeshHandle octahedronMesh;
+    std::unique_ptr<MaterialVariants> cubeMaterials;
     std::shared_ptr<Material> mat;
 
+    std::unique_ptr<CameraPath> cameraPath;
+    std::unique_ptr<Benchmark> benchmark;
+    std::unique_ptr<MetricsExporter> metricsExporter;
+    std::unique_ptr<AutoTuner> tuner;
+
+    std::unique_ptr<TrajectoryRecorder> recorder;
+    std::unique_ptr<TrajectoryReader> playback;
+    std::unique_ptr<FeedConsumer> feed;
+    std::unique_ptr<ChunkedDataset> chunkedData;
+    std::unique_ptr<ChunkResidency> residency;
+
+    std::unique_ptr<ParticleSystems> systems;
+
     std::unique_ptr<std::vector<glm::vec3>> cubePositions;
     std::unique_ptr<std::vector<glm::vec3>> cubeVelocities;
+    std::vector<InstanceAttributes> cubeAttributes;
 };
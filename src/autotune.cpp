@@ -0,0 +1,262 @@
+#include "autotune.hpp"
+#include "integrator.hpp"
+#include "mesh.hpp"
+#include "log.hpp"
+
+#include <GL/glew.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+constexpr size_t CHUNK_SIZE_CANDIDATES[] = { 1024, 4096, 16384 };
+constexpr size_t SIMULATION_REPEATS = 3;
+constexpr size_t UPLOAD_REPEATS = 5;
+// A candidate has to be this much faster to replace the current config
+constexpr double MIN_IMPROVEMENT = 0.03;
+// Part of the budget the simulation may use, the rest is for uploads
+constexpr double SIMULATION_SHARE = 0.75;
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+static std::string cpuModel()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while(std::getline(cpuinfo, line)) {
+        if(line.rfind("model name", 0) != 0)
+            continue;
+
+        size_t start = line.find_first_not_of(" \t", line.find(':') + 1);
+        if(start != std::string::npos)
+            return line.substr(start);
+    }
+    return "unknown CPU";
+}
+
+static std::optional<UploadStrategy> parseUploadStrategy(const std::string &name)
+{
+    for(uint32_t i = 0; i < UPLOAD_STRATEGY_COUNT; i++) {
+        if(name == uploadStrategyName((UploadStrategy)i))
+            return (UploadStrategy)i;
+    }
+    return std::nullopt;
+}
+
+AutoTuner::AutoTuner(const std::string &cachePath) : cachePath(cachePath), machine(fingerprint())
+{
+    LOG_DEBUG("Created auto-tuner for '{}'", machine);
+}
+
+AutoTuner::~AutoTuner()
+{
+    LOG_DEBUG("Destroyed auto-tuner");
+}
+
+std::string AutoTuner::fingerprint()
+{
+    const char *renderer = (const char*)glGetString(GL_RENDERER);
+    const char *version = (const char*)glGetString(GL_VERSION);
+
+    std::string result = fmt::format("{} x{} / {} / {}",
+        cpuModel(), std::thread::hardware_concurrency(), renderer ? renderer : "?", version ? version : "?");
+
+    // Tabs and newlines would break the cache file
+    std::replace_if(result.begin(), result.end(), [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+    return result;
+}
+
+std::optional<TunedConfig> AutoTuner::load() const
+{
+    std::ifstream file(cachePath);
+    if(!file.is_open())
+        return std::nullopt;
+
+    std::string prefix = machine + '\t';
+    std::string line;
+    while(std::getline(file, line)) {
+        if(line.compare(0, prefix.size(), prefix) != 0)
+            continue;
+
+        std::istringstream fields(line.substr(prefix.size()));
+        TunedConfig config;
+        std::string upload;
+        fields >> config.threadCount >> config.integratorChunkSize >> upload;
+
+        std::optional<UploadStrategy> strategy = parseUploadStrategy(upload);
+        if(fields.fail() || !strategy || config.threadCount == 0 || config.integratorChunkSize == 0) {
+            LOG_WARN("Ignoring broken auto-tune entry in {}", cachePath);
+            return std::nullopt;
+        }
+        config.upload = *strategy;
+        return config;
+    }
+    return std::nullopt;
+}
+
+void AutoTuner::save(const TunedConfig &config) const
+{
+    std::string prefix = machine + '\t';
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(cachePath);
+        std::string line;
+        while(std::getline(file, line)) {
+            if(line.compare(0, prefix.size(), prefix) != 0)
+                lines.push_back(line);
+        }
+    }
+    lines.push_back(fmt::format("{}{} {} {}",
+        prefix, config.threadCount, config.integratorChunkSize, uploadStrategyName(config.upload)));
+
+    std::ofstream file(cachePath, std::ios::trunc);
+    if(!file.is_open())
+        throw std::runtime_error(fmt::format("Failed to open {} for writing!", cachePath));
+
+    for(const std::string &line : lines) {
+        file << line << '\n';
+    }
+}
+
+AutoTuner::Result AutoTuner::tune(
+    const std::vector<glm::vec3> &positions,
+    const std::vector<glm::vec3> &velocities,
+    const GravitySettings &gravity, float deltaTime,
+    const TunedConfig &current, ThreadPool &pool, double budget)
+{
+    double start = now();
+
+    Result result = {};
+    result.config = current;
+
+    // The current config goes first, so it's measured whatever the budget
+    size_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::pair<size_t, size_t>> candidates = { { current.threadCount, current.integratorChunkSize } };
+    for(size_t threads : { hardware, hardware - 1, hardware / 2 }) {
+        for(size_t chunkSize : CHUNK_SIZE_CANDIDATES) {
+            std::pair<size_t, size_t> candidate = { threads, chunkSize };
+            if(threads > 0 && std::find(candidates.begin(), candidates.end(), candidate) == candidates.end())
+                candidates.push_back(candidate);
+        }
+    }
+
+    // Simulation, on copies so the real particles don't move
+    if(!positions.empty() && velocities.size() == positions.size()) {
+        std::vector<glm::vec3> stepPositions, stepVelocities;
+        double baseline = 0.0, best = INFINITY, slowest = 0.0;
+
+        for(auto [threads, chunkSize] : candidates) {
+            double candidateStart = now();
+            // Don't start one that won't fit
+            if(result.candidates > 0 && candidateStart + slowest - start > budget * SIMULATION_SHARE)
+                break;
+
+            pool.setThreadCount(threads);
+            BlockIntegrator integrator;
+            integrator.settings = gravity;
+            integrator.chunkSize = chunkSize;
+
+            stepPositions = positions;
+            stepVelocities = velocities;
+            // The first step also fills in the accelerations
+            integrator.step(stepPositions, stepVelocities, deltaTime, pool);
+
+            std::vector<double> times;
+            for(size_t i = 0; i < SIMULATION_REPEATS; i++) {
+                double stepStart = now();
+                integrator.step(stepPositions, stepVelocities, deltaTime, pool);
+                times.push_back(now() - stepStart);
+            }
+
+            double time = median(times);
+            LOG_DEBUG("Auto-tune: {} threads, chunks of {}: {:.3f}ms", threads, chunkSize, time * 1e3);
+
+            if(result.candidates++ == 0)
+                baseline = time;
+            if(time < best) {
+                best = time;
+                result.config.threadCount = threads;
+                result.config.integratorChunkSize = chunkSize;
+            }
+            slowest = std::max(slowest, now() - candidateStart);
+        }
+
+        // Within the noise, stay where we are
+        if(best > baseline * (1.0 - MIN_IMPROVEMENT)) {
+            result.config.threadCount = current.threadCount;
+            result.config.integratorChunkSize = current.integratorChunkSize;
+            best = baseline;
+        }
+        result.tickTime = best;
+    }
+    pool.setThreadCount(result.config.threadCount);
+
+    // Uploads, each one waited for so the driver can't hide the copy
+    if(!positions.empty()) {
+        std::unique_ptr<InstanceStream> stream = InstanceStream::create<InstanceOffset>(StreamFrequency::Dynamic);
+        double baseline = 0.0, best = INFINITY;
+        bool first = true;
+
+        std::vector<UploadStrategy> strategies = { current.upload };
+        for(uint32_t i = 0; i < UPLOAD_STRATEGY_COUNT; i++) {
+            if((UploadStrategy)i != current.upload)
+                strategies.push_back((UploadStrategy)i);
+        }
+
+        for(UploadStrategy strategy : strategies) {
+            if(!first && now() - start > budget)
+                break;
+
+            stream->setUploadStrategy(strategy);
+            stream->upload(positions);
+            glFinish();
+
+            std::vector<double> times;
+            for(size_t i = 0; i < UPLOAD_REPEATS; i++) {
+                double uploadStart = now();
+                stream->upload(positions);
+                glFinish();
+                times.push_back(now() - uploadStart);
+            }
+
+            double time = median(times);
+            LOG_DEBUG("Auto-tune: {} uploads: {:.3f}ms", uploadStrategyName(strategy), time * 1e3);
+
+            result.candidates++;
+            if(first)
+                baseline = time;
+            if(time < best) {
+                best = time;
+                result.config.upload = strategy;
+            }
+            first = false;
+        }
+
+        if(best > baseline * (1.0 - MIN_IMPROVEMENT)) {
+            result.config.upload = current.upload;
+            best = baseline;
+        }
+        result.uploadTime = best;
+    }
+
+    result.elapsed = now() - start;
+    LOG_INFO("Auto-tuned in {:.2f}s over {} candidates: {} threads, chunks of {}, {} uploads",
+        result.elapsed, result.candidates, result.config.threadCount,
+        result.config.integratorChunkSize, uploadStrategyName(result.config.upload));
+    return result;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "forcelaw.hpp"
+#include "instancestream.hpp"
+#include "threadpool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+struct TunedConfig {
+    size_t threadCount;
+    size_t integratorChunkSize;
+    UploadStrategy upload;
+};
+
+// Picks the worker thread count, integrator chunk size and upload
+// strategy that are fastest on this machine by timing candidates on the
+// actual particles, within a time budget.
+//
+// Winners are cached per machine, keyed by a fingerprint of the CPU model,
+// its thread count and the GL renderer and driver, so one cache file can
+// be shared by different hosts. Each line of the file is
+//   fingerprint <tab> threads chunk-size upload-strategy
+class AutoTuner {
+public:
+    struct Result {
+        TunedConfig config;
+        double tickTime;   // median of the winner
+        double uploadTime;
+        size_t candidates; // configurations timed
+        double elapsed;
+    };
+
+    AutoTuner(const std::string &cachePath);
+    ~AutoTuner();
+
+    // Needs a current GL context
+    static std::string fingerprint();
+
+    std::optional<TunedConfig> load() const;
+    // Replaces this machine's line, keeping the others
+    void save(const TunedConfig &config) const;
+
+    // The particles are copied, not stepped. A candidate has to clearly
+    // beat the current config to replace it. Leaves the pool with the
+    // winning thread count.
+    Result tune(
+        const std::vector<glm::vec3> &positions,
+        const std::vector<glm::vec3> &velocities,
+        const GravitySettings &gravity, float deltaTime,
+        const TunedConfig &current, ThreadPool &pool, double budget
+    );
+
+    const std::string &getFingerprint() const { return machine; }
+    const std::string &getCachePath() const { return cachePath; }
+
+private:
+    std::string cachePath;
+    std::string machine;
+};
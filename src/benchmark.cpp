@@ -0,0 +1,212 @@
+#include "benchmark.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+Benchmark::Benchmark(const LaunchOptions &options) : options(options), frameCount(options.benchmarkFrames)
+{
+    renderer = (const char*)glGetString(GL_RENDERER);
+    frames.reserve(frameCount);
+    if(options.diagnostics)
+        diagnostics.reserve(frameCount);
+
+    glGenQueries(QUERY_RING_SIZE, queries);
+
+    LOG_INFO("Benchmarking {} frames of '{}' with {} particles, seed {}",
+        frameCount, options.benchmarkPath, options.particleCount, options.seed);
+}
+
+Benchmark::~Benchmark()
+{
+    glDeleteQueries(QUERY_RING_SIZE, queries);
+}
+
+void Benchmark::beginFrame()
+{
+    // Reuse the query of the frame QUERY_RING_SIZE frames back
+    if(frameIndex >= QUERY_RING_SIZE)
+        collectQuery(frameIndex - QUERY_RING_SIZE);
+
+    glBeginQuery(GL_TIME_ELAPSED, queries[frameIndex % QUERY_RING_SIZE]);
+}
+
+void Benchmark::endFrame(double cpuTime, const SimulationDiagnostics *frameDiagnostics)
+{
+    glEndQuery(GL_TIME_ELAPSED);
+
+    frames.push_back(FrameTiming { cpuTime, 0.0 });
+    if(frameDiagnostics)
+        diagnostics.push_back(*frameDiagnostics);
+    frameIndex++;
+}
+
+void Benchmark::collectQuery(size_t frame)
+{
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(queries[frame % QUERY_RING_SIZE], GL_QUERY_RESULT, &elapsed);
+    frames[frame].gpu = elapsed * 1e-9;
+}
+
+void Benchmark::finish()
+{
+    size_t pending = std::min(frameIndex, QUERY_RING_SIZE);
+    for(size_t frame = frameIndex - pending; frame < frameIndex; frame++) {
+        collectQuery(frame);
+    }
+
+    const std::string &path = options.benchmarkOutput;
+    if(path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0) {
+        writeCsv(path);
+    } else {
+        writeJson(path);
+    }
+
+    Summary cpu = summarize(&FrameTiming::cpu);
+    Summary gpu = summarize(&FrameTiming::gpu);
+    LOG_INFO("CPU p50 {:.3f}ms p99 {:.3f}ms max {:.3f}ms", cpu.p50 * 1e3, cpu.p99 * 1e3, cpu.max * 1e3);
+    LOG_INFO("GPU p50 {:.3f}ms p99 {:.3f}ms max {:.3f}ms", gpu.p50 * 1e3, gpu.p99 * 1e3, gpu.max * 1e3);
+    if(hasDiagnostics()) {
+        double start = diagnostics.front().totalEnergy(), end = diagnostics.back().totalEnergy();
+        LOG_INFO("Energy {:.6g} -> {:.6g}, {} non-finite particles at the end",
+            start, end, diagnostics.back().nonFiniteCount());
+    }
+    LOG_INFO("Wrote benchmark results to {}", path);
+}
+
+Benchmark::Summary Benchmark::summarize(double FrameTiming::*field) const
+{
+    Summary summary = {};
+    if(frames.empty())
+        return summary;
+
+    std::vector<double> sorted;
+    sorted.reserve(frames.size());
+    for(size_t i = 0; i < frames.size(); i++) {
+        double value = frames[i].*field;
+        sorted.push_back(value);
+        summary.mean += value;
+        if(value > summary.max) {
+            summary.max = value;
+            summary.worstFrame = i;
+        }
+    }
+    summary.mean /= frames.size();
+
+    std::sort(sorted.begin(), sorted.end());
+
+    // Nearest rank
+    auto percentile = [&](double p) {
+        size_t rank = (size_t)std::ceil(p * sorted.size());
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    };
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+
+    return summary;
+}
+
+static std::string jsonEscape(const std::string &str)
+{
+    std::string result;
+    for(char c : str) {
+        if(c == '"' || c == '\\') result += '\\';
+        if((unsigned char)c < 0x20) continue;
+        result += c;
+    }
+    return result;
+}
+
+static std::string summaryJson(const char *name, const Benchmark::Summary &s)
+{
+    return fmt::format(
+        "  \"{}\": {{\"mean\": {:.6f}, \"p50\": {:.6f}, \"p95\": {:.6f}, \"p99\": {:.6f}, \"max\": {:.6f}, \"worst_frame\": {}}}",
+        name, s.mean * 1e3, s.p50 * 1e3, s.p95 * 1e3, s.p99 * 1e3, s.max * 1e3, s.worstFrame
+    );
+}
+
+std::string Benchmark::diagnosticsJson() const
+{
+    const SimulationDiagnostics &first = diagnostics.front(), &last = diagnostics.back();
+    double start = first.totalEnergy(), end = last.totalEnergy();
+
+    float maxSpeed = 0.0f;
+    size_t maxNonFinite = 0;
+    for(const SimulationDiagnostics &d : diagnostics) {
+        maxSpeed = std::max(maxSpeed, d.maxSpeed());
+        maxNonFinite = std::max(maxNonFinite, d.nonFiniteCount());
+    }
+
+    return fmt::format(
+        "  \"diagnostics\": {{\"energy_start\": {:.9g}, \"energy_end\": {:.9g}, \"energy_drift\": {:.9g}, "
+        "\"momentum_end\": [{:.9g}, {:.9g}, {:.9g}], \"max_speed\": {:.6g}, \"max_non_finite\": {}, "
+        "\"nan_end\": {}, \"inf_end\": {}, \"unbound_end\": {}, "
+        "\"bounds_min\": [{:.6g}, {:.6g}, {:.6g}], \"bounds_max\": [{:.6g}, {:.6g}, {:.6g}]}}",
+        start, end, start != 0.0 ? (end - start) / std::abs(start) : 0.0,
+        last.momentum.x, last.momentum.y, last.momentum.z, maxSpeed, maxNonFinite,
+        last.nanCount, last.infCount, last.unboundCount,
+        last.boundsMin.x, last.boundsMin.y, last.boundsMin.z, last.boundsMax.x, last.boundsMax.y, last.boundsMax.z
+    );
+}
+
+void Benchmark::writeJson(const std::string &path) const
+{
+    std::ofstream file(path);
+    if(!file.is_open())
+        throw std::runtime_error(fmt::format("Failed to open {} for writing!", path));
+
+    file << "{\n";
+    file << fmt::format("  \"camera_path\": \"{}\",\n", jsonEscape(options.benchmarkPath));
+    file << fmt::format("  \"renderer\": \"{}\",\n", jsonEscape(renderer));
+    file << fmt::format("  \"seed\": {},\n", options.seed);
+    file << fmt::format("  \"particles\": {},\n", options.particleCount);
+    file << fmt::format("  \"frames\": {},\n", frames.size());
+    file << summaryJson("cpu_ms", summarize(&FrameTiming::cpu)) << ",\n";
+    file << summaryJson("gpu_ms", summarize(&FrameTiming::gpu)) << ",\n";
+    if(hasDiagnostics())
+        file << diagnosticsJson() << ",\n";
+
+    file << "  \"per_frame\": [\n";
+    for(size_t i = 0; i < frames.size(); i++) {
+        std::string extra;
+        if(hasDiagnostics()) {
+            const SimulationDiagnostics &d = diagnostics[i];
+            extra = fmt::format(", \"energy\": {:.9g}, \"max_speed\": {:.6g}, \"non_finite\": {}",
+                d.totalEnergy(), d.maxSpeed(), d.nonFiniteCount());
+        }
+        file << fmt::format("    {{\"cpu_ms\": {:.6f}, \"gpu_ms\": {:.6f}{}}}{}\n",
+            frames[i].cpu * 1e3, frames[i].gpu * 1e3, extra, i + 1 < frames.size() ? "," : "");
+    }
+    file << "  ]\n";
+    file << "}\n";
+}
+
+void Benchmark::writeCsv(const std::string &path) const
+{
+    std::ofstream file(path);
+    if(!file.is_open())
+        throw std::runtime_error(fmt::format("Failed to open {} for writing!", path));
+
+    file << (hasDiagnostics() ? "frame,cpu_ms,gpu_ms,energy,max_speed,non_finite\n" : "frame,cpu_ms,gpu_ms\n");
+    for(size_t i = 0; i < frames.size(); i++) {
+        file << fmt::format("{},{:.6f},{:.6f}", i, frames[i].cpu * 1e3, frames[i].gpu * 1e3);
+        if(hasDiagnostics()) {
+            const SimulationDiagnostics &d = diagnostics[i];
+            file << fmt::format(",{:.9g},{:.6g},{}", d.totalEnergy(), d.maxSpeed(), d.nonFiniteCount());
+        }
+        file << "\n";
+    }
+
+    // Summary table follows after a blank line
+    file << "\nmetric,mean,p50,p95,p99,max,worst_frame\n";
+    for(auto [name, field] : {std::pair {"cpu_ms", &FrameTiming::cpu}, std::pair {"gpu_ms", &FrameTiming::gpu}}) {
+        Summary s = summarize(field);
+        file << fmt::format("{},{:.6f},{:.6f},{:.6f},{:.6f},{:.6f},{}\n",
+            name, s.mean * 1e3, s.p50 * 1e3, s.p95 * 1e3, s.p99 * 1e3, s.max * 1e3, s.worstFrame);
+    }
+}
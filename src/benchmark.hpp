@@ -0,0 +1,62 @@
+#pragma once
+
+#include "options.hpp"
+#include "diagnostics.hpp"
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+
+// Collects per-frame CPU and GPU times for a fixed number of frames
+// and writes them out with percentile summaries.
+class Benchmark {
+public:
+    Benchmark(const LaunchOptions &options);
+    ~Benchmark();
+
+    // Wrap the GL work of a frame; GPU times are read back a few frames late
+    void beginFrame();
+    // Diagnostics of the frame's tick, if it ran with them
+    void endFrame(double cpuTime, const SimulationDiagnostics *diagnostics = nullptr);
+
+    bool isFinished() const { return frameIndex >= frameCount; }
+    size_t getFrameIndex() const { return frameIndex; }
+    size_t getFrameCount() const { return frameCount; }
+
+    // Reads back outstanding queries and writes the results file
+    void finish();
+
+    struct Summary {
+        double mean, p50, p95, p99, max;
+        size_t worstFrame;
+    };
+
+private:
+    struct FrameTiming {
+        double cpu;
+        double gpu;
+    };
+
+    static constexpr size_t QUERY_RING_SIZE = 4;
+
+    void collectQuery(size_t frame);
+    Summary summarize(double FrameTiming::*field) const;
+
+    bool hasDiagnostics() const { return !diagnostics.empty() && diagnostics.size() == frames.size(); }
+    std::string diagnosticsJson() const;
+
+    void writeJson(const std::string &path) const;
+    void writeCsv(const std::string &path) const;
+
+    LaunchOptions options;
+    std::string renderer;
+
+    size_t frameIndex = 0;
+    size_t frameCount;
+    std::vector<FrameTiming> frames;
+    // Only filled when every frame came with them
+    std::vector<SimulationDiagnostics> diagnostics;
+
+    GLuint queries[QUERY_RING_SIZE];
+};
@@ -18,3 +18,6 @@ public: // public properties
     float nearPlane, farPlane;
     float fovY;
 };
+
+// Normalized planes of the view frustum, pointing inwards
+void extractFrustumPlanes(const glm::mat4 &projectionView, glm::vec4 planes[6]);
@@ -0,0 +1,92 @@
+#include "camerapath.hpp"
+#include "fileutil.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+template<typename T>
+static T catmullRom(const T &p0, const T &p1, const T &p2, const T &p3, float t)
+{
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return 0.5f * (
+        2.0f * p1 +
+        (p2 - p0) * t +
+        (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+        (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3
+    );
+}
+
+CameraPath::CameraPath(std::vector<CameraKeyframe> keyframes) : keyframes(std::move(keyframes))
+{
+    if(this->keyframes.empty())
+        throw std::runtime_error("Camera path has no keyframes");
+
+    std::stable_sort(this->keyframes.begin(), this->keyframes.end(),
+        [](const CameraKeyframe &a, const CameraKeyframe &b) { return a.time < b.time; });
+
+    LOG_DEBUG("Created camera path with {} keyframes, {}s long", this->keyframes.size(), getDuration());
+}
+
+CameraPath CameraPath::loadFromFile(const std::string &path)
+{
+    std::istringstream file(utils::readFileToEnd(path));
+    std::vector<CameraKeyframe> keyframes;
+
+    std::string line;
+    size_t lineNumber = 0;
+    while(std::getline(file, line)) {
+        lineNumber++;
+
+        line = line.substr(0, line.find('#'));
+        if(line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        std::istringstream fields(line);
+        CameraKeyframe keyframe;
+        fields >> keyframe.time
+            >> keyframe.origin.x >> keyframe.origin.y >> keyframe.origin.z
+            >> keyframe.rotation.x >> keyframe.rotation.y >> keyframe.rotation.z;
+
+        if(fields.fail())
+            throw std::runtime_error(fmt::format("{}:{}: expected 'time x y z pitch yaw roll'", path, lineNumber));
+
+        keyframes.push_back(keyframe);
+    }
+
+    return CameraPath(std::move(keyframes));
+}
+
+void CameraPath::sample(float time, glm::vec3 &origin, glm::vec3 &rotation) const
+{
+    if(keyframes.size() == 1 || time <= keyframes.front().time) {
+        origin = keyframes.front().origin;
+        rotation = keyframes.front().rotation;
+        return;
+    }
+    if(time >= keyframes.back().time) {
+        origin = keyframes.back().origin;
+        rotation = keyframes.back().rotation;
+        return;
+    }
+
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+        [](float time, const CameraKeyframe &keyframe) { return time < keyframe.time; });
+    size_t i = next - keyframes.begin() - 1;
+
+    // End points are repeated to clamp the spline
+    const CameraKeyframe &k0 = keyframes[i == 0 ? 0 : i - 1];
+    const CameraKeyframe &k1 = keyframes[i];
+    const CameraKeyframe &k2 = keyframes[i + 1];
+    const CameraKeyframe &k3 = keyframes[std::min(i + 2, keyframes.size() - 1)];
+
+    float span = k2.time - k1.time;
+    float t = span > 0.0f ? (time - k1.time) / span : 0.0f;
+
+    origin = catmullRom(k0.origin, k1.origin, k2.origin, k3.origin, t);
+    rotation = catmullRom(k0.rotation, k1.rotation, k2.rotation, k3.rotation, t);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+struct CameraKeyframe {
+    float time;
+    glm::vec3 origin;
+    glm::vec3 rotation;
+};
+
+// Keyframed camera flight, interpolated with a Catmull-Rom spline.
+//
+// Text format, one keyframe per line, '#' starts a comment:
+//     time  x y z  pitch yaw roll
+class CameraPath {
+public:
+    CameraPath(std::vector<CameraKeyframe> keyframes);
+
+    static CameraPath loadFromFile(const std::string &path);
+
+    void sample(float time, glm::vec3 &origin, glm::vec3 &rotation) const;
+    float getDuration() const { return keyframes.back().time; }
+
+private:
+    std::vector<CameraKeyframe> keyframes;
+};
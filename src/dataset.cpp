@@ -0,0 +1,274 @@
+#include "dataset.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char DATASET_MAGIC[8] = {'G', 'L', 'I', 'C', 'H', 'N', 'K', '1'};
+
+static size_t alignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static size_t tablesEnd(size_t chunkCount)
+{
+    size_t groupCount = (chunkCount + dataset::GROUP_SIZE - 1) / dataset::GROUP_SIZE;
+    return alignUp(sizeof(dataset::FileHeader)
+        + chunkCount * sizeof(dataset::ChunkEntry)
+        + groupCount * sizeof(dataset::GroupEntry), dataset::PAGE_SIZE);
+}
+
+static dataset::Bounds toBounds(const float min[3], const float max[3])
+{
+    return { glm::vec3(min[0], min[1], min[2]), glm::vec3(max[0], max[1], max[2]) };
+}
+
+static void storeBounds(const glm::vec3 &min, const glm::vec3 &max, float outMin[3], float outMax[3])
+{
+    for(int axis = 0; axis < 3; axis++) {
+        outMin[axis] = min[axis];
+        outMax[axis] = max[axis];
+    }
+}
+
+size_t dataset::chunkBytes(uint32_t chunkCapacity)
+{
+    return alignUp(chunkCapacity * sizeof(glm::vec3), PAGE_SIZE);
+}
+
+DatasetWriter::DatasetWriter(const std::string &path, uint32_t chunkCapacity, size_t chunkCount) :
+    path(path), chunkCapacity(chunkCapacity), chunkCount(chunkCount)
+{
+    if(chunkCapacity == 0 || chunkCount == 0)
+        throw std::runtime_error("A dataset needs at least one chunk with room for a point");
+
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        throw std::runtime_error(fmt::format("Failed to create {}: {}", path, std::strerror(errno)));
+
+    dataOffset = tablesEnd(chunkCount);
+    chunks.reserve(chunkCount);
+
+    LOG_DEBUG("Writing dataset {} ({} chunks of {} points)", path, chunkCount, chunkCapacity);
+}
+
+DatasetWriter::~DatasetWriter()
+{
+    if(!finished)
+        LOG_WARN("Dataset {} was not finished and is unreadable", path);
+    close(fd);
+}
+
+void DatasetWriter::writeAt(const void *data, size_t size, size_t offset)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+    while(size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            throw std::runtime_error(fmt::format("Failed to write {}: {}", path, std::strerror(errno)));
+        }
+        bytes += written;
+        offset += written;
+        size -= written;
+    }
+}
+
+void DatasetWriter::addChunk(const glm::vec3 *points, size_t count)
+{
+    if(chunks.size() >= chunkCount)
+        throw std::runtime_error(fmt::format("{} already has all of its {} chunks", path, chunkCount));
+    if(count > chunkCapacity)
+        throw std::runtime_error(fmt::format("Chunk of {} points is over the capacity of {}", count, chunkCapacity));
+
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for(size_t i = 0; i < count; i++) {
+        min = glm::min(min, points[i]);
+        max = glm::max(max, points[i]);
+    }
+    if(count == 0)
+        min = max = glm::vec3(0.0f);
+
+    dataset::ChunkEntry entry = {};
+    storeBounds(min, max, entry.boundsMin, entry.boundsMax);
+    entry.count = count;
+    entry.offset = dataOffset + chunks.size() * dataset::chunkBytes(chunkCapacity);
+
+    writeAt(points, count * sizeof(glm::vec3), entry.offset);
+    chunks.push_back(entry);
+    pointCount += count;
+}
+
+void DatasetWriter::finish()
+{
+    if(chunks.size() != chunkCount)
+        throw std::runtime_error(fmt::format("{} has {} of its {} chunks", path, chunks.size(), chunkCount));
+
+    std::vector<dataset::GroupEntry> groups;
+    glm::vec3 totalMin(std::numeric_limits<float>::max());
+    glm::vec3 totalMax(std::numeric_limits<float>::lowest());
+
+    for(size_t first = 0; first < chunkCount; first += dataset::GROUP_SIZE) {
+        size_t last = std::min(first + dataset::GROUP_SIZE, chunkCount);
+
+        glm::vec3 min(std::numeric_limits<float>::max());
+        glm::vec3 max(std::numeric_limits<float>::lowest());
+        for(size_t i = first; i < last; i++) {
+            dataset::Bounds bounds = toBounds(chunks[i].boundsMin, chunks[i].boundsMax);
+            min = glm::min(min, bounds.min);
+            max = glm::max(max, bounds.max);
+        }
+
+        dataset::GroupEntry group = {};
+        storeBounds(min, max, group.boundsMin, group.boundsMax);
+        group.firstChunk = first;
+        group.chunkCount = last - first;
+        groups.push_back(group);
+
+        totalMin = glm::min(totalMin, min);
+        totalMax = glm::max(totalMax, max);
+    }
+
+    dataset::FileHeader header = {};
+    std::memcpy(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+    header.version = dataset::VERSION;
+    header.chunkCapacity = chunkCapacity;
+    header.chunkCount = chunkCount;
+    header.groupCount = groups.size();
+    header.pointCount = pointCount;
+    storeBounds(totalMin, totalMax, header.boundsMin, header.boundsMax);
+
+    size_t offset = 0;
+    writeAt(&header, sizeof(header), offset);
+    offset += sizeof(header);
+    writeAt(chunks.data(), chunks.size() * sizeof(dataset::ChunkEntry), offset);
+    offset += chunks.size() * sizeof(dataset::ChunkEntry);
+    writeAt(groups.data(), groups.size() * sizeof(dataset::GroupEntry), offset);
+
+    // The last chunk has to be mappable in full
+    size_t fileSize = dataOffset + chunkCount * dataset::chunkBytes(chunkCapacity);
+    if(ftruncate(fd, fileSize) != 0)
+        throw std::runtime_error(fmt::format("Failed to size {}: {}", path, std::strerror(errno)));
+
+    finished = true;
+    LOG_INFO("Wrote {} points in {} chunks to {} ({} MB)", pointCount, chunkCount, path, fileSize >> 20);
+}
+
+ChunkedDataset::ChunkedDataset(const std::string &path) : path(path)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error(fmt::format("Failed to open {}: {}", path, std::strerror(errno)));
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(dataset::FileHeader)) {
+        close(fd);
+        throw std::runtime_error(fmt::format("{} is not a chunked dataset", path));
+    }
+    mappingSize = info.st_size;
+
+    void *address = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    if(address == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error(fmt::format("Failed to map {}: {}", path, std::strerror(errno)));
+    }
+    mapping = (const uint8_t*)address;
+    header = (const dataset::FileHeader*)mapping;
+    chunks = (const dataset::ChunkEntry*)(mapping + sizeof(dataset::FileHeader));
+    groups = (const dataset::GroupEntry*)(chunks + header->chunkCount);
+
+    const char *problem = nullptr;
+    if(std::memcmp(header->magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0 || header->version != dataset::VERSION)
+        problem = "is not a chunked dataset";
+    else if(header->chunkCount == 0 || header->chunkCapacity == 0 || tablesEnd(header->chunkCount) > mappingSize ||
+        header->groupCount != (header->chunkCount + dataset::GROUP_SIZE - 1) / dataset::GROUP_SIZE)
+        problem = "has a broken chunk table";
+
+    size_t chunkSize = problem ? 0 : dataset::chunkBytes(header->chunkCapacity);
+    for(size_t i = 0; !problem && i < header->chunkCount; i++) {
+        if(chunks[i].count > header->chunkCapacity || chunks[i].offset % dataset::PAGE_SIZE != 0 ||
+            chunks[i].offset + chunkSize > mappingSize)
+            problem = "has a chunk outside the file";
+    }
+    for(size_t i = 0; !problem && i < header->groupCount; i++) {
+        if((uint64_t)groups[i].firstChunk + groups[i].chunkCount > header->chunkCount)
+            problem = "has a group outside the chunk table";
+    }
+
+    if(problem) {
+        munmap((void*)mapping, mappingSize);
+        close(fd);
+        throw std::runtime_error(fmt::format("{} {}", path, problem));
+    }
+
+    // Access follows the camera, not the file order
+    madvise((void*)mapping, mappingSize, MADV_RANDOM);
+
+    LOG_DEBUG("Mapped dataset {} ({} points in {} chunks)", path, header->pointCount, header->chunkCount);
+}
+
+ChunkedDataset::~ChunkedDataset()
+{
+    munmap((void*)mapping, mappingSize);
+    close(fd);
+    LOG_DEBUG("Unmapped dataset {}", path);
+}
+
+dataset::Bounds ChunkedDataset::getBounds() const
+{
+    return toBounds(header->boundsMin, header->boundsMax);
+}
+
+dataset::Bounds ChunkedDataset::getChunkBounds(size_t index) const
+{
+    return toBounds(chunks[index].boundsMin, chunks[index].boundsMax);
+}
+
+dataset::Bounds ChunkedDataset::getGroupBounds(size_t index) const
+{
+    return toBounds(groups[index].boundsMin, groups[index].boundsMax);
+}
+
+const glm::vec3 *ChunkedDataset::getChunkData(size_t index) const
+{
+    return (const glm::vec3*)(mapping + chunks[index].offset);
+}
+
+size_t ChunkedDataset::getMappedSize(size_t index) const
+{
+    return alignUp(getChunkSize(index), dataset::PAGE_SIZE);
+}
+
+size_t ChunkedDataset::prefetch(size_t index) const
+{
+    const uint8_t *data = mapping + chunks[index].offset;
+    size_t size = getMappedSize(index);
+
+    madvise((void*)data, size, MADV_WILLNEED);
+
+    // WILLNEED is only a hint, touching every page makes sure it happened
+    volatile uint8_t sink = 0;
+    for(size_t offset = 0; offset < size; offset += dataset::PAGE_SIZE) {
+        sink = sink + data[offset];
+    }
+
+    return size;
+}
+
+void ChunkedDataset::release(size_t index) const
+{
+    madvise((void*)(mapping + chunks[index].offset), getMappedSize(index), MADV_DONTNEED);
+}
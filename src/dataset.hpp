@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Chunked on-disk particle dataset.
+//
+// A file header is followed by the chunk table and a coarser group
+// table, which together form the spatial index: every chunk and every
+// run of GROUP_SIZE consecutive chunks carries its bounds. Chunks are
+// written in spatial order, so the groups stay tight. Each chunk holds up
+// to chunkCapacity tightly packed vec3 positions and starts on a page
+// boundary, so it can be mapped, prefetched and dropped on its own.
+namespace dataset {
+    constexpr uint32_t VERSION = 1;
+    constexpr size_t PAGE_SIZE = 4096;
+    constexpr uint32_t GROUP_SIZE = 16;
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t chunkCapacity;
+        uint64_t chunkCount;
+        uint64_t groupCount;
+        uint64_t pointCount;
+        float boundsMin[3];
+        float boundsMax[3];
+    };
+
+    struct ChunkEntry {
+        float boundsMin[3];
+        uint32_t count;
+        float boundsMax[3];
+        uint32_t reserved;
+        uint64_t offset; // from the start of the file
+    };
+
+    struct GroupEntry {
+        float boundsMin[3];
+        uint32_t firstChunk;
+        float boundsMax[3];
+        uint32_t chunkCount;
+    };
+
+    struct Bounds {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    size_t chunkBytes(uint32_t chunkCapacity);
+}
+
+// Writes a dataset one chunk at a time, so it never has to fit in memory.
+// The tables are written on finish().
+class DatasetWriter {
+public:
+    DatasetWriter(const std::string &path, uint32_t chunkCapacity, size_t chunkCount);
+    ~DatasetWriter();
+
+    // Chunks should be added in a spatially coherent order
+    void addChunk(const glm::vec3 *points, size_t count);
+    void finish();
+
+    size_t getPointCount() const { return pointCount; }
+
+private:
+    void writeAt(const void *data, size_t size, size_t offset);
+
+    std::string path;
+    int fd = -1;
+    uint32_t chunkCapacity;
+    size_t chunkCount;
+    size_t dataOffset;
+    size_t pointCount = 0;
+    std::vector<dataset::ChunkEntry> chunks;
+    bool finished = false;
+};
+
+// Maps a dataset read-only. Nothing is read until a chunk is touched;
+// prefetch() and release() move a chunk in and out of memory.
+class ChunkedDataset {
+public:
+    ChunkedDataset(const std::string &path);
+    ~ChunkedDataset();
+
+    size_t getChunkCount() const { return header->chunkCount; }
+    size_t getGroupCount() const { return header->groupCount; }
+    size_t getPointCount() const { return header->pointCount; }
+    uint32_t getChunkCapacity() const { return header->chunkCapacity; }
+    dataset::Bounds getBounds() const;
+
+    const dataset::ChunkEntry &getChunk(size_t index) const { return chunks[index]; }
+    const dataset::GroupEntry &getGroup(size_t index) const { return groups[index]; }
+    dataset::Bounds getChunkBounds(size_t index) const;
+    dataset::Bounds getGroupBounds(size_t index) const;
+    const glm::vec3 *getChunkData(size_t index) const;
+    size_t getChunkSize(size_t index) const { return chunks[index].count * sizeof(glm::vec3); }
+    // Whole pages spanned by the chunk's points
+    size_t getMappedSize(size_t index) const;
+
+    // Faults the chunk's pages in, returns the bytes touched
+    size_t prefetch(size_t index) const;
+    // Lets the kernel drop the chunk's pages
+    void release(size_t index) const;
+
+    const std::string &getPath() const { return path; }
+
+private:
+    std::string path;
+    int fd = -1;
+    const uint8_t *mapping = nullptr;
+    size_t mappingSize = 0;
+
+    const dataset::FileHeader *header;
+    const dataset::ChunkEntry *chunks;
+    const dataset::GroupEntry *groups;
+};
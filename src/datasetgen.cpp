@@ -0,0 +1,149 @@
+// Writes a synthetic chunked dataset for --dataset.
+// Points are spread over a grid of cells following a few dense clusters on
+// a thin background. Cells are visited in Z-order and generated one at a
+// time, so the dataset can be far bigger than memory.
+
+#include "dataset.hpp"
+#include "morton.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const char *USAGE =
+    "Usage: gl-instancing-dataset [options]\n"
+    "  --output FILE   dataset to write (default dataset.chunks)\n"
+    "  --count N       number of points\n"
+    "  --chunk N       points per chunk\n"
+    "  --extent F      half size of the volume\n"
+    "  --seed N        seed for the clusters and points\n";
+
+constexpr int MAX_GRID_SIZE = 128;
+constexpr int CLUSTER_COUNT = 24;
+
+struct Cluster {
+    glm::vec3 center;
+    float radius;
+    float weight;
+};
+
+int main(int argc, char **argv) try {
+    std::string output = "dataset.chunks";
+    size_t count = 100000000;
+    uint32_t chunkCapacity = 65536;
+    float extent = 20000.0f;
+    uint32_t seed = 1;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc)
+            throw std::runtime_error(fmt::format("Missing value for {}\n{}", arg, USAGE));
+
+        if(arg == "--output") {
+            output = argv[++i];
+        } else if(arg == "--count") {
+            count = std::stoull(argv[++i]);
+        } else if(arg == "--chunk") {
+            chunkCapacity = std::stoul(argv[++i]);
+        } else if(arg == "--extent") {
+            extent = std::stof(argv[++i]);
+        } else if(arg == "--seed") {
+            seed = std::stoul(argv[++i]);
+        } else {
+            throw std::runtime_error(fmt::format("Unknown argument '{}'\n{}", arg, USAGE));
+        }
+    }
+    if(count == 0 || chunkCapacity == 0)
+        throw std::runtime_error("--count and --chunk must be positive");
+
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::vector<Cluster> clusters(CLUSTER_COUNT);
+    for(Cluster &cluster : clusters) {
+        cluster.center = (glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f) * extent * 0.8f;
+        cluster.radius = extent * (0.03f + unit(random) * 0.12f);
+        cluster.weight = 0.5f + unit(random);
+    }
+
+    // About one chunk per cell on average
+    int gridSize = 1;
+    while(gridSize < MAX_GRID_SIZE && (size_t)gridSize * gridSize * gridSize * chunkCapacity < count) {
+        gridSize *= 2;
+    }
+    size_t cellCount = (size_t)gridSize * gridSize * gridSize;
+    float cellSize = extent * 2.0f / gridSize;
+
+    auto cellCenter = [&](size_t cell) {
+        glm::vec3 coord(cell % gridSize, cell / gridSize % gridSize, cell / gridSize / gridSize);
+        return (coord + 0.5f) * cellSize - extent;
+    };
+
+    std::vector<double> weights(cellCount);
+    double totalWeight = 0.0;
+    for(size_t cell = 0; cell < cellCount; cell++) {
+        glm::vec3 center = cellCenter(cell);
+        double weight = 0.02;
+        for(const Cluster &cluster : clusters) {
+            float distance = glm::length(center - cluster.center) / cluster.radius;
+            weight += cluster.weight * std::exp(-0.5f * distance * distance);
+        }
+        weights[cell] = weight;
+        totalWeight += weight;
+    }
+
+    std::vector<uint32_t> order(cellCount);
+    std::vector<uint32_t> codes(cellCount);
+    for(size_t cell = 0; cell < cellCount; cell++) {
+        order[cell] = cell;
+        codes[cell] = morton::encode30((cellCenter(cell) + extent) / (extent * 2.0f));
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+
+    // Rounding leftovers go to the densest cells first
+    std::vector<size_t> cellPoints(cellCount);
+    size_t assigned = 0;
+    for(size_t cell = 0; cell < cellCount; cell++) {
+        cellPoints[cell] = (size_t)(count * (weights[cell] / totalWeight));
+        assigned += cellPoints[cell];
+    }
+    std::vector<uint32_t> byWeight(order);
+    std::sort(byWeight.begin(), byWeight.end(), [&](uint32_t a, uint32_t b) { return weights[a] > weights[b]; });
+    for(size_t i = 0; assigned < count; i = (i + 1) % cellCount, assigned++) {
+        cellPoints[byWeight[i]]++;
+    }
+
+    size_t chunkCount = 0;
+    for(size_t points : cellPoints) {
+        chunkCount += (points + chunkCapacity - 1) / chunkCapacity;
+    }
+
+    LOG_INFO("Generating {} points in {} chunks over a {}^3 grid", count, chunkCount, gridSize);
+
+    DatasetWriter writer(output, chunkCapacity, chunkCount);
+    std::vector<glm::vec3> chunk(chunkCapacity);
+
+    for(uint32_t cell : order) {
+        glm::vec3 corner = cellCenter(cell) - cellSize * 0.5f;
+
+        for(size_t left = cellPoints[cell]; left > 0;) {
+            size_t points = std::min<size_t>(left, chunkCapacity);
+            for(size_t i = 0; i < points; i++) {
+                chunk[i] = corner + glm::vec3(unit(random), unit(random), unit(random)) * cellSize;
+            }
+            writer.addChunk(chunk.data(), points);
+            left -= points;
+        }
+    }
+
+    writer.finish();
+} catch(std::exception &e) {
+    LOG_ERROR("{}", e.what());
+    return 1;
+}
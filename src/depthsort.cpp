@@ -0,0 +1,171 @@
+#include "depthsort.hpp"
+#include "camera.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+
+constexpr size_t DEPTH_KEY_BITS = 24;
+constexpr uint32_t MAX_DEPTH_KEY = (1u << DEPTH_KEY_BITS) - 1;
+constexpr uint32_t HIDDEN_KEY = UINT32_MAX;
+// Average shifts per key the repair may spend before it gives up
+constexpr size_t MAX_REPAIR_MOVES = 16;
+
+DepthSorter::DepthSorter()
+{
+    LOG_DEBUG("Created depth sorter");
+}
+
+DepthSorter::~DepthSorter()
+{
+    LOG_DEBUG("Destroyed depth sorter");
+}
+
+void DepthSorter::sort(
+    const std::vector<glm::vec3> &positions,
+    const glm::mat4 &view,
+    const glm::mat4 &projectionView,
+    float nearPlane, float farPlane,
+    ThreadPool &pool)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    size_t count = positions.size();
+    size_t chunkCount = (count + RADIX_CHUNK_SIZE - 1) / RADIX_CHUNK_SIZE;
+
+    bool incremental = settings.incremental && valid && order.size() == count;
+    if(!valid || order.size() != count) {
+        order.resize(count);
+        std::iota(order.begin(), order.end(), 0);
+    }
+
+    glm::vec4 planes[6];
+    extractFrustumPlanes(projectionView, planes);
+
+    // View-space depth is minus the view z
+    glm::vec3 depthAxis = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+    float depthOffset = -view[3][2];
+    float depthScale = MAX_DEPTH_KEY / std::max(farPlane - nearPlane, 1e-6f);
+    float radius = settings.boundingRadius;
+
+    depthKeys.resize(count);
+    chunkVisible.resize(chunkCount);
+
+    // Keys are made in last frame's order, so they come out nearly sorted
+    // A pool without threads runs the whole range in one call, so each
+    // range is walked chunk by chunk to fill every count
+    pool.parallelFor(count, RADIX_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for(size_t chunk = begin; chunk < end; chunk += RADIX_CHUNK_SIZE) {
+            uint32_t visible = 0;
+            for(size_t i = chunk; i < std::min(chunk + RADIX_CHUNK_SIZE, end); i++) {
+                const glm::vec3 &position = positions[order[i]];
+
+                bool inside = true;
+                for(int p = 0; p < 6 && inside; p++) {
+                    inside = glm::dot(glm::vec3(planes[p]), position) + planes[p].w >= -radius;
+                }
+                if(!inside) {
+                    depthKeys[i] = HIDDEN_KEY;
+                    continue;
+                }
+
+                float depth = glm::dot(depthAxis, position) + depthOffset;
+                depthKeys[i] = (uint32_t)std::clamp((depth - nearPlane) * depthScale, 0.0f, (float)MAX_DEPTH_KEY);
+                visible++;
+            }
+            chunkVisible[chunk / RADIX_CHUNK_SIZE] = visible;
+        }
+    });
+
+    size_t visibleCount = 0;
+    for(uint32_t &visible : chunkVisible) {
+        size_t inChunk = visible;
+        visible = visibleCount;
+        visibleCount += inChunk;
+    }
+
+    // Visible instances go to the sort, the rest straight to the back
+    keys.resize(visibleCount);
+    values.resize(visibleCount);
+    nextOrder.resize(count);
+    pool.parallelFor(count, RADIX_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for(size_t chunk = begin; chunk < end; chunk += RADIX_CHUNK_SIZE) {
+            size_t visible = chunkVisible[chunk / RADIX_CHUNK_SIZE];
+            size_t hidden = visibleCount + chunk - visible;
+            for(size_t i = chunk; i < std::min(chunk + RADIX_CHUNK_SIZE, end); i++) {
+                if(depthKeys[i] == HIDDEN_KEY) {
+                    nextOrder[hidden++] = order[i];
+                } else {
+                    keys[visible] = depthKeys[i];
+                    values[visible++] = order[i];
+                }
+            }
+        }
+    });
+
+    stats.moves = 0;
+    stats.incremental = incremental && repair(pool);
+    stats.radixPasses = stats.incremental ? 0 : radixSort(keys, values, scratch, pool, DEPTH_KEY_BITS);
+
+    std::copy(values.begin(), values.end(), nextOrder.begin());
+    order.swap(nextOrder);
+    valid = true;
+
+    stats.visibleCount = visibleCount;
+    stats.sortTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool DepthSorter::repair(ThreadPool &pool)
+{
+    size_t count = keys.size();
+    std::atomic<size_t> moves = 0;
+    std::atomic<bool> failed = false;
+
+    // Each chunk on its own first
+    pool.parallelFor(count, RADIX_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        size_t budget = (end - begin) * MAX_REPAIR_MOVES;
+        size_t local = 0;
+        for(size_t i = begin + 1; i < end && local <= budget; i++) {
+            uint32_t key = keys[i], value = values[i];
+            size_t j = i;
+            for(; j > begin && keys[j - 1] > key; j--) {
+                keys[j] = keys[j - 1];
+                values[j] = values[j - 1];
+            }
+            keys[j] = key;
+            values[j] = value;
+            local += i - j;
+        }
+        moves += local;
+        if(local > budget)
+            failed = true;
+    });
+
+    size_t total = moves;
+    size_t budget = count * MAX_REPAIR_MOVES;
+
+    // Then carry keys across the seams. Everything before a seam is sorted
+    // and so is the chunk after it, so only a prefix of the chunk can be
+    // out of place.
+    for(size_t seam = RADIX_CHUNK_SIZE; seam < count && !failed; seam += RADIX_CHUNK_SIZE) {
+        size_t end = std::min(seam + RADIX_CHUNK_SIZE, count);
+        for(size_t i = seam; i < end && keys[i] < keys[i - 1] && total <= budget; i++) {
+            uint32_t key = keys[i], value = values[i];
+            size_t j = i;
+            for(; j > 0 && keys[j - 1] > key; j--) {
+                keys[j] = keys[j - 1];
+                values[j] = values[j - 1];
+            }
+            keys[j] = key;
+            values[j] = value;
+            total += i - j;
+        }
+        if(total > budget)
+            failed = true;
+    }
+
+    stats.moves = total;
+    return !failed;
+}
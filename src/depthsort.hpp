@@ -0,0 +1,88 @@
+#pragma once
+
+#include "radixsort.hpp"
+#include "threadpool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct DepthSortSettings {
+    // Start from last frame's order and only repair it, while that's cheap
+    bool incremental = true;
+    float boundingRadius = 1.7320508f; // unit cube
+};
+
+// Orders the instances inside the view frustum front to back, so early-Z
+// rejects most of the fragments behind the nearest surfaces.
+//
+// Keys are view-space depths quantized to 24 bits between the near and
+// far plane and radix sorted on the worker threads. The order of all
+// instances is kept between frames; when the camera and the particles
+// only moved a little it is still nearly sorted, and a block-wise
+// insertion sort with a bounded number of moves fixes it up instead. If
+// the bound is hit the full radix sort runs after all.
+class DepthSorter {
+public:
+    struct Stats {
+        double sortTime;
+        size_t visibleCount;
+        bool incremental;   // repaired last frame's order
+        size_t moves;       // keys shifted by the repair
+        size_t radixPasses;
+    };
+
+    DepthSorter();
+    ~DepthSorter();
+
+    void sort(
+        const std::vector<glm::vec3> &positions,
+        const glm::mat4 &view,
+        const glm::mat4 &projectionView,
+        float nearPlane, float farPlane,
+        ThreadPool &pool
+    );
+
+    // Forgets the previous order, e.g. after the instances were permuted
+    void reset() { valid = false; }
+
+    // target[i] = source[i-th nearest visible instance]
+    template<typename T>
+    void gather(const std::vector<T> &source, std::vector<T> &target, ThreadPool &pool) const;
+
+    size_t getVisibleCount() const { return keys.size(); }
+    const Stats &getStats() const { return stats; }
+
+    DepthSortSettings settings;
+
+private:
+    bool repair(ThreadPool &pool);
+
+    // Every instance: the visible ones nearest first, then the rest
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> nextOrder;
+    bool valid = false;
+
+    // Visible instances, in the order they're being sorted
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> values;
+    RadixScratch<uint32_t> scratch;
+
+    std::vector<uint32_t> depthKeys;
+    std::vector<uint32_t> chunkVisible;
+
+    Stats stats = {};
+};
+
+template<typename T>
+void DepthSorter::gather(const std::vector<T> &source, std::vector<T> &target, ThreadPool &pool) const
+{
+    target.resize(getVisibleCount());
+
+    pool.parallelFor(target.size(), RADIX_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            target[i] = source[order[i]];
+        }
+    });
+}
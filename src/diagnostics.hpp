@@ -0,0 +1,180 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// Health of the particle system after a tick. Energies are per unit mass
+// and summed over the particles; particles with a NaN or infinite
+// component are only counted, so one bad particle doesn't hide the rest.
+//
+// Also the partial sum a thread builds over its chunk. Partials are merged
+// in chunk order, which keeps the result independent of the scheduling.
+struct SimulationDiagnostics {
+    size_t count = 0;
+    double kineticEnergy = 0.0;
+    double potentialEnergy = 0.0;
+    glm::dvec3 momentum = glm::dvec3(0.0);
+    glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+    float maxSpeedSquared = 0.0f;
+    // Positive total energy, on their way out of the attractor
+    size_t unboundCount = 0;
+    size_t nanCount = 0;
+    size_t infCount = 0;
+
+    // Sums a run of particles, meant to be about an activity block long
+    void add(const glm::vec3 *positions, const glm::vec3 *velocities, const float *potentials, size_t n)
+    {
+        if(!addFinite(positions, velocities, potentials, n))
+            addEach(positions, velocities, potentials, n);
+    }
+
+    void merge(const SimulationDiagnostics &other)
+    {
+        count += other.count;
+        kineticEnergy += other.kineticEnergy;
+        potentialEnergy += other.potentialEnergy;
+        momentum += other.momentum;
+        boundsMin = glm::min(boundsMin, other.boundsMin);
+        boundsMax = glm::max(boundsMax, other.boundsMax);
+        maxSpeedSquared = std::max(maxSpeedSquared, other.maxSpeedSquared);
+        unboundCount += other.unboundCount;
+        nanCount += other.nanCount;
+        infCount += other.infCount;
+    }
+
+    double totalEnergy() const { return kineticEnergy + potentialEnergy; }
+    float maxSpeed() const { return std::sqrt(maxSpeedSquared); }
+    size_t nonFiniteCount() const { return nanCount + infCount; }
+
+private:
+    static constexpr size_t LANES = 8;
+    // Multiple of 3, so flattened vec3s keep each lane to one axis
+    static constexpr size_t AXIS_LANES = 12;
+
+    // Float bits as an int that orders like the float, which keeps the
+    // bounds to branch-free integer min/max. Its own inverse.
+    static int32_t orderedBits(int32_t bits) { return bits ^ ((bits >> 31) & 0x7fffffff); }
+
+    // Float sums go in lanes the compiler can vectorize, widened to double
+    // once at the end. NaN and Inf are only counted, by a mask, and false
+    // leaves everything as it was.
+    bool addFinite(const glm::vec3 *positions, const glm::vec3 *velocities, const float *potentials, size_t n)
+    {
+        int32_t minX = std::numeric_limits<int32_t>::max(), minY = minX, minZ = minX;
+        int32_t maxX = std::numeric_limits<int32_t>::min(), maxY = maxX, maxZ = maxX;
+        int32_t maxSpeed = 0;
+        uint32_t finite = 0;
+        uint32_t unbound = 0;
+        for(size_t i = 0; i < n; i++) {
+            float px = positions[i].x, py = positions[i].y, pz = positions[i].z;
+            float vx = velocities[i].x, vy = velocities[i].y, vz = velocities[i].z;
+            float u = potentials[i];
+            float speedSquared = vx * vx + vy * vy + vz * vz;
+
+            int32_t x = orderedBits(std::bit_cast<int32_t>(px));
+            int32_t y = orderedBits(std::bit_cast<int32_t>(py));
+            int32_t z = orderedBits(std::bit_cast<int32_t>(pz));
+            minX = std::min(minX, x);
+            minY = std::min(minY, y);
+            minZ = std::min(minZ, z);
+            maxX = std::max(maxX, x);
+            maxY = std::max(maxY, y);
+            maxZ = std::max(maxZ, z);
+            // Never negative, so the bits order as they are
+            maxSpeed = std::max(maxSpeed, std::bit_cast<int32_t>(speedSquared));
+
+            // Zero unless something was NaN or Inf, or the sum overflowed
+            float probe = (px + py + pz + vx + vy + vz + u) * 0.0f;
+            finite += probe == 0.0f;
+            unbound += 0.5f * speedSquared + u > 0.0f;
+        }
+        if(finite != n)
+            return false;
+        if(n == 0)
+            return true;
+
+        static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "Velocities are summed as a flat float array");
+        const float *flat = &velocities[0].x;
+        float sums[AXIS_LANES] = {};
+        float squares[AXIS_LANES] = {};
+        size_t floats = n * 3;
+        size_t whole = floats - floats % AXIS_LANES;
+        for(size_t base = 0; base < whole; base += AXIS_LANES) {
+            for(size_t lane = 0; lane < AXIS_LANES; lane++) {
+                float v = flat[base + lane];
+                sums[lane] += v;
+                squares[lane] += v * v;
+            }
+        }
+        for(size_t i = whole; i < floats; i++) {
+            sums[i - whole] += flat[i];
+            squares[i - whole] += flat[i] * flat[i];
+        }
+
+        float potential[LANES] = {};
+        whole = n - n % LANES;
+        for(size_t base = 0; base < whole; base += LANES) {
+            for(size_t lane = 0; lane < LANES; lane++) {
+                potential[lane] += potentials[base + lane];
+            }
+        }
+        for(size_t i = whole; i < n; i++) {
+            potential[i - whole] += potentials[i];
+        }
+
+        double squaresSum = 0.0;
+        for(size_t lane = 0; lane < AXIS_LANES; lane++) {
+            momentum[lane % 3] += sums[lane];
+            squaresSum += squares[lane];
+        }
+        kineticEnergy += 0.5 * squaresSum;
+        for(size_t lane = 0; lane < LANES; lane++) {
+            potentialEnergy += potential[lane];
+        }
+
+        auto toFloat = [](int32_t ordered) { return std::bit_cast<float>(orderedBits(ordered)); };
+        boundsMin = glm::min(boundsMin, glm::vec3(toFloat(minX), toFloat(minY), toFloat(minZ)));
+        boundsMax = glm::max(boundsMax, glm::vec3(toFloat(maxX), toFloat(maxY), toFloat(maxZ)));
+        maxSpeedSquared = std::max(maxSpeedSquared, std::bit_cast<float>(maxSpeed));
+        unboundCount += unbound;
+        count += n;
+        return true;
+    }
+
+    // Rare, so a run the mask turned down goes one particle at a time
+    void addEach(const glm::vec3 *positions, const glm::vec3 *velocities, const float *potentials, size_t n)
+    {
+        for(size_t i = 0; i < n; i++) {
+            const glm::vec3 &position = positions[i];
+            const glm::vec3 &velocity = velocities[i];
+            float potential = potentials[i];
+            if(glm::any(glm::isnan(position)) || glm::any(glm::isnan(velocity)) || std::isnan(potential)) {
+                nanCount++;
+                continue;
+            }
+            if(glm::any(glm::isinf(position)) || glm::any(glm::isinf(velocity)) || std::isinf(potential)) {
+                infCount++;
+                continue;
+            }
+
+            float speedSquared = glm::dot(velocity, velocity);
+            float kinetic = 0.5f * speedSquared;
+            count++;
+            kineticEnergy += kinetic;
+            potentialEnergy += potential;
+            momentum += glm::dvec3(velocity);
+            boundsMin = glm::min(boundsMin, position);
+            boundsMax = glm::max(boundsMax, position);
+            maxSpeedSquared = std::max(maxSpeedSquared, speedSquared);
+            if(kinetic + potential > 0.0f)
+                unboundCount++;
+        }
+    }
+};
@@ -0,0 +1,102 @@
+// Reference producer for the shared memory instance feed.
+// Publishes particles on rotating rings at a fixed rate until interrupted.
+
+#include "sharedfeed.hpp"
+#include "threadpool.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char *USAGE =
+    "Usage: gl-instancing-producer [options]\n"
+    "  --name NAME   shared memory name (default gl-instancing)\n"
+    "  --count N     number of instances per frame\n"
+    "  --rate HZ     frames per second\n";
+
+static std::atomic<bool> interrupted = false;
+
+struct Orbit {
+    float radius;
+    float height;
+    float phase;
+    float speed;
+};
+
+int main(int argc, char **argv) try {
+    std::string name = "gl-instancing";
+    size_t count = 1000000;
+    double rate = 60.0;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc)
+            throw std::runtime_error(fmt::format("Missing value for {}\n{}", arg, USAGE));
+
+        if(arg == "--name") {
+            name = argv[++i];
+        } else if(arg == "--count") {
+            count = std::stoull(argv[++i]);
+        } else if(arg == "--rate") {
+            rate = std::stod(argv[++i]);
+        } else {
+            throw std::runtime_error(fmt::format("Unknown argument '{}'\n{}", arg, USAGE));
+        }
+    }
+
+    std::signal(SIGINT, [](int) { interrupted = true; });
+    std::signal(SIGTERM, [](int) { interrupted = true; });
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Orbit> orbits(count);
+    for(Orbit &orbit : orbits) {
+        orbit.radius = 50.0f + unit(random) * 950.0f;
+        orbit.height = (unit(random) - 0.5f) * 200.0f;
+        orbit.phase = unit(random) * 6.2831853f;
+        orbit.speed = 20.0f / std::sqrt(orbit.radius);
+    }
+
+    FeedProducer producer(name, count);
+    ThreadPool workers;
+
+    auto period = std::chrono::duration<double>(1.0 / rate);
+    auto start = std::chrono::steady_clock::now();
+    auto next = start;
+
+    while(!interrupted) {
+        float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+        glm::vec3 *positions = producer.beginFrame();
+        workers.parallelFor(count, 16384, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                const Orbit &orbit = orbits[i];
+                float angle = orbit.phase + orbit.speed * time;
+                positions[i] = glm::vec3(
+                    std::cos(angle) * orbit.radius,
+                    orbit.height,
+                    std::sin(angle) * orbit.radius
+                );
+            }
+        });
+        producer.endFrame(count);
+
+        if(producer.getFrameCount() % 600 == 0)
+            LOG_INFO("Published {} frames", producer.getFrameCount());
+
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        std::this_thread::sleep_until(next);
+    }
+} catch(std::exception &e) {
+    LOG_ERROR("{}", e.what());
+    return 1;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+
+struct GravitySettings {
+    glm::vec3 attractor = glm::vec3(0.0f);
+    float strength = 1000000.0f; // G * M
+    float softening = 10.0f;
+
+    // Optional terms, each one drops out of the kernel while its weight is zero
+    glm::vec3 secondAttractor = glm::vec3(150.0f, 0.0f, 0.0f);
+    float secondStrength = 0.0f;
+    float drag = 0.0f;     // Velocity lost per second, as a rate
+    float noise = 0.0f;    // Magnitude of the random acceleration
+    float boundary = 0.0f; // Half size of the box positions wrap around in
+
+    // Step size is accuracy * sqrt(softening / |a|)
+    float accuracy = 0.05f;
+    // The finest step is deltaTime / 2^maxLevel
+    int maxLevel = 8;
+
+    bool operator==(const GravitySettings &) const = default;
+};
+
+// Terms that can be added on top of the central attractor
+enum ForceTerm : uint32_t {
+    FORCE_SECOND_ATTRACTOR = 1 << 0,
+    FORCE_DRAG = 1 << 1,
+    FORCE_NOISE = 1 << 2,
+    FORCE_WRAP = 1 << 3,
+};
+constexpr uint32_t FORCE_TERM_COMBINATIONS = 1 << 4;
+
+inline uint32_t activeForceTerms(const GravitySettings &settings)
+{
+    uint32_t terms = 0;
+    if(settings.secondStrength != 0.0f) terms |= FORCE_SECOND_ATTRACTOR;
+    if(settings.drag > 0.0f) terms |= FORCE_DRAG;
+    if(settings.noise > 0.0f) terms |= FORCE_NOISE;
+    if(settings.boundary > 0.0f) terms |= FORCE_WRAP;
+    return terms;
+}
+
+// Force law with its terms fixed at compile time. The integrator builds a
+// kernel for every combination and picks one per tick, so a switched off
+// term never shows up in the per-particle loop.
+template<uint32_t Terms>
+struct ForceLaw {
+    static constexpr bool has(uint32_t term) { return (Terms & term) != 0; }
+
+    // Conservative part, evaluated at every sub-step
+    static glm::vec3 acceleration(const GravitySettings &settings, const glm::vec3 &position) {
+        glm::vec3 result = attract(settings.attractor, settings.strength, settings.softening, position);
+        if constexpr(has(FORCE_SECOND_ATTRACTOR))
+            result += attract(settings.secondAttractor, settings.secondStrength, settings.softening, position);
+        return result;
+    }
+
+    // Same, and the potential energy per unit mass it's the gradient of.
+    // Shares the square root, the acceleration comes out bit for bit equal.
+    static glm::vec3 acceleration(const GravitySettings &settings, const glm::vec3 &position, float &potential) {
+        potential = 0.0f;
+        glm::vec3 result = attract(settings.attractor, settings.strength, settings.softening, position, potential);
+        if constexpr(has(FORCE_SECOND_ATTRACTOR))
+            result += attract(settings.secondAttractor, settings.secondStrength, settings.softening, position, potential);
+        return result;
+    }
+
+    // For particles that weren't stepped
+    static float potential(const GravitySettings &settings, const glm::vec3 &position) {
+        float result;
+        acceleration(settings, position, result);
+        return result;
+    }
+
+    // The rest is applied once at the end of the tick, which keeps the
+    // leapfrog sub-steps time-reversible. Returns true if the particle
+    // jumped and its cached acceleration is stale.
+    static bool finish(
+        const GravitySettings &settings, uint32_t seed,
+        glm::vec3 &position, glm::vec3 &velocity, float deltaTime
+    ) {
+        if constexpr(has(FORCE_DRAG))
+            velocity *= std::exp(-settings.drag * deltaTime);
+        if constexpr(has(FORCE_NOISE))
+            velocity += randomDirection(seed) * (settings.noise * deltaTime);
+        if constexpr(has(FORCE_WRAP)) {
+            float size = settings.boundary * 2.0f;
+            glm::vec3 shift = size * glm::floor((position + settings.boundary) / size);
+            position -= shift;
+            return shift != glm::vec3(0.0f);
+        }
+        return false;
+    }
+
+private:
+    static glm::vec3 attract(const glm::vec3 &center, float strength, float softening, const glm::vec3 &position) {
+        glm::vec3 offset = center - position;
+        float distanceSquared = glm::dot(offset, offset) + softening * softening;
+        return offset * (strength / (distanceSquared * std::sqrt(distanceSquared)));
+    }
+
+    static glm::vec3 attract(const glm::vec3 &center, float strength, float softening, const glm::vec3 &position, float &potential) {
+        glm::vec3 offset = center - position;
+        float distanceSquared = glm::dot(offset, offset) + softening * softening;
+        float distance = std::sqrt(distanceSquared);
+        potential -= strength / distance;
+        return offset * (strength / (distanceSquared * distance));
+    }
+
+    // Components in [-1, 1], stateless so any thread can draw them
+    static glm::vec3 randomDirection(uint32_t seed) {
+        glm::vec3 result;
+        for(int axis = 0; axis < 3; axis++) {
+            seed = seed * 747796405u + 2891336453u;
+            uint32_t word = ((seed >> ((seed >> 28u) + 4u)) ^ seed) * 277803737u;
+            word = (word >> 22u) ^ word;
+            result[axis] = (float)word * (2.0f / 4294967295.0f) - 1.0f;
+        }
+        return result;
+    }
+};
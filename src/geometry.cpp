@@ -0,0 +1,320 @@
+#include "geometry.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+#include <fmt/format.h>
+
+#include <stdexcept>
+
+static metrics::Counter &drawCalls = metrics::counter("draw_calls");
+static metrics::Counter &drawCommands = metrics::counter("draw_commands");
+
+RangeAllocator::RangeAllocator(size_t capacity) : capacity(capacity)
+{
+    if(capacity > 0)
+        freeBlocks.insert({0, capacity});
+}
+
+bool RangeAllocator::allocate(size_t size, size_t &offset)
+{
+    for(auto it = freeBlocks.begin(); it != freeBlocks.end(); it++) {
+        if(it->second < size)
+            continue;
+
+        offset = it->first;
+        size_t remaining = it->second - size;
+        freeBlocks.erase(it);
+
+        if(remaining > 0)
+            freeBlocks.insert({offset + size, remaining});
+
+        allocations.insert({offset, size});
+        used += size;
+        return true;
+    }
+
+    return false;
+}
+
+void RangeAllocator::release(size_t offset)
+{
+    auto allocation = allocations.find(offset);
+    if(allocation == allocations.end())
+        throw std::runtime_error(fmt::format("Releasing unknown range at {}", offset));
+
+    size_t size = allocation->second;
+    allocations.erase(allocation);
+    used -= size;
+
+    auto next = freeBlocks.lower_bound(offset);
+    if(next != freeBlocks.end() && offset + size == next->first) {
+        size += next->second;
+        next = freeBlocks.erase(next);
+    }
+
+    if(next != freeBlocks.begin()) {
+        auto prev = std::prev(next);
+        if(prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+
+    freeBlocks.insert({offset, size});
+}
+
+std::map<size_t, size_t> RangeAllocator::compact()
+{
+    std::map<size_t, size_t> moves;
+    std::map<size_t, size_t> packed;
+
+    size_t cursor = 0;
+    for(auto &[offset, size] : allocations) {
+        moves.insert({offset, cursor});
+        packed.insert({cursor, size});
+        cursor += size;
+    }
+
+    allocations = std::move(packed);
+    freeBlocks.clear();
+    if(cursor < capacity)
+        freeBlocks.insert({cursor, capacity - cursor});
+
+    return moves;
+}
+
+void RangeAllocator::grow(size_t newCapacity)
+{
+    if(newCapacity <= capacity)
+        return;
+
+    // Extend the trailing free block, or open a new one
+    auto last = freeBlocks.empty() ? freeBlocks.end() : std::prev(freeBlocks.end());
+    if(last != freeBlocks.end() && last->first + last->second == capacity) {
+        last->second += newCapacity - capacity;
+    } else {
+        freeBlocks.insert({capacity, newCapacity - capacity});
+    }
+
+    capacity = newCapacity;
+}
+
+size_t RangeAllocator::getLargestFree() const
+{
+    size_t largest = 0;
+    for(auto &[offset, size] : freeBlocks) {
+        if(size > largest) largest = size;
+    }
+    return largest;
+}
+
+GeometryArena::GeometryArena(size_t vertexCapacity, size_t indexCapacity, size_t vertexStride) :
+    vbo(0), ebo(0), vao(0), indirectBuffer(0), vertexStride(vertexStride),
+    vertexAllocator(vertexCapacity), indexAllocator(indexCapacity)
+{
+    glCreateVertexArrays(1, &vao);
+    glCreateBuffers(1, &indirectBuffer);
+
+    relocate(vertexCapacity, indexCapacity, {}, {});
+
+    LOG_DEBUG("Created geometry arena {} ({} vertices, {} indices)", vao, vertexCapacity, indexCapacity);
+}
+
+GeometryArena::~GeometryArena()
+{
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+    glDeleteBuffers(1, &indirectBuffer);
+    glDeleteVertexArrays(1, &vao);
+    LOG_DEBUG("Destroyed geometry arena {}", vao);
+}
+
+MeshHandle GeometryArena::addMeshData(const void *vertData, size_t vertexCount, const std::vector<GLuint> &indices)
+{
+    size_t stride = vertexStride;
+
+    if(vertexCount == 0 || indices.empty())
+        throw std::runtime_error("Cannot add an empty mesh to the geometry arena");
+
+    ensureSpace(vertexCount, indices.size());
+
+    size_t baseVertex, firstIndex;
+    vertexAllocator.allocate(vertexCount, baseVertex);
+    indexAllocator.allocate(indices.size(), firstIndex);
+
+    glNamedBufferSubData(vbo, baseVertex * stride, vertexCount * stride, vertData);
+    glNamedBufferSubData(ebo, firstIndex * sizeof(GLuint), indices.size() * sizeof(GLuint), indices.data());
+
+    MeshHandle handle = nextHandle++;
+    meshes.insert({handle, MeshRange {
+        (GLint)baseVertex, (GLuint)firstIndex,
+        (GLuint)indices.size(), (GLuint)vertexCount
+    }});
+
+    return handle;
+}
+
+void GeometryArena::removeMesh(MeshHandle handle)
+{
+    const MeshRange &range = meshes.at(handle);
+    vertexAllocator.release(range.baseVertex);
+    indexAllocator.release(range.firstIndex);
+    meshes.erase(handle);
+}
+
+void GeometryArena::ensureSpace(size_t vertexCount, size_t indexCount)
+{
+    bool vertexFits = vertexAllocator.getLargestFree() >= vertexCount;
+    bool indexFits = indexAllocator.getLargestFree() >= indexCount;
+    if(vertexFits && indexFits)
+        return;
+
+    // Holes may add up to enough space
+    size_t freeVertices = vertexAllocator.getCapacity() - vertexAllocator.getUsed();
+    size_t freeIndices = indexAllocator.getCapacity() - indexAllocator.getUsed();
+    if(freeVertices >= vertexCount && freeIndices >= indexCount) {
+        defragment();
+        return;
+    }
+
+    size_t vertexCapacity = vertexAllocator.getCapacity();
+    size_t indexCapacity = indexAllocator.getCapacity();
+    while(vertexCapacity - vertexAllocator.getUsed() < vertexCount) vertexCapacity = vertexCapacity * 2 + 1;
+    while(indexCapacity - indexAllocator.getUsed() < indexCount) indexCapacity = indexCapacity * 2 + 1;
+
+    auto vertexMoves = vertexAllocator.compact();
+    auto indexMoves = indexAllocator.compact();
+    vertexAllocator.grow(vertexCapacity);
+    indexAllocator.grow(indexCapacity);
+
+    relocate(vertexCapacity, indexCapacity, vertexMoves, indexMoves);
+    LOG_DEBUG("Grew geometry arena to {} vertices, {} indices", vertexCapacity, indexCapacity);
+}
+
+void GeometryArena::defragment()
+{
+    auto vertexMoves = vertexAllocator.compact();
+    auto indexMoves = indexAllocator.compact();
+
+    relocate(vertexAllocator.getCapacity(), indexAllocator.getCapacity(), vertexMoves, indexMoves);
+    LOG_DEBUG("Defragmented geometry arena {}", vao);
+}
+
+void GeometryArena::relocate(
+    size_t vertexCapacity, size_t indexCapacity,
+    const std::map<size_t, size_t> &vertexMoves,
+    const std::map<size_t, size_t> &indexMoves)
+{
+    size_t stride = vertexStride;
+
+    GLuint newVbo, newEbo;
+    glCreateBuffers(1, &newVbo);
+    glCreateBuffers(1, &newEbo);
+    glNamedBufferStorage(newVbo, vertexCapacity * stride, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferStorage(newEbo, indexCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+    // Indices are relative to baseVertex, so both ranges move as plain bytes
+    for(auto &[handle, range] : meshes) {
+        size_t baseVertex = vertexMoves.empty() ? range.baseVertex : vertexMoves.at(range.baseVertex);
+        size_t firstIndex = indexMoves.empty() ? range.firstIndex : indexMoves.at(range.firstIndex);
+
+        glCopyNamedBufferSubData(vbo, newVbo, range.baseVertex * stride, baseVertex * stride, range.vertexCount * stride);
+        glCopyNamedBufferSubData(ebo, newEbo,
+            range.firstIndex * sizeof(GLuint), firstIndex * sizeof(GLuint), range.indexCount * sizeof(GLuint));
+
+        range.baseVertex = (GLint)baseVertex;
+        range.firstIndex = (GLuint)firstIndex;
+    }
+
+    if(vbo) glDeleteBuffers(1, &vbo);
+    if(ebo) glDeleteBuffers(1, &ebo);
+    vbo = newVbo;
+    ebo = newEbo;
+
+    glVertexArrayVertexBuffer(vao, VERTEX_BINDING, vbo, 0, stride);
+    glVertexArrayElementBuffer(vao, ebo);
+}
+
+void GeometryArena::queueDraw(MeshHandle handle, GLuint baseInstance, GLuint instanceCount)
+{
+    const MeshRange &range = meshes.at(handle);
+    commands.push_back(DrawElementsIndirectCommand {
+        range.indexCount, instanceCount,
+        range.firstIndex, range.baseVertex,
+        baseInstance
+    });
+}
+
+void GeometryArena::drawQueued()
+{
+    lastDrawCount = commands.size();
+    if(commands.empty())
+        return;
+
+    size_t size = commands.size() * sizeof(DrawElementsIndirectCommand);
+    if(size > indirectCapacity) {
+        indirectCapacity = size * 2;
+        glNamedBufferData(indirectBuffer, indirectCapacity, nullptr, GL_STREAM_DRAW);
+    }
+    glNamedBufferSubData(indirectBuffer, 0, size, commands.data());
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, commands.size(), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    drawCalls.add();
+    drawCommands.add(commands.size());
+
+    commands.clear();
+}
+
+void GeometryArena::attachStream(const InstanceStream &stream)
+{
+    stream.attach(vao);
+
+    if(stream.getFrequency() == StreamFrequency::Static) {
+        staticBuffer = stream.getBuffer();
+        staticStride = stream.getStride();
+    } else {
+        instanceBuffer = stream.getBuffer();
+        instanceStride = stream.getStride();
+    }
+}
+
+void GeometryArena::drawIndirect(GLuint instances, GLuint commandBuffer, GLsizei drawCount, GLuint staticInstances)
+{
+    glVertexArrayVertexBuffer(vao, INSTANCE_BINDING, instances, 0, instanceStride);
+    if(staticInstances)
+        glVertexArrayVertexBuffer(vao, STATIC_INSTANCE_BINDING, staticInstances, 0, staticStride);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, drawCount, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    drawCalls.add();
+    drawCommands.add(drawCount);
+
+    glVertexArrayVertexBuffer(vao, INSTANCE_BINDING, instanceBuffer, 0, instanceStride);
+    if(staticInstances)
+        glVertexArrayVertexBuffer(vao, STATIC_INSTANCE_BINDING, staticBuffer, 0, staticStride);
+}
+
+void GeometryArena::drawIndirectPulled(GLuint commandBuffer, GLsizei drawCount)
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, drawCount, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    drawCalls.add();
+    drawCommands.add(drawCount);
+}
+
+float GeometryArena::getVertexUsage() const
+{
+    return vertexAllocator.getUsed() / (float)vertexAllocator.getCapacity();
+}
+
+float GeometryArena::getIndexUsage() const
+{
+    return indexAllocator.getUsed() / (float)indexAllocator.getCapacity();
+}
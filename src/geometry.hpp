@@ -0,0 +1,159 @@
+#pragma once
+
+#include "layout.hpp"
+#include "instancestream.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <memory>
+#include <vector>
+
+// First-fit allocator over an abstract range of elements.
+// Free neighbours are coalesced on release.
+class RangeAllocator {
+public:
+    RangeAllocator(size_t capacity);
+
+    // Returns false if no free block is large enough
+    bool allocate(size_t size, size_t &offset);
+    void release(size_t offset);
+
+    // Moves every allocation to the front, keeping their order.
+    // Returns old offset -> new offset for each allocation.
+    std::map<size_t, size_t> compact();
+    void grow(size_t newCapacity);
+
+    size_t getCapacity() const { return capacity; }
+    size_t getUsed() const { return used; }
+    size_t getLargestFree() const;
+    const std::map<size_t, size_t> &getAllocations() const { return allocations; }
+
+private:
+    size_t capacity;
+    size_t used = 0;
+
+    std::map<size_t, size_t> freeBlocks; // offset -> size
+    std::map<size_t, size_t> allocations; // offset -> size
+};
+
+struct MeshRange {
+    GLint baseVertex;
+    GLuint firstIndex;
+    GLuint indexCount;
+    GLuint vertexCount;
+};
+
+// Layout expected by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+using MeshHandle = uint32_t;
+
+// Stores many meshes in one vertex buffer and one index buffer behind
+// a single VAO, so they can all be drawn with one multi-draw call.
+class GeometryArena {
+public:
+    GeometryArena(size_t vertexCapacity, size_t indexCapacity, size_t vertexStride);
+    ~GeometryArena();
+
+    template<typename V>
+    static std::unique_ptr<GeometryArena> create(size_t vertexCapacity, size_t indexCapacity);
+    template<typename V, typename I>
+    static std::unique_ptr<GeometryArena> create(size_t vertexCapacity, size_t indexCapacity, GLuint instanceBuffer);
+
+    // Reads the stream's attributes from its binding point in every draw
+    void attachStream(const InstanceStream &stream);
+
+    template<typename V>
+    MeshHandle addMesh(const std::vector<V> &vertData, const std::vector<GLuint> &indices);
+    void removeMesh(MeshHandle handle);
+    const MeshRange &getRange(MeshHandle handle) { return meshes.at(handle); }
+
+    // Packs all meshes to the start of the buffers
+    void defragment();
+
+    // Per-draw instance range, taken from the shared instance buffer
+    void queueDraw(MeshHandle handle, GLuint baseInstance, GLuint instanceCount);
+    // Submits every queued draw in one call and clears the queue
+    void drawQueued();
+    // Draws commands written by the GPU, with instances read from `instances`
+    // and, if given, static attributes from `staticInstances`
+    void drawIndirect(GLuint instances, GLuint commandBuffer, GLsizei drawCount = 1, GLuint staticInstances = 0);
+    // Same for shaders that pull their instances from storage buffers,
+    // the instance bindings are left alone
+    void drawIndirectPulled(GLuint commandBuffer, GLsizei drawCount = 1);
+
+    size_t getLastDrawCount() const { return lastDrawCount; }
+    size_t getMeshCount() const { return meshes.size(); }
+    float getVertexUsage() const;
+    float getIndexUsage() const;
+
+private:
+    MeshHandle addMeshData(const void *vertData, size_t vertexCount, const std::vector<GLuint> &indices);
+
+    // Copies live ranges into new buffers, optionally moving them
+    void relocate(
+        size_t vertexCapacity, size_t indexCapacity,
+        const std::map<size_t, size_t> &vertexMoves,
+        const std::map<size_t, size_t> &indexMoves
+    );
+    void ensureSpace(size_t vertexCount, size_t indexCount);
+
+    GLuint vbo, ebo, vao;
+    GLuint indirectBuffer;
+    size_t vertexStride;
+
+    GLuint instanceBuffer = 0;
+    GLsizei instanceStride = 0;
+    GLuint staticBuffer = 0;
+    GLsizei staticStride = 0;
+    size_t indirectCapacity = 0;
+
+    RangeAllocator vertexAllocator;
+    RangeAllocator indexAllocator;
+
+    MeshHandle nextHandle = 0;
+    std::map<MeshHandle, MeshRange> meshes;
+
+    std::vector<DrawElementsIndirectCommand> commands;
+    size_t lastDrawCount = 0;
+};
+
+template<typename V>
+std::unique_ptr<GeometryArena> GeometryArena::create(size_t vertexCapacity, size_t indexCapacity)
+{
+    auto arena = std::make_unique<GeometryArena>(vertexCapacity, indexCapacity, sizeof(V));
+    setupLayout<V>(arena->vao, VERTEX_BINDING);
+    return arena;
+}
+
+template<typename V, typename I>
+std::unique_ptr<GeometryArena> GeometryArena::create(size_t vertexCapacity, size_t indexCapacity, GLuint instanceBuffer)
+{
+    auto arena = create<V>(vertexCapacity, indexCapacity);
+
+    // Instance attributes advance per instance, starting at each draw's baseInstance
+    bindLayout<I>(arena->vao, INSTANCE_BINDING, instanceBuffer);
+    arena->instanceBuffer = instanceBuffer;
+    arena->instanceStride = sizeof(I);
+
+    return arena;
+}
+
+template<typename V>
+MeshHandle GeometryArena::addMesh(const std::vector<V> &vertData, const std::vector<GLuint> &indices)
+{
+    if(sizeof(V) != vertexStride)
+        throw std::runtime_error("Vertex format does not match the geometry arena");
+
+    return addMeshData(vertData.data(), vertData.size(), indices);
+}
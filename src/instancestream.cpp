@@ -0,0 +1,86 @@
+#include "instancestream.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+static metrics::Counter &uploadedCounter = metrics::counter("upload_bytes");
+
+InstanceStream::InstanceStream(StreamFrequency frequency, GLsizei stride, void (*setup)(GLuint vao, GLuint binding)) :
+    frequency(frequency), stride(stride), setup(setup)
+{
+    glCreateBuffers(1, &buffer);
+    LOG_DEBUG("Created {} instance stream {}", frequency == StreamFrequency::Static ? "static" : "dynamic", buffer);
+}
+
+InstanceStream::~InstanceStream()
+{
+    glDeleteBuffers(1, &buffer);
+    LOG_DEBUG("Deleted instance stream {}", buffer);
+}
+
+const char *uploadStrategyName(UploadStrategy strategy)
+{
+    switch(strategy) {
+        case UploadStrategy::Orphan: return "orphan";
+        case UploadStrategy::SubData: return "subdata";
+        case UploadStrategy::Map: return "map";
+    }
+    return "unknown";
+}
+
+void InstanceStream::upload(const void *data, size_t count)
+{
+    size_t size = count * stride;
+    GLenum usage = frequency == StreamFrequency::Static ? GL_STATIC_DRAW : GL_STREAM_DRAW;
+
+    // Respecifying the whole store lets the driver hand out fresh memory
+    // instead of waiting for draws still reading the old contents. The
+    // other two need a store to write into first.
+    if(strategy == UploadStrategy::Orphan || size > capacity) {
+        glNamedBufferData(buffer, size, data, usage);
+        capacity = size;
+    } else if(strategy == UploadStrategy::SubData) {
+        glNamedBufferSubData(buffer, 0, size, data);
+    } else if(size > 0) {
+        void *mapped = glMapNamedBufferRange(buffer, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if(mapped)
+            std::memcpy(mapped, data, size);
+        // The contents can get lost while mapped, then they're sent again
+        if(!mapped || !glUnmapNamedBuffer(buffer))
+            glNamedBufferSubData(buffer, 0, size, data);
+    }
+
+    this->count = count;
+    uploadedBytes += size;
+    uploadedCounter.add(size);
+}
+
+void InstanceStream::uploadRange(const void *data, size_t first, size_t count)
+{
+    if(first + count > this->count)
+        throw std::runtime_error("Instance range is outside the stream");
+
+    glNamedBufferSubData(buffer, first * stride, count * stride, data);
+    uploadedBytes += count * stride;
+    uploadedCounter.add(count * stride);
+}
+
+void InstanceStream::attach(GLuint vao) const
+{
+    setup(vao, getBinding());
+    glVertexArrayVertexBuffer(vao, getBinding(), buffer, 0, stride);
+}
+
+GLuint InstanceStream::getBinding() const
+{
+    return frequency == StreamFrequency::Static ? STATIC_INSTANCE_BINDING : INSTANCE_BINDING;
+}
+
+size_t InstanceStream::takeUploadedBytes()
+{
+    size_t bytes = uploadedBytes;
+    uploadedBytes = 0;
+    return bytes;
+}
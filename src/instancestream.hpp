@@ -0,0 +1,86 @@
+#pragma once
+
+#include "layout.hpp"
+
+#include <GL/glew.h>
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+enum class StreamFrequency {
+    Static,  // uploaded once, and again only if the instances change
+    Dynamic, // uploaded every frame
+};
+
+// How a whole upload reaches the buffer. Which is fastest depends on the
+// driver, so it's left to the auto-tuner.
+enum class UploadStrategy : uint32_t {
+    Orphan,  // respecify the store with glBufferData
+    SubData, // overwrite the store in place with glBufferSubData
+    Map,     // map with the old contents invalidated and copy
+};
+constexpr uint32_t UPLOAD_STRATEGY_COUNT = 3;
+
+const char *uploadStrategyName(UploadStrategy strategy);
+
+// A buffer of per-instance attributes with one update frequency.
+// Each frequency has its own binding point, so a VAO can read static
+// and dynamic attributes of the same instance from separate buffers.
+class InstanceStream {
+public:
+    InstanceStream(StreamFrequency frequency, GLsizei stride, void (*setup)(GLuint vao, GLuint binding));
+    ~InstanceStream();
+
+    template<typename I>
+    static std::unique_ptr<InstanceStream> create(StreamFrequency frequency);
+
+    void upload(const void *data, size_t count);
+    // Overwrites instances [first, first + count) with `data`
+    void uploadRange(const void *data, size_t first, size_t count);
+    template<typename I>
+    void upload(const std::vector<I> &data);
+
+    // Points the stream's attributes at this stream's buffer
+    void attach(GLuint vao) const;
+
+    GLuint getBuffer() const { return buffer; }
+    GLuint getBinding() const;
+    GLsizei getStride() const { return stride; }
+    size_t getCount() const { return count; }
+    StreamFrequency getFrequency() const { return frequency; }
+
+    void setUploadStrategy(UploadStrategy strategy) { this->strategy = strategy; }
+    UploadStrategy getUploadStrategy() const { return strategy; }
+
+    // Bytes uploaded since the last call
+    size_t takeUploadedBytes();
+
+private:
+    StreamFrequency frequency;
+    GLsizei stride;
+    void (*setup)(GLuint vao, GLuint binding);
+
+    GLuint buffer;
+    size_t count = 0;
+    // Bytes of storage, may be more than count instances
+    size_t capacity = 0;
+    UploadStrategy strategy = UploadStrategy::Orphan;
+    size_t uploadedBytes = 0;
+};
+
+template<typename I>
+std::unique_ptr<InstanceStream> InstanceStream::create(StreamFrequency frequency)
+{
+    static_assert(VertexLayout<I>::divisor > 0, "Instance streams need a per-instance layout");
+    return std::make_unique<InstanceStream>(frequency, sizeof(I), &setupLayout<I>);
+}
+
+template<typename I>
+void InstanceStream::upload(const std::vector<I> &data)
+{
+    if(sizeof(I) != (size_t)stride)
+        throw std::runtime_error("Instance format does not match the stream");
+
+    upload(data.data(), data.size());
+}
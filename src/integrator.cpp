@@ -0,0 +1,231 @@
+#include "integrator.hpp"
+#include "morton.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <utility>
+
+int BlockIntegrator::chooseLevel(const glm::vec3 &acceleration, float deltaTime) const
+{
+    float magnitude = glm::length(acceleration);
+    if(magnitude <= 0.0f)
+        return 0;
+
+    float wanted = settings.accuracy * std::sqrt(settings.softening / magnitude);
+    if(wanted >= deltaTime)
+        return 0;
+
+    int level = (int)std::ceil(std::log2(deltaTime / wanted));
+    return std::min(level, settings.maxLevel);
+}
+
+template<uint32_t Terms, bool Observe>
+int BlockIntegrator::advance(
+    glm::vec3 &position, glm::vec3 &velocity, glm::vec3 &accel,
+    float deltaTime, int maxLevel, size_t &evaluations, float &potential) const
+{
+    uint32_t finestSteps = 1u << maxLevel;
+    int deepest = 0;
+
+    // Time is counted in units of the finest step
+    uint32_t time = 0;
+    while(time < finestSteps) {
+        int level = std::min(chooseLevel(accel, deltaTime), maxLevel);
+
+        // Steps have to start on a multiple of their own size
+        while(time % (finestSteps >> level) != 0) level++;
+
+        float dt = deltaTime / (float)(1u << level);
+
+        velocity += accel * (dt * 0.5f);
+        position += velocity * dt;
+        if constexpr(Observe)
+            accel = ForceLaw<Terms>::acceleration(settings, position, potential);
+        else
+            accel = ForceLaw<Terms>::acceleration(settings, position);
+        velocity += accel * (dt * 0.5f);
+
+        time += finestSteps >> level;
+        deepest = std::max(deepest, level);
+        evaluations++;
+    }
+
+    return deepest;
+}
+
+void BlockIntegrator::step(
+    std::vector<glm::vec3> &positions,
+    std::vector<glm::vec3> &velocities,
+    float deltaTime,
+    ThreadPool &pool,
+    ActivityTracker *activity)
+{
+    using Kernel = void (BlockIntegrator::*)(
+        std::vector<glm::vec3> &, std::vector<glm::vec3> &, float, ThreadPool &, ActivityTracker *);
+
+    // Every combination of terms, each with and without diagnostics
+    static constexpr auto kernels = []<uint32_t... Index>(std::integer_sequence<uint32_t, Index...>) {
+        return std::array<Kernel, sizeof...(Index)>{ &BlockIntegrator::stepWith<Index / 2, Index % 2 != 0>... };
+    }(std::make_integer_sequence<uint32_t, FORCE_TERM_COMBINATIONS * 2>());
+
+    size_t kernel = activeForceTerms(settings) * 2 + (diagnosticsOn ? 1 : 0);
+    (this->*kernels[kernel])(positions, velocities, deltaTime, pool, activity);
+    tickSeed++;
+}
+
+template<uint32_t Terms, bool Diagnose>
+void BlockIntegrator::stepWith(
+    std::vector<glm::vec3> &positions,
+    std::vector<glm::vec3> &velocities,
+    float deltaTime,
+    ThreadPool &pool,
+    ActivityTracker *activity)
+{
+    using Law = ForceLaw<Terms>;
+
+    size_t count = positions.size();
+    int maxLevel = std::clamp(settings.maxLevel, 0, MAX_TIMESTEP_LEVELS - 1);
+    // Activity blocks must not straddle chunks
+    size_t perChunk = std::max<size_t>(chunkSize / ActivityTracker::BLOCK_SIZE, 1) * ActivityTracker::BLOCK_SIZE;
+
+    // The cached kick would belong to the old field
+    if(accelerations.size() != count || accelerationSettings != settings) {
+        accelerations.resize(count);
+        sleepPotentials.resize(count);
+        sleepingBlocks.resize((count + ActivityTracker::BLOCK_SIZE - 1) / ActivityTracker::BLOCK_SIZE);
+        sleepingBlockCached.assign(sleepingBlocks.size(), 0);
+        accelerationSettings = settings;
+        pool.parallelFor(count, perChunk, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                accelerations[i] = Law::acceleration(settings, positions[i], sleepPotentials[i]);
+            }
+        });
+    }
+    if(activity && activity->getCount() != count)
+        activity->resize(count);
+
+    std::atomic<size_t> forceEvaluations = 0;
+    std::atomic<size_t> steppedParticles = 0;
+    std::array<size_t, MAX_TIMESTEP_LEVELS> levelCounts = {};
+    std::mutex statsMutex;
+
+    if constexpr(Diagnose)
+        partials.assign((count + perChunk - 1) / perChunk, SimulationDiagnostics());
+
+    // There is no coupling between particles, so each one runs through
+    // the whole tick on its own and they all meet again at the end
+    pool.parallelFor(count, perChunk, [&](size_t begin, size_t end) {
+        size_t localEvaluations = 0;
+        size_t localStepped = 0;
+        std::array<size_t, MAX_TIMESTEP_LEVELS> localLevels = {};
+        // Kept local, so the sums can stay in registers
+        SimulationDiagnostics partial;
+        // Potentials of the block being stepped, summed with it once it's done
+        float blockPotentials[ActivityTracker::BLOCK_SIZE];
+
+        for(size_t first = begin; first < end; first += ActivityTracker::BLOCK_SIZE) {
+            size_t block = first / ActivityTracker::BLOCK_SIZE;
+            size_t last = std::min(first + ActivityTracker::BLOCK_SIZE, end);
+
+            // Fully asleep blocks cost one check, and nothing in them
+            // moves, so their sums only need working out once
+            if(activity && !activity->isBlockAwake(block)) {
+                if constexpr(Diagnose) {
+                    if(!sleepingBlockCached[block]) {
+                        sleepingBlocks[block] = SimulationDiagnostics();
+                        sleepingBlocks[block].add(&positions[first], &velocities[first], &sleepPotentials[first], last - first);
+                        sleepingBlockCached[block] = 1;
+                    }
+                    partial.merge(sleepingBlocks[block]);
+                }
+                continue;
+            }
+            sleepingBlockCached[block] = 0;
+
+            for(size_t i = first; i < last; i++) {
+                // Sleeping particles still count, they're just not moved
+                if(activity && !activity->isAwake(i)) {
+                    if constexpr(Diagnose)
+                        blockPotentials[i - first] = sleepPotentials[i];
+                    continue;
+                }
+
+                glm::vec3 position = positions[i];
+                glm::vec3 velocity = velocities[i];
+                glm::vec3 accel = accelerations[i];
+
+                // The potential falls out of the last force evaluation
+                float potential = 0.0f;
+                int deepest = advance<Terms, Diagnose>(position, velocity, accel, deltaTime, maxLevel, localEvaluations, potential);
+                if(Law::finish(settings, (uint32_t)i * 0x9E3779B9u ^ tickSeed, position, velocity, deltaTime))
+                    accel = Law::acceleration(settings, position, potential);
+
+                // Falling asleep freezes the particle where it is, so its
+                // potential stays what it is now until something wakes it
+                if(activity && activity->settle(i, velocity, accel, deltaTime)) {
+                    velocity = glm::vec3(0.0f);
+                    sleepPotentials[i] = Diagnose ? potential : Law::potential(settings, position);
+                }
+
+                positions[i] = position;
+                velocities[i] = velocity;
+                accelerations[i] = accel;
+                // Only after the writes, so whoever takes the span sees them
+                if(activity)
+                    activity->markDirty(i);
+                if constexpr(Diagnose)
+                    blockPotentials[i - first] = potential;
+                localLevels[deepest]++;
+                localStepped++;
+            }
+
+            if constexpr(Diagnose)
+                partial.add(&positions[first], &velocities[first], blockPotentials, last - first);
+            if(activity)
+                activity->refreshBlock(block);
+        }
+
+        forceEvaluations += localEvaluations;
+        steppedParticles += localStepped;
+        if constexpr(Diagnose)
+            partials[begin / perChunk] = partial;
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        for(int level = 0; level < MAX_TIMESTEP_LEVELS; level++) {
+            levelCounts[level] += localLevels[level];
+        }
+    });
+
+    int finestUsed = 0;
+    for(int level = 0; level < MAX_TIMESTEP_LEVELS; level++) {
+        if(levelCounts[level] > 0) finestUsed = level;
+    }
+
+    stats.forceEvaluations = forceEvaluations;
+    stats.sharedStepEvaluations = count << finestUsed;
+    stats.levelCounts = levelCounts;
+    stats.steppedParticles = steppedParticles;
+    stats.forceTerms = Terms;
+
+    if constexpr(Diagnose) {
+        diagnostics = SimulationDiagnostics();
+        for(const SimulationDiagnostics &chunk : partials) {
+            diagnostics.merge(chunk);
+        }
+    }
+
+    if(activity)
+        activity->setAwakeCount(steppedParticles);
+}
+
+void BlockIntegrator::permute(const std::vector<uint32_t> &order, ThreadPool &pool)
+{
+    if(accelerations.size() != order.size())
+        return;
+
+    morton::permute(accelerations, order, pool);
+    morton::permute(sleepPotentials, order, pool);
+    std::fill(sleepingBlockCached.begin(), sleepingBlockCached.end(), 0);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "threadpool.hpp"
+#include "activity.hpp"
+#include "forcelaw.hpp"
+#include "diagnostics.hpp"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+constexpr int MAX_TIMESTEP_LEVELS = 16;
+constexpr size_t DEFAULT_INTEGRATOR_CHUNK_SIZE = 4096;
+
+// Leapfrog (kick-drift-kick) integration of a softened central attractor,
+// plus whichever ForceLaw terms are switched on, with power-of-two
+// individual timesteps. Every particle advances through
+// the tick in steps of deltaTime / 2^level, where the level comes from its
+// acceleration, so only particles in the strong field get sub-stepped.
+// With an ActivityTracker, sleeping particles are skipped and the ones
+// that moved are marked dirty.
+class BlockIntegrator {
+public:
+    struct Stats {
+        size_t forceEvaluations;
+        // What a shared step at the finest used level would have cost
+        size_t sharedStepEvaluations;
+        std::array<size_t, MAX_TIMESTEP_LEVELS> levelCounts;
+        // Particles that were awake and got stepped
+        size_t steppedParticles;
+        // ForceTerm bits of the kernel that ran
+        uint32_t forceTerms;
+    };
+
+    void step(
+        std::vector<glm::vec3> &positions,
+        std::vector<glm::vec3> &velocities,
+        float deltaTime,
+        ThreadPool &pool,
+        ActivityTracker *activity = nullptr
+    );
+
+    // Keeps per-particle state in line with reordered particle arrays
+    void permute(const std::vector<uint32_t> &order, ThreadPool &pool);
+
+    const Stats &getStats() const { return stats; }
+    // Of the last tick that ran with diagnostics on
+    const SimulationDiagnostics &getDiagnostics() const { return diagnostics; }
+
+    GravitySettings settings;
+    // Reduce energy, momentum, bounds and bad values in the same sweep
+    bool diagnosticsOn = false;
+    // Particles per parallel task, rounded to whole activity blocks
+    size_t chunkSize = DEFAULT_INTEGRATOR_CHUNK_SIZE;
+
+private:
+    template<uint32_t Terms, bool Diagnose>
+    void stepWith(
+        std::vector<glm::vec3> &positions,
+        std::vector<glm::vec3> &velocities,
+        float deltaTime,
+        ThreadPool &pool,
+        ActivityTracker *activity
+    );
+
+    int chooseLevel(const glm::vec3 &acceleration, float deltaTime) const;
+    // Runs one particle through the tick, returns the finest level it used.
+    // With Observe, leaves the potential at the final position in potential.
+    template<uint32_t Terms, bool Observe>
+    int advance(
+        glm::vec3 &position, glm::vec3 &velocity, glm::vec3 &accel,
+        float deltaTime, int maxLevel, size_t &evaluations, float &potential
+    ) const;
+
+    // Acceleration at the end of the last step, reused by the next kick
+    std::vector<glm::vec3> accelerations;
+    // Settings the cached accelerations were evaluated with
+    GravitySettings accelerationSettings;
+    // Potential where each sleeping particle fell asleep, so diagnostics
+    // don't evaluate the field for particles that aren't moving
+    std::vector<float> sleepPotentials;
+    // Diagnostics of each fully asleep activity block, valid where the
+    // flag is set and dropped as soon as the block is stepped again
+    std::vector<SimulationDiagnostics> sleepingBlocks;
+    std::vector<uint8_t> sleepingBlockCached;
+    uint32_t tickSeed = 0;
+
+    Stats stats = {};
+
+    // One partial per chunk, merged in order
+    std::vector<SimulationDiagnostics> partials;
+    SimulationDiagnostics diagnostics;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Compile-time description of vertex and instance formats.
+//
+// A format is a plain struct plus a specialization of VertexLayout for it:
+//
+//     template<> struct VertexLayout<MyVertex> {
+//         static constexpr GLuint divisor = 0;
+//         static constexpr std::array attributes = {
+//             LAYOUT_ATTRIB(MyVertex, position, 0, AttribMode::Float),
+//         };
+//     };
+//
+// Component count and GL type are deduced from the member type.
+
+// Binding points used by every mesh VAO
+constexpr GLuint VERTEX_BINDING = 0;
+constexpr GLuint INSTANCE_BINDING = 1;        // streamed every frame
+constexpr GLuint STATIC_INSTANCE_BINDING = 2; // uploaded once
+
+enum class AttribMode {
+    Float,      // floating point, or integers converted as-is
+    Normalized, // integers mapped to [0, 1] / [-1, 1]
+    Integer,    // integers kept as integers (ivec/uvec in GLSL)
+};
+
+struct VertexAttribute {
+    GLuint location;
+    GLint components;
+    GLenum type;
+    AttribMode mode;
+    GLuint offset;
+    GLuint size;
+};
+
+template<typename T> struct ComponentType;
+template<> struct ComponentType<float> { static constexpr GLenum value = GL_FLOAT; };
+template<> struct ComponentType<int8_t> { static constexpr GLenum value = GL_BYTE; };
+template<> struct ComponentType<uint8_t> { static constexpr GLenum value = GL_UNSIGNED_BYTE; };
+template<> struct ComponentType<int16_t> { static constexpr GLenum value = GL_SHORT; };
+template<> struct ComponentType<uint16_t> { static constexpr GLenum value = GL_UNSIGNED_SHORT; };
+template<> struct ComponentType<int32_t> { static constexpr GLenum value = GL_INT; };
+template<> struct ComponentType<uint32_t> { static constexpr GLenum value = GL_UNSIGNED_INT; };
+
+template<typename T> struct AttribTraits {
+    static constexpr GLint components = 1;
+    static constexpr GLenum type = ComponentType<T>::value;
+};
+
+template<glm::length_t L, typename T, glm::qualifier Q> struct AttribTraits<glm::vec<L, T, Q>> {
+    static_assert(L >= 1 && L <= 4, "Attributes have 1 to 4 components");
+    static constexpr GLint components = L;
+    static constexpr GLenum type = ComponentType<T>::value;
+};
+
+template<typename T>
+constexpr VertexAttribute makeAttribute(GLuint location, size_t offset, AttribMode mode)
+{
+    return VertexAttribute {
+        location,
+        AttribTraits<T>::components,
+        AttribTraits<T>::type,
+        mode,
+        (GLuint)offset,
+        (GLuint)sizeof(T)
+    };
+}
+
+#define LAYOUT_ATTRIB(STRUCT, MEMBER, LOCATION, MODE) \
+    makeAttribute<decltype(STRUCT::MEMBER)>(LOCATION, offsetof(STRUCT, MEMBER), MODE)
+
+template<typename T> struct VertexLayout;
+
+template<typename T>
+constexpr bool validateLayout()
+{
+    using Layout = VertexLayout<T>;
+    for(size_t i = 0; i < Layout::attributes.size(); i++) {
+        const VertexAttribute &attrib = Layout::attributes[i];
+        if(attrib.offset + attrib.size > sizeof(T))
+            return false;
+        if(attrib.mode != AttribMode::Float && attrib.type == GL_FLOAT)
+            return false;
+        for(size_t j = 0; j < i; j++) {
+            const VertexAttribute &other = Layout::attributes[j];
+            if(other.location == attrib.location)
+                return false;
+            if(other.offset < attrib.offset + attrib.size && attrib.offset < other.offset + other.size)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Points every attribute of T at `binding` and sets its step rate
+template<typename T>
+void setupLayout(GLuint vao, GLuint binding)
+{
+    static_assert(std::is_standard_layout_v<T>, "Layout structs must be standard layout");
+    static_assert(validateLayout<T>(), "Overlapping, out of bounds or mistyped attribute in layout");
+
+    for(const VertexAttribute &attrib : VertexLayout<T>::attributes) {
+        glEnableVertexArrayAttrib(vao, attrib.location);
+
+        if(attrib.mode == AttribMode::Integer) {
+            glVertexArrayAttribIFormat(vao, attrib.location, attrib.components, attrib.type, attrib.offset);
+        } else {
+            glVertexArrayAttribFormat(vao, attrib.location, attrib.components, attrib.type,
+                attrib.mode == AttribMode::Normalized, attrib.offset);
+        }
+
+        glVertexArrayAttribBinding(vao, attrib.location, binding);
+    }
+
+    glVertexArrayBindingDivisor(vao, binding, VertexLayout<T>::divisor);
+}
+
+// Setup and buffer binding in one go
+template<typename T>
+void bindLayout(GLuint vao, GLuint binding, GLuint buffer, GLintptr offset = 0)
+{
+    setupLayout<T>(vao, binding);
+    glVertexArrayVertexBuffer(vao, binding, buffer, offset, sizeof(T));
+}
@@ -3,8 +3,9 @@
 
 #include <stdexcept>
 
-int main() try {
-    Application app;
+int main(int argc, char **argv) try {
+    LaunchOptions options = LaunchOptions::parse(argc, argv);
+    Application app(options);
     
     app.run();
 } catch(std::runtime_error &e) {
@@ -49,6 +49,15 @@ void Material::use()
     glUseProgram(program);
 }
 
+void Material::addKnownLocations(const std::map<std::string, GLint> &locations)
+{
+    for(const auto &[name, location] : locations) {
+        auto it = uniforms.find(name);
+        if(it == uniforms.end() || it->second.location == (GLuint)-1)
+            uniforms[name] = MaterialProperty { (GLuint)location, GL_NONE };
+    }
+}
+
 void Material::uniform1(const std::string &name, GLint value)
 {
     glUniform1i(getLocation(name), value);
@@ -79,6 +88,11 @@ void Material::uniform4(const std::string &name, glm::vec4 vec)
     glUniform4fv(getLocation(name), 1, glm::value_ptr(vec));
 }
 
+void Material::uniform4v(const std::string &name, const glm::vec4 *vecs, GLsizei count)
+{
+    glUniform4fv(getLocation(name), count, glm::value_ptr(vecs[0]));
+}
+
 void Material::uniform4x4(const std::string &name, glm::mat4 matrix)
 {
     glUniformMatrix4fv(getLocation(name), 1, false, glm::value_ptr(matrix));
@@ -122,12 +136,15 @@ std::shared_ptr<Material> MaterialBuilder::buildMaterial()
         throw std::runtime_error(fmt::format("Failed to link shaders in material: {}", infoLog));
     }
 
+    std::shared_ptr<Material> material = std::make_shared<Material>(program);
+
     for(auto shader : attachedShaders) {
+        material->addKnownLocations(shader->uniformLocations);
         glDetachShader(program, shader->getId());
     }
     attachedShaders.clear();
 
-    return std::make_shared<Material>(program);
+    return material;
 }
 
 MaterialBuilder MaterialBuilder::attachShader(std::shared_ptr<Shader> shader)
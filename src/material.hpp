@@ -23,6 +23,8 @@ public:
 
     void use();
     GLuint getHandle() { return program; }
+    // Fills in uniforms the driver didn't report by name
+    void addKnownLocations(const std::map<std::string, GLint> &locations);
 
     void uniform1(const std::string &name, GLint value);
     void uniform1(const std::string &name, GLuint value);
@@ -30,6 +32,7 @@ public:
     void uniform2(const std::string &name, glm::vec2 vec);
     void uniform3(const std::string &name, glm::vec3 vec);
     void uniform4(const std::string &name, glm::vec4 vec);
+    void uniform4v(const std::string &name, const glm::vec4 *vecs, GLsizei count);
     void uniform4x4(const std::string &name, glm::mat4 matrix);
 
 private:
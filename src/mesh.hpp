@@ -1,17 +1,51 @@
 #pragma once
 
+#include "layout.hpp"
+#include "instancestream.hpp"
+
 #include <GL/glew.h>
 #include <vector>
 #include <glm/glm.hpp>
 #include <memory>
 
-constexpr int VERTEX_ATTRIBS[] = {
-    3, // v_position
-    3, // v_normal
+struct Vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+struct InstanceOffset {
+    glm::vec3 offset;
+};
+
+// Per-instance attributes that don't change as the instance moves
+struct InstanceAttributes {
+    glm::u8vec4 color;
+    float scale;
+    uint32_t palette;
+};
+
+template<> struct VertexLayout<Vertex> {
+    static constexpr GLuint divisor = 0;
+    static constexpr std::array attributes = {
+        LAYOUT_ATTRIB(Vertex, position, 0, AttribMode::Float), // v_position
+        LAYOUT_ATTRIB(Vertex, normal, 1, AttribMode::Float),   // v_normal
+    };
 };
 
-constexpr int INSTANCE_ATTRIBS[] = {
-    3, // i_offset
+template<> struct VertexLayout<InstanceOffset> {
+    static constexpr GLuint divisor = 1;
+    static constexpr std::array attributes = {
+        LAYOUT_ATTRIB(InstanceOffset, offset, 2, AttribMode::Float), // i_offset
+    };
+};
+
+template<> struct VertexLayout<InstanceAttributes> {
+    static constexpr GLuint divisor = 1;
+    static constexpr std::array attributes = {
+        LAYOUT_ATTRIB(InstanceAttributes, color, 3, AttribMode::Normalized), // i_color
+        LAYOUT_ATTRIB(InstanceAttributes, scale, 4, AttribMode::Float),      // i_scale
+        LAYOUT_ATTRIB(InstanceAttributes, palette, 5, AttribMode::Integer),  // i_palette
+    };
 };
 
 class Mesh {
@@ -22,18 +56,49 @@ public:
     void draw();
     void drawInstanced(size_t instanceCount);
 
+    // Reads the stream's attributes from its binding point
+    void attachStream(const InstanceStream &stream) { stream.attach(vao); }
+
+    template<typename V>
     static std::shared_ptr<Mesh> createFromVertexArray(
-        const std::vector<float> &vertData,
+        const std::vector<V> &vertData,
         const std::vector<GLuint> &indices
     );
+    template<typename V, typename I>
     static std::shared_ptr<Mesh> createFromVertexArrayInstanced(
-        const std::vector<float> &vertData,
+        const std::vector<V> &vertData,
         const std::vector<GLuint> &indices,
         GLuint instanceBuffer
     );
 
 private:
+    static std::shared_ptr<Mesh> createBuffers(
+        const void *vertData, size_t vertSize,
+        const std::vector<GLuint> &indices
+    );
+
     GLuint vbo, vao, ebo;
     
     size_t elementCount;
 };
+
+template<typename V>
+std::shared_ptr<Mesh> Mesh::createFromVertexArray(
+    const std::vector<V> &vertData,
+    const std::vector<GLuint> &indices)
+{
+    std::shared_ptr<Mesh> mesh = createBuffers(vertData.data(), vertData.size() * sizeof(V), indices);
+    bindLayout<V>(mesh->vao, VERTEX_BINDING, mesh->vbo);
+    return mesh;
+}
+
+template<typename V, typename I>
+std::shared_ptr<Mesh> Mesh::createFromVertexArrayInstanced(
+    const std::vector<V> &vertData,
+    const std::vector<GLuint> &indices,
+    GLuint instanceBuffer)
+{
+    std::shared_ptr<Mesh> mesh = createFromVertexArray(vertData, indices);
+    bindLayout<I>(mesh->vao, INSTANCE_BINDING, instanceBuffer);
+    return mesh;
+}
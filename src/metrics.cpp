@@ -0,0 +1,373 @@
+#include "metrics.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+using metrics::Counter;
+using metrics::Gauge;
+using metrics::Histogram;
+
+constexpr uint64_t MAX_NANOSECONDS = (1ull << 40) - 1;
+constexpr size_t SUB_BUCKET_BITS = 3;
+static_assert(Histogram::SUB_BUCKETS == 1 << SUB_BUCKET_BITS);
+
+// Constant initialized, so it counts allocations made before main too
+static constinit Counter allocationCounter;
+
+static std::atomic<size_t> nextShard = 0;
+
+namespace {
+    template<typename M>
+    struct Family {
+        std::map<std::string, M*> byName;
+        std::vector<std::unique_ptr<M>> owned;
+
+        M &get(const std::string &name)
+        {
+            auto it = byName.find(name);
+            if(it != byName.end())
+                return *it->second;
+
+            owned.push_back(std::make_unique<M>());
+            byName[name] = owned.back().get();
+            return *owned.back();
+        }
+
+        metrics::Entries<M> entries() const { return { byName.begin(), byName.end() }; }
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        Family<Counter> counters;
+        Family<Gauge> gauges;
+        Family<Histogram> histograms;
+
+        Registry()
+        {
+            counters.byName["allocations"] = &allocationCounter;
+        }
+    };
+
+    Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+}
+
+size_t metrics::threadShard()
+{
+    thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+    return shard;
+}
+
+uint64_t Counter::total() const
+{
+    uint64_t sum = 0;
+    for(const Shard &shard : shards) {
+        sum += shard.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+// Below 16ns every value has its own bucket, above that the top four bits
+// of the value pick it
+static size_t bucketOf(uint64_t nanoseconds)
+{
+    constexpr uint64_t sub = Histogram::SUB_BUCKETS;
+    if(nanoseconds < sub * 2)
+        return nanoseconds;
+
+    size_t shift = std::bit_width(nanoseconds) - SUB_BUCKET_BITS - 1;
+    return (shift + 1) * sub + ((nanoseconds >> shift) - sub);
+}
+
+static uint64_t bucketUpperBound(size_t bucket)
+{
+    constexpr uint64_t sub = Histogram::SUB_BUCKETS;
+    if(bucket < sub * 2)
+        return bucket;
+
+    size_t shift = bucket / sub - 1;
+    uint64_t mantissa = bucket % sub + sub;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void Histogram::record(double seconds)
+{
+    uint64_t nanoseconds = seconds > 0.0 ? (uint64_t)std::min(seconds * 1e9, (double)MAX_NANOSECONDS) : 0;
+
+    Shard &shard = shards[threadShard()];
+    shard.buckets[bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    size_t index = recentIndex.fetch_add(1, std::memory_order_relaxed);
+    recentValues[index % RECENT_SIZE].store((float)seconds, std::memory_order_relaxed);
+}
+
+Histogram::Buckets Histogram::buckets() const
+{
+    Buckets result;
+    result.counts.assign(BUCKET_COUNT, 0);
+
+    for(const Shard &shard : shards) {
+        for(size_t i = 0; i < BUCKET_COUNT; i++) {
+            result.counts[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        }
+        result.count += shard.count.load(std::memory_order_relaxed);
+        result.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+Histogram::Summary Histogram::summarize(const Buckets &from, const Buckets &to)
+{
+    Summary summary = {};
+    summary.count = to.count - from.count;
+    if(summary.count == 0)
+        return summary;
+
+    summary.mean = (to.sum - from.sum) * 1e-9 / summary.count;
+
+    // Nearest rank, reported as the bucket's upper bound
+    uint64_t p50Rank = (uint64_t)std::ceil(summary.count * 0.50);
+    uint64_t p99Rank = (uint64_t)std::ceil(summary.count * 0.99);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < to.counts.size(); i++) {
+        uint64_t count = to.counts[i] - (from.counts.empty() ? 0 : from.counts[i]);
+        if(count == 0)
+            continue;
+
+        double bound = bucketUpperBound(i) * 1e-9;
+        if(seen < p50Rank && seen + count >= p50Rank)
+            summary.p50 = bound;
+        if(seen < p99Rank && seen + count >= p99Rank)
+            summary.p99 = bound;
+        summary.max = bound;
+        seen += count;
+    }
+    return summary;
+}
+
+void Histogram::recent(std::vector<float> &values) const
+{
+    size_t end = recentIndex.load(std::memory_order_relaxed);
+    size_t count = std::min(end, RECENT_SIZE);
+
+    values.resize(count);
+    for(size_t i = 0; i < count; i++) {
+        values[i] = recentValues[(end - count + i) % RECENT_SIZE].load(std::memory_order_relaxed);
+    }
+}
+
+Histogram::Summary Histogram::summarizeRecent() const
+{
+    std::vector<float> values;
+    recent(values);
+
+    Summary summary = {};
+    summary.count = values.size();
+    if(values.empty())
+        return summary;
+
+    double sum = 0.0;
+    for(float value : values) {
+        sum += value;
+    }
+    summary.mean = sum / values.size();
+
+    std::sort(values.begin(), values.end());
+    auto percentile = [&](double p) {
+        size_t rank = (size_t)std::ceil(p * values.size());
+        return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+    };
+    summary.p50 = percentile(0.50);
+    summary.p99 = percentile(0.99);
+    summary.max = values.back();
+    return summary;
+}
+
+Counter &metrics::counter(const std::string &name)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.counters.get(name);
+}
+
+Gauge &metrics::gauge(const std::string &name)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.gauges.get(name);
+}
+
+Histogram &metrics::histogram(const std::string &name)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.histograms.get(name);
+}
+
+Counter &metrics::allocations()
+{
+    return allocationCounter;
+}
+
+metrics::Entries<Counter> metrics::counters()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.counters.entries();
+}
+
+metrics::Entries<Gauge> metrics::gauges()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.gauges.entries();
+}
+
+metrics::Entries<Histogram> metrics::histograms()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.histograms.entries();
+}
+
+bool metrics::CounterRates::update(double time)
+{
+    if(lastTime >= 0.0 && time - lastTime < interval)
+        return false;
+
+    bool first = lastTime < 0.0;
+    double elapsed = time - lastTime;
+    for(auto &[name, counter] : counters()) {
+        uint64_t total = counter->total();
+        auto last = lastTotals.find(name);
+        uint64_t previous = last != lastTotals.end() ? last->second : 0;
+        rates[name] = !first && elapsed > 0.0 ? (total - previous) / elapsed : 0.0;
+        lastTotals[name] = total;
+    }
+    lastTime = time;
+    return !first;
+}
+
+double metrics::CounterRates::get(const std::string &name) const
+{
+    auto it = rates.find(name);
+    return it != rates.end() ? it->second : 0.0;
+}
+
+MetricsExporter::MetricsExporter(const std::string &path, double interval) :
+    path(path), file(path, std::ios::trunc), rates(interval)
+{
+    if(!file.is_open())
+        throw std::runtime_error(fmt::format("Failed to open {} for writing!", path));
+
+    json = !(path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0);
+    if(!json)
+        file << "time_s,metric,kind,value,rate,count,mean_ms,p50_ms,p99_ms,max_ms\n";
+
+    LOG_INFO("Writing metrics to {} every {}s", path, interval);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    LOG_DEBUG("Wrote {} metric snapshots to {}", writeCount, path);
+}
+
+void MetricsExporter::update(double time)
+{
+    if(lastTime < 0.0) {
+        // Baseline, so the first row covers a whole interval
+        rates.update(time);
+        for(auto &[name, histogram] : metrics::histograms()) {
+            lastBuckets[name] = histogram->buckets();
+        }
+        lastTime = time;
+        return;
+    }
+
+    if(rates.update(time)) {
+        write(time);
+        lastTime = time;
+    }
+}
+
+void MetricsExporter::write(double time)
+{
+    std::string counters, gauges, histograms;
+
+    for(auto &[name, counter] : metrics::counters()) {
+        uint64_t total = counter->total();
+        double rate = rates.get(name);
+        if(json) {
+            counters += fmt::format("{}\"{}\": {{\"total\": {}, \"rate\": {:.3f}}}", counters.empty() ? "" : ", ", name, total, rate);
+        } else {
+            file << fmt::format("{:.3f},{},counter,{},{:.3f},,,,,\n", time, name, total, rate);
+        }
+    }
+
+    for(auto &[name, gauge] : metrics::gauges()) {
+        if(json) {
+            gauges += fmt::format("{}\"{}\": {:.6g}", gauges.empty() ? "" : ", ", name, gauge->get());
+        } else {
+            file << fmt::format("{:.3f},{},gauge,{:.6g},,,,,,\n", time, name, gauge->get());
+        }
+    }
+
+    for(auto &[name, histogram] : metrics::histograms()) {
+        metrics::Histogram::Buckets current = histogram->buckets();
+        metrics::Histogram::Summary s = metrics::Histogram::summarize(lastBuckets[name], current);
+        lastBuckets[name] = std::move(current);
+
+        if(json) {
+            histograms += fmt::format(
+                "{}\"{}\": {{\"count\": {}, \"mean_ms\": {:.6f}, \"p50_ms\": {:.6f}, \"p99_ms\": {:.6f}, \"max_ms\": {:.6f}}}",
+                histograms.empty() ? "" : ", ", name, s.count, s.mean * 1e3, s.p50 * 1e3, s.p99 * 1e3, s.max * 1e3
+            );
+        } else {
+            file << fmt::format("{:.3f},{},histogram,,,{},{:.6f},{:.6f},{:.6f},{:.6f}\n",
+                time, name, s.count, s.mean * 1e3, s.p50 * 1e3, s.p99 * 1e3, s.max * 1e3);
+        }
+    }
+
+    if(json) {
+        file << fmt::format("{{\"time_s\": {:.3f}, \"counters\": {{{}}}, \"gauges\": {{{}}}, \"histograms\": {{{}}}}}\n",
+            time, counters, gauges, histograms);
+    }
+
+    // Flushed every time, an unattended run may well end by being killed
+    file.flush();
+    writeCount++;
+}
+
+// Counts every allocation that goes through the global operator new;
+// the array and nothrow forms end up here as well
+void *operator new(size_t size)
+{
+    allocationCounter.add();
+    if(void *pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
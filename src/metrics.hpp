@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Process-wide counters, gauges and latency histograms.
+//
+// Metrics are looked up once by name and then updated from any thread.
+// Counters and histograms are split into shards, and each thread adds to
+// its own with relaxed atomics, so updates never take a lock or fight over
+// a cache line. Readers sum the shards.
+namespace metrics {
+    constexpr size_t SHARD_COUNT = 8;
+
+    // Shard of the calling thread
+    size_t threadShard();
+
+    class Counter {
+    public:
+        void add(uint64_t amount = 1)
+        {
+            shards[threadShard()].value.fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        uint64_t total() const;
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> value = 0;
+        };
+
+        Shard shards[SHARD_COUNT];
+    };
+
+    // Last value set, for levels rather than events
+    class Gauge {
+    public:
+        void set(double value) { current.store(value, std::memory_order_relaxed); }
+        double get() const { return current.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> current = 0.0;
+    };
+
+    // Durations on log-linear buckets, 8 per power of two of nanoseconds,
+    // so percentiles are within 12.5%. The most recent values are also
+    // kept as they are, for graphs and exact rolling percentiles.
+    class Histogram {
+    public:
+        static constexpr size_t SUB_BUCKETS = 8;
+        static constexpr size_t BUCKET_COUNT = 304; // below 2^40ns, about 18 minutes
+        static constexpr size_t RECENT_SIZE = 240;
+
+        // Cumulative, diff two of them to get an interval
+        struct Buckets {
+            std::vector<uint64_t> counts;
+            uint64_t count = 0;
+            uint64_t sum = 0; // nanoseconds
+        };
+
+        struct Summary {
+            uint64_t count;
+            double mean, p50, p99, max; // seconds
+        };
+
+        void record(double seconds);
+
+        Buckets buckets() const;
+        // Summary of the values recorded between two snapshots
+        static Summary summarize(const Buckets &from, const Buckets &to);
+
+        // Up to RECENT_SIZE last values in seconds, oldest first
+        void recent(std::vector<float> &values) const;
+        // Exact percentiles over the recent values
+        Summary summarizeRecent() const;
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> buckets[BUCKET_COUNT] = {};
+            std::atomic<uint64_t> count = 0;
+            std::atomic<uint64_t> sum = 0;
+        };
+
+        Shard shards[SHARD_COUNT];
+
+        std::atomic<float> recentValues[RECENT_SIZE] = {};
+        std::atomic<size_t> recentIndex = 0;
+    };
+
+    // Registered on first use, the references stay valid for the process
+    Counter &counter(const std::string &name);
+    Gauge &gauge(const std::string &name);
+    Histogram &histogram(const std::string &name);
+
+    // Allocations through global operator new
+    Counter &allocations();
+
+    template<typename M>
+    using Entries = std::vector<std::pair<std::string, M*>>;
+
+    // Every metric registered so far, sorted by name
+    Entries<Counter> counters();
+    Entries<Gauge> gauges();
+    Entries<Histogram> histograms();
+
+    // Per second rates of every counter, refreshed at most every interval
+    class CounterRates {
+    public:
+        CounterRates(double interval = 0.5) : interval(interval) {}
+
+        // Returns true when the rates were refreshed
+        bool update(double time);
+        double get(const std::string &name) const;
+
+    private:
+        double interval;
+        double lastTime = -1.0;
+        std::map<std::string, uint64_t> lastTotals;
+        std::map<std::string, double> rates;
+    };
+}
+
+// Appends every metric to a file at a fixed interval, for unattended runs.
+// Files ending in .csv get one row per metric and interval; anything else
+// gets one JSON object per line. Histograms cover just the interval.
+class MetricsExporter {
+public:
+    MetricsExporter(const std::string &path, double interval);
+    ~MetricsExporter();
+
+    // Call once per frame, writes when the interval has passed
+    void update(double time);
+
+    const std::string &getPath() const { return path; }
+    size_t getWriteCount() const { return writeCount; }
+
+private:
+    void write(double time);
+
+    std::string path;
+    std::ofstream file;
+    bool json;
+    double lastTime = -1.0;
+    size_t writeCount = 0;
+
+    metrics::CounterRates rates;
+    std::map<std::string, metrics::Histogram::Buckets> lastBuckets;
+};
@@ -0,0 +1,109 @@
+#include "morton.hpp"
+#include "radixsort.hpp"
+
+#include <algorithm>
+#include <limits>
+
+static constexpr size_t SORT_CHUNK_SIZE = 65536;
+
+// Spreads the low 10 bits so there are two zero bits between each
+static uint32_t expandBits10(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Same for the low 21 bits
+static uint64_t expandBits21(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffull;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+    v = (v | (v << 8)) & 0x100f00f00f00f00full;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+uint32_t morton::encode30(const glm::vec3 &normalized)
+{
+    glm::vec3 scaled = glm::clamp(normalized * 1024.0f, 0.0f, 1023.0f);
+    return (expandBits10((uint32_t)scaled.x) << 2)
+        | (expandBits10((uint32_t)scaled.y) << 1)
+        | expandBits10((uint32_t)scaled.z);
+}
+
+uint64_t morton::encode63(const glm::vec3 &normalized)
+{
+    glm::vec3 scaled = glm::clamp(normalized * 2097152.0f, 0.0f, 2097151.0f);
+    return (expandBits21((uint64_t)scaled.x) << 2)
+        | (expandBits21((uint64_t)scaled.y) << 1)
+        | expandBits21((uint64_t)scaled.z);
+}
+
+template<typename Key, typename Encode>
+static void sortByKey(
+    const std::vector<glm::vec3> &positions,
+    const glm::vec3 &boundsMin, const glm::vec3 &invExtent,
+    Encode encode,
+    ThreadPool &pool,
+    std::vector<uint32_t> &order)
+{
+    std::vector<Key> keys(positions.size());
+
+    pool.parallelFor(positions.size(), SORT_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            keys[i] = encode((positions[i] - boundsMin) * invExtent);
+            order[i] = i;
+        }
+    });
+
+    RadixScratch<Key> scratch;
+    radixSort(keys, order, scratch, pool);
+}
+
+void morton::computeOrder(
+    const std::vector<glm::vec3> &positions,
+    bool wideKeys,
+    ThreadPool &pool,
+    std::vector<uint32_t> &order)
+{
+    size_t count = positions.size();
+    size_t chunkCount = (count + SORT_CHUNK_SIZE - 1) / SORT_CHUNK_SIZE;
+    order.resize(count);
+
+    if(count == 0)
+        return;
+
+    std::vector<glm::vec3> chunkMin(chunkCount, glm::vec3(std::numeric_limits<float>::max()));
+    std::vector<glm::vec3> chunkMax(chunkCount, glm::vec3(std::numeric_limits<float>::lowest()));
+
+    // A call may span several chunks; the slots it skips keep their
+    // identity bounds, so the reduction below is right for any pool size
+    pool.parallelFor(count, SORT_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        glm::vec3 &min = chunkMin[begin / SORT_CHUNK_SIZE];
+        glm::vec3 &max = chunkMax[begin / SORT_CHUNK_SIZE];
+        for(size_t i = begin; i < end; i++) {
+            min = glm::min(min, positions[i]);
+            max = glm::max(max, positions[i]);
+        }
+    });
+
+    glm::vec3 boundsMin = chunkMin[0], boundsMax = chunkMax[0];
+    for(size_t i = 1; i < chunkCount; i++) {
+        boundsMin = glm::min(boundsMin, chunkMin[i]);
+        boundsMax = glm::max(boundsMax, chunkMax[i]);
+    }
+
+    glm::vec3 invExtent = 1.0f / glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+
+    if(wideKeys) {
+        sortByKey<uint64_t>(positions, boundsMin, invExtent, encode63, pool, order);
+    } else {
+        sortByKey<uint32_t>(positions, boundsMin, invExtent, encode30, pool, order);
+    }
+}
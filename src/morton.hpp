@@ -0,0 +1,45 @@
+#pragma once
+
+#include "threadpool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Z-order helpers for keeping particles that are close in space close in memory
+namespace morton {
+    // Coordinates are expected in [0, 1]
+    uint32_t encode30(const glm::vec3 &normalized);
+    uint64_t encode63(const glm::vec3 &normalized);
+
+    // Fills `order` with particle indices sorted along the Z-order curve
+    // of the particles' bounding box
+    void computeOrder(
+        const std::vector<glm::vec3> &positions,
+        bool wideKeys,
+        ThreadPool &pool,
+        std::vector<uint32_t> &order
+    );
+
+    // data[i] = old data[order[i]], done in place
+    template<typename T>
+    void permute(std::vector<T> &data, const std::vector<uint32_t> &order, ThreadPool &pool);
+}
+
+template<typename T>
+void morton::permute(std::vector<T> &data, const std::vector<uint32_t> &order, ThreadPool &pool)
+{
+    std::vector<T> scratch(data.size());
+
+    pool.parallelFor(data.size(), 65536, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            scratch[i] = data[order[i]];
+        }
+    });
+
+    // Copy back instead of swapping so data() stays valid for readers
+    pool.parallelFor(data.size(), 65536, [&](size_t begin, size_t end) {
+        std::copy(scratch.begin() + begin, scratch.begin() + end, data.begin() + begin);
+    });
+}
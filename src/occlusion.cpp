@@ -0,0 +1,236 @@
+#include "occlusion.hpp"
+#include "camera.hpp"
+#include "shader.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+OcclusionCuller::OcclusionCuller() : statsReadback(sizeof(Stats))
+{
+    cullProgram = MaterialBuilder()
+        .attachShader(shaderFromBinaryFile("shaders/cull.comp.spv", GL_COMPUTE_SHADER))
+        .buildMaterial();
+    reduceProgram = MaterialBuilder()
+        .attachShader(shaderFromBinaryFile("shaders/depthreduce.comp.spv", GL_COMPUTE_SHADER))
+        .buildMaterial();
+
+    glCreateBuffers(1, &earlyCommand);
+    glCreateBuffers(1, &lateCommand);
+    glNamedBufferStorage(earlyCommand, sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferStorage(lateCommand, sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+    LOG_DEBUG("Created occlusion culler");
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    glDeleteBuffers(1, &earlyInstances);
+    glDeleteBuffers(1, &lateInstances);
+    glDeleteBuffers(1, &earlyStatic);
+    glDeleteBuffers(1, &lateStatic);
+    glDeleteBuffers(1, &earlyIndices);
+    glDeleteBuffers(1, &lateIndices);
+    glDeleteBuffers(1, &earlyCommand);
+    glDeleteBuffers(1, &lateCommand);
+    glDeleteBuffers(1, &visibility);
+
+    glDeleteFramebuffers(1, &depthFramebuffer);
+    glDeleteTextures(1, &depthTexture);
+    glDeleteTextures(1, &pyramid);
+
+    LOG_DEBUG("Destroyed occlusion culler");
+}
+
+void OcclusionCuller::ensureCapacity(size_t instanceCount)
+{
+    if(instanceCount <= capacity)
+        return;
+
+    glDeleteBuffers(1, &earlyInstances);
+    glDeleteBuffers(1, &lateInstances);
+    glDeleteBuffers(1, &earlyStatic);
+    glDeleteBuffers(1, &lateStatic);
+    glDeleteBuffers(1, &earlyIndices);
+    glDeleteBuffers(1, &lateIndices);
+    glDeleteBuffers(1, &visibility);
+    earlyInstances = lateInstances = 0;
+    earlyStatic = lateStatic = 0;
+    earlyIndices = lateIndices = 0;
+
+    capacity = instanceCount;
+
+    glCreateBuffers(1, &visibility);
+    glNamedBufferStorage(visibility, capacity * sizeof(GLuint), nullptr, 0);
+
+    if(indexOutput) {
+        glCreateBuffers(1, &earlyIndices);
+        glCreateBuffers(1, &lateIndices);
+        glNamedBufferStorage(earlyIndices, capacity * sizeof(GLuint), nullptr, 0);
+        glNamedBufferStorage(lateIndices, capacity * sizeof(GLuint), nullptr, 0);
+    } else {
+        glCreateBuffers(1, &earlyInstances);
+        glCreateBuffers(1, &lateInstances);
+        glNamedBufferStorage(earlyInstances, capacity * sizeof(glm::vec3), nullptr, 0);
+        glNamedBufferStorage(lateInstances, capacity * sizeof(glm::vec3), nullptr, 0);
+    }
+
+    if(staticInput && !indexOutput) {
+        glCreateBuffers(1, &earlyStatic);
+        glCreateBuffers(1, &lateStatic);
+        glNamedBufferStorage(earlyStatic, capacity * staticStride, nullptr, 0);
+        glNamedBufferStorage(lateStatic, capacity * staticStride, nullptr, 0);
+    }
+
+    // Nothing counts as visible yet, the first late pass finds it all
+    glClearNamedBufferData(visibility, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    LOG_DEBUG("Resized occlusion culler to {} instances", capacity);
+}
+
+void OcclusionCuller::setStaticStream(GLuint buffer, GLsizei stride)
+{
+    if(stride % sizeof(GLuint) != 0)
+        throw std::runtime_error("Static instance attributes must be a whole number of words");
+
+    bool reallocate = (buffer != 0) != (staticInput != 0) || stride != staticStride;
+    staticInput = buffer;
+    staticStride = stride;
+
+    // Outputs are allocated on the next cull
+    if(reallocate)
+        capacity = 0;
+}
+
+void OcclusionCuller::setIndexOutput(bool indices)
+{
+    if(indices == indexOutput)
+        return;
+
+    indexOutput = indices;
+    capacity = 0;
+}
+
+size_t OcclusionCuller::getCompactedBytes() const
+{
+    size_t record = indexOutput ? sizeof(GLuint) : sizeof(glm::vec3) + (staticInput ? staticStride : 0);
+    return ((size_t)stats.drawnEarly + stats.drawnLate) * record;
+}
+
+void OcclusionCuller::cullEarly(GLuint instanceBuffer, size_t instanceCount, const MeshRange &range, const glm::mat4 &projectionView)
+{
+    ensureCapacity(instanceCount);
+
+    // Take the newest finished counters, then reset this frame's
+    statsReadback.read(&stats);
+    statsBuffer = statsReadback.begin();
+
+    cull(false, instanceBuffer, instanceCount, range, projectionView);
+}
+
+void OcclusionCuller::cullLate(GLuint instanceBuffer, size_t instanceCount, const MeshRange &range, const glm::mat4 &projectionView)
+{
+    cull(true, instanceBuffer, instanceCount, range, projectionView);
+    statsReadback.end();
+}
+
+void OcclusionCuller::cull(bool late, GLuint instanceBuffer, size_t instanceCount, const MeshRange &range, const glm::mat4 &projectionView)
+{
+    GLuint command = late ? lateCommand : earlyCommand;
+    DrawElementsIndirectCommand reset = {
+        range.indexCount, 0,
+        range.firstIndex, range.baseVertex,
+        0
+    };
+    glNamedBufferSubData(command, 0, sizeof(reset), &reset);
+
+    glm::vec4 planes[6];
+    extractFrustumPlanes(projectionView, planes);
+
+    cullProgram->use();
+    cullProgram->uniform4x4("projection_view", projectionView);
+    cullProgram->uniform4v("frustumPlanes", planes, 6);
+    cullProgram->uniform1("instanceCount", (GLuint)instanceCount);
+    cullProgram->uniform1("boundingRadius", boundingRadius);
+    cullProgram->uniform1("latePass", (GLuint)late);
+    cullProgram->uniform1("staticWords", (GLuint)(staticInput && !indexOutput ? staticStride / sizeof(GLuint) : 0));
+    cullProgram->uniform1("compactIndices", (GLuint)indexOutput);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, late ? lateInstances : earlyInstances);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visibility);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, statsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, staticInput);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, late ? lateStatic : earlyStatic);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, late ? lateIndices : earlyIndices);
+    glBindTextureUnit(0, pyramid);
+
+    glDispatchCompute((instanceCount + 255) / 256, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void OcclusionCuller::buildPyramid(GLuint framebuffer, int width, int height)
+{
+    if(width <= 0 || height <= 0)
+        return;
+
+    if(width != pyramidWidth || height != pyramidHeight) {
+        glDeleteFramebuffers(1, &depthFramebuffer);
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(1, &pyramid);
+
+        pyramidWidth = width;
+        pyramidHeight = height;
+        pyramidLevels = (int)std::floor(std::log2(std::max(width, height))) + 1;
+
+        // Same format as the scene's depth buffer, so it can be blitted
+        glCreateTextures(GL_TEXTURE_2D, 1, &depthTexture);
+        glTextureStorage2D(depthTexture, 1, GL_DEPTH24_STENCIL8, width, height);
+        glTextureParameteri(depthTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(depthTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glCreateFramebuffers(1, &depthFramebuffer);
+        glNamedFramebufferTexture(depthFramebuffer, GL_DEPTH_STENCIL_ATTACHMENT, depthTexture, 0);
+
+        glCreateTextures(GL_TEXTURE_2D, 1, &pyramid);
+        glTextureStorage2D(pyramid, pyramidLevels, GL_R32F, width, height);
+        glTextureParameteri(pyramid, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTextureParameteri(pyramid, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTextureParameteri(pyramid, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(pyramid, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        LOG_DEBUG("Created depth pyramid {}x{} with {} levels", width, height, pyramidLevels);
+    }
+
+    // Resolves the multisampled depth
+    glBlitNamedFramebuffer(framebuffer, depthFramebuffer,
+        0, 0, width, height,
+        0, 0, width, height,
+        GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    reduceProgram->use();
+
+    glBindTextureUnit(0, depthTexture);
+    glBindImageTexture(0, pyramid, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    reduceProgram->uniform1("sourceLevel", (GLint)0);
+    reduceProgram->uniform1("copyOnly", (GLint)1);
+    glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+
+    glBindTextureUnit(0, pyramid);
+    reduceProgram->uniform1("copyOnly", (GLint)0);
+
+    for(int level = 1; level < pyramidLevels; level++) {
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        int levelWidth = std::max(1, width >> level);
+        int levelHeight = std::max(1, height >> level);
+
+        glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        reduceProgram->uniform1("sourceLevel", (GLint)(level - 1));
+        glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+    }
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "material.hpp"
+#include "readback.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <memory>
+
+// Two-phase GPU occlusion culling against a hierarchical depth buffer.
+//
+// The early pass draws the instances that were visible last frame.
+// Their depth is reduced into a max-depth pyramid, and the late pass
+// tests every instance against it. Newly visible ones are drawn, and
+// the visibility is remembered for the next frame.
+class OcclusionCuller {
+public:
+    struct Stats {
+        GLuint drawnEarly;
+        GLuint drawnLate;
+        GLuint occluded;
+        GLuint frustumCulled;
+    };
+
+    OcclusionCuller();
+    ~OcclusionCuller();
+
+    void cullEarly(GLuint instanceBuffer, size_t instanceCount, const MeshRange &range, const glm::mat4 &projectionView);
+    // Reduces the depth buffer of the given framebuffer
+    void buildPyramid(GLuint framebuffer, int width, int height);
+    void cullLate(GLuint instanceBuffer, size_t instanceCount, const MeshRange &range, const glm::mat4 &projectionView);
+
+    // Compacted instances and their draw command, for GeometryArena::drawIndirect
+    GLuint getEarlyInstances() const { return earlyInstances; }
+    GLuint getEarlyCommand() const { return earlyCommand; }
+    GLuint getLateInstances() const { return lateInstances; }
+    GLuint getLateCommand() const { return lateCommand; }
+    // Static attributes compacted in the same order, if a static stream is set
+    GLuint getEarlyStatic() const { return earlyStatic; }
+    GLuint getLateStatic() const { return lateStatic; }
+
+    // Static per-instance attributes to compact along with the positions
+    void setStaticStream(GLuint buffer, GLsizei stride);
+
+    // Compact only the indices of the visible instances instead of copying
+    // their records, for shaders that pull instances from storage buffers
+    void setIndexOutput(bool indices);
+    GLuint getEarlyIndices() const { return earlyIndices; }
+    GLuint getLateIndices() const { return lateIndices; }
+
+    // Bytes the compaction wrote, as of the last counters read back
+    size_t getCompactedBytes() const;
+
+    void setBoundingRadius(float radius) { boundingRadius = radius; }
+
+    // Counts from a few frames ago, to avoid stalling on the GPU
+    const Stats &getStats() const { return stats; }
+
+private:
+    void ensureCapacity(size_t instanceCount);
+    void cull(bool late, GLuint instanceBuffer, size_t instanceCount, const MeshRange &range, const glm::mat4 &projectionView);
+
+    std::shared_ptr<Material> cullProgram;
+    std::shared_ptr<Material> reduceProgram;
+
+    size_t capacity = 0;
+    GLuint earlyInstances = 0, lateInstances = 0;
+    GLuint earlyStatic = 0, lateStatic = 0;
+    GLuint staticInput = 0;
+    GLsizei staticStride = 0;
+    bool indexOutput = false;
+    GLuint earlyIndices = 0, lateIndices = 0;
+    GLuint earlyCommand, lateCommand;
+    GLuint visibility = 0;
+
+    BufferReadback statsReadback;
+    GLuint statsBuffer = 0;
+    Stats stats = {};
+
+    GLuint depthTexture = 0, depthFramebuffer = 0;
+    GLuint pyramid = 0;
+    int pyramidWidth = 0, pyramidHeight = 0, pyramidLevels = 0;
+
+    float boundingRadius = 1.7320508f; // unit cube
+};
@@ -0,0 +1,130 @@
+#include "options.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+static const char *USAGE =
+    "Usage: gl-instancing [options]\n"
+    "  --count N          number of particles\n"
+    "  --seed N           seed for particle generation\n"
+    "  --benchmark PATH   run the camera path in PATH and exit\n"
+    "  --frames N         frames to run in benchmark mode\n"
+    "  --output FILE      benchmark results, .json or .csv\n"
+    "  --record FILE      record particle trajectories to FILE\n"
+    "  --play FILE        play back a trajectory recording\n"
+    "  --feed NAME        render instances from a shared memory feed\n"
+    "  --dataset FILE     stream a chunked dataset larger than memory\n"
+    "  --msaa N           samples per pixel, 1 to turn multisampling off\n"
+    "  --metrics FILE     append metrics to FILE, .csv or JSON lines\n"
+    "  --metrics-interval S  seconds between metrics exports\n"
+    "  --diagnostics      track energy, momentum and bad values every tick\n"
+    "  --autotune         tune threads, chunk size and uploads again\n"
+    "  --no-autotune      keep the defaults, ignoring the tuning cache\n"
+    "  --tune-cache FILE  where tuned configs are kept per machine\n"
+    "  --tune-budget S    seconds the tuning may take\n"
+    "  --systems N        add N smaller particle systems around the main one\n"
+    "  --system-size N    average particles per added system\n";
+
+LaunchOptions LaunchOptions::parse(int argc, char **argv)
+{
+    LaunchOptions options;
+
+    auto value = [&](int &i) -> std::string {
+        if(i + 1 >= argc)
+            throw std::runtime_error(fmt::format("Missing value for {}\n{}", argv[i], USAGE));
+        return argv[++i];
+    };
+
+    auto number = [&](int &i) -> unsigned long long {
+        std::string arg = argv[i];
+        std::string str = value(i);
+        try {
+            return std::stoull(str);
+        } catch(std::exception &) {
+            throw std::runtime_error(fmt::format("Expected a number for {}, got '{}'", arg, str));
+        }
+    };
+
+    auto seconds = [&](int &i) -> double {
+        std::string arg = argv[i];
+        std::string str = value(i);
+        double result;
+        try {
+            result = std::stod(str);
+        } catch(std::exception &) {
+            throw std::runtime_error(fmt::format("Expected seconds for {}, got '{}'", arg, str));
+        }
+        if(result <= 0.0)
+            throw std::runtime_error(fmt::format("{} must be positive", arg));
+        return result;
+    };
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if(arg == "--count") {
+            options.particleCount = number(i);
+        } else if(arg == "--seed") {
+            options.seed = (uint32_t)number(i);
+            options.seeded = true;
+        } else if(arg == "--benchmark") {
+            options.benchmarkPath = value(i);
+        } else if(arg == "--frames") {
+            options.benchmarkFrames = number(i);
+        } else if(arg == "--output") {
+            options.benchmarkOutput = value(i);
+        } else if(arg == "--record") {
+            options.recordPath = value(i);
+        } else if(arg == "--play") {
+            options.playPath = value(i);
+        } else if(arg == "--feed") {
+            options.feedName = value(i);
+        } else if(arg == "--dataset") {
+            options.datasetPath = value(i);
+        } else if(arg == "--msaa") {
+            options.msaaSamples = (int)std::max(number(i), 1ull);
+        } else if(arg == "--diagnostics") {
+            options.diagnostics = true;
+        } else if(arg == "--metrics") {
+            options.metricsPath = value(i);
+        } else if(arg == "--metrics-interval") {
+            options.metricsInterval = seconds(i);
+        } else if(arg == "--autotune") {
+            options.retune = true;
+        } else if(arg == "--no-autotune") {
+            options.autotune = false;
+        } else if(arg == "--tune-cache") {
+            options.tuneCachePath = value(i);
+        } else if(arg == "--tune-budget") {
+            options.tuneBudget = seconds(i);
+        } else if(arg == "--systems") {
+            options.systemCount = number(i);
+        } else if(arg == "--system-size") {
+            options.systemSize = std::max(number(i), 1ull);
+        } else {
+            throw std::runtime_error(fmt::format("Unknown argument '{}'\n{}", arg, USAGE));
+        }
+    }
+
+    if(options.retune && !options.autotune)
+        throw std::runtime_error("--autotune and --no-autotune cannot be used together");
+    if(options.isPlayback() && !options.recordPath.empty())
+        throw std::runtime_error("--record and --play cannot be used together");
+    if(options.isFeed() && (options.isPlayback() || !options.recordPath.empty()))
+        throw std::runtime_error("--feed cannot be combined with --play or --record");
+    if(options.isOutOfCore() && (options.isFeed() || options.isPlayback() || !options.recordPath.empty()))
+        throw std::runtime_error("--dataset cannot be combined with --feed, --play or --record");
+
+    // Benchmarks must be reproducible
+    if(options.isBenchmark() && !options.seeded) {
+        options.seeded = true;
+        options.seed = 1;
+    }
+    // and not depend on a cache left by an earlier run
+    if(options.isBenchmark() && !options.retune)
+        options.autotune = false;
+
+    return options;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct LaunchOptions {
+    size_t particleCount = 100000;
+
+    bool seeded = false;
+    uint32_t seed = 0;
+
+    // Benchmark mode is on when a camera path is given
+    std::string benchmarkPath;
+    size_t benchmarkFrames = 1000;
+    std::string benchmarkOutput = "benchmark.json";
+
+    // Samples per pixel of the scene, 1 for none
+    int msaaSamples = 8;
+
+    // Trajectory recording, started at launch
+    std::string recordPath;
+    // Plays a recording back instead of simulating
+    std::string playPath;
+    // Renders instances published by another process
+    std::string feedName;
+    // Streams a chunked dataset from disk around the camera
+    std::string datasetPath;
+
+    // Periodic metrics export, .csv or JSON lines
+    std::string metricsPath;
+    double metricsInterval = 1.0;
+
+    // Energy, momentum and bounds reduced during every tick
+    bool diagnostics = false;
+
+    // Tuned config from the cache, or tuned on the spot when there is none
+    bool autotune = true;
+    // Tune even if the cache has a config
+    bool retune = false;
+    std::string tuneCachePath = "autotune.cache";
+    double tuneBudget = 3.0;
+
+    // Extra particle systems around the main one, for many-system scenes
+    size_t systemCount = 0;
+    size_t systemSize = 10000;
+
+    bool isBenchmark() const { return !benchmarkPath.empty(); }
+    bool isPlayback() const { return !playPath.empty(); }
+    bool isFeed() const { return !feedName.empty(); }
+    bool isOutOfCore() const { return !datasetPath.empty(); }
+
+    static LaunchOptions parse(int argc, char **argv);
+};
@@ -0,0 +1,54 @@
+#include "overdraw.hpp"
+#include "log.hpp"
+
+constexpr double OVERDRAW_SMOOTHING = 0.2;
+
+OverdrawCounter::OverdrawCounter()
+{
+    for(Slot &slot : slots) {
+        glGenQueries(1, &slot.query);
+        slot.pending = false;
+    }
+
+    LOG_DEBUG("Created overdraw counter");
+}
+
+OverdrawCounter::~OverdrawCounter()
+{
+    for(Slot &slot : slots) {
+        glDeleteQueries(1, &slot.query);
+    }
+
+    LOG_DEBUG("Destroyed overdraw counter");
+}
+
+void OverdrawCounter::begin(size_t variant, size_t sampleCount)
+{
+    Slot &slot = slots[frame % QUERY_RING_SIZE];
+
+    // Same as the resolution controller: a result that isn't there after
+    // QUERY_RING_SIZE frames is dropped rather than waited for
+    if(slot.pending) {
+        GLint available = 0;
+        glGetQueryObjectiv(slot.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available && slot.sampleCount > 0) {
+            GLuint64 passed = 0;
+            glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &passed);
+
+            double measured = passed / (double)slot.sampleCount;
+            double &average = overdraw[slot.variant];
+            average = average > 0.0 ? average + (measured - average) * OVERDRAW_SMOOTHING : measured;
+        }
+    }
+
+    slot.variant = variant < MAX_VARIANTS ? variant : MAX_VARIANTS - 1;
+    slot.sampleCount = sampleCount;
+    slot.pending = true;
+    glBeginQuery(GL_SAMPLES_PASSED, slot.query);
+}
+
+void OverdrawCounter::end()
+{
+    glEndQuery(GL_SAMPLES_PASSED);
+    frame++;
+}
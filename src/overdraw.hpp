@@ -0,0 +1,42 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+// Debug counter for how many times each sample gets written. A samples
+// passed query around the scene counts the fragments that made it through
+// the depth test, which divided by the samples in the target is the
+// average overdraw. Results are read a few frames late, without stalling.
+//
+// Each frame is tagged with a variant, and every variant keeps its own
+// average, so two ways of drawing the same scene can be compared live.
+class OverdrawCounter {
+public:
+    static constexpr size_t MAX_VARIANTS = 2;
+
+    OverdrawCounter();
+    ~OverdrawCounter();
+
+    // sampleCount is the number of samples in the target being drawn to
+    void begin(size_t variant, size_t sampleCount);
+    void end();
+
+    // Smoothed fragments per sample, 0 until the variant was measured
+    double getOverdraw(size_t variant) const { return overdraw[variant]; }
+
+private:
+    static constexpr size_t QUERY_RING_SIZE = 4;
+
+    struct Slot {
+        GLuint query;
+        size_t variant;
+        size_t sampleCount;
+        bool pending;
+    };
+
+    Slot slots[QUERY_RING_SIZE];
+    size_t frame = 0;
+
+    double overdraw[MAX_VARIANTS] = {};
+};
@@ -0,0 +1,300 @@
+#include "particlesystem.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+// Particles per parallel task, whatever system they belong to
+constexpr size_t SYSTEM_CHUNK_SIZE = 4096;
+// A system that fell behind drops the rest instead of catching up
+constexpr int MAX_TICKS_PER_UPDATE = 4;
+
+using ChunkKernel = void (*)(
+    const GravitySettings &settings, uint64_t firstTick, size_t begin, size_t end, int ticks, float deltaTime,
+    glm::vec3 *positions, glm::vec3 *velocities, glm::vec3 *accelerations);
+
+template<uint32_t Terms>
+static void stepChunk(
+    const GravitySettings &settings, uint64_t firstTick, size_t begin, size_t end, int ticks, float deltaTime,
+    glm::vec3 *positions, glm::vec3 *velocities, glm::vec3 *accelerations)
+{
+    using Law = ForceLaw<Terms>;
+    float halfStep = deltaTime * 0.5f;
+
+    for(size_t i = begin; i < end; i++) {
+        glm::vec3 position = positions[i];
+        glm::vec3 velocity = velocities[i];
+        glm::vec3 accel = accelerations[i];
+
+        for(int tick = 0; tick < ticks; tick++) {
+            velocity += accel * halfStep;
+            position += velocity * deltaTime;
+            accel = Law::acceleration(settings, position);
+            velocity += accel * halfStep;
+
+            uint32_t seed = (uint32_t)i * 0x9E3779B9u ^ (uint32_t)(firstTick + tick);
+            if(Law::finish(settings, seed, position, velocity, deltaTime))
+                accel = Law::acceleration(settings, position);
+        }
+
+        positions[i] = position;
+        velocities[i] = velocity;
+        accelerations[i] = accel;
+    }
+}
+
+static constexpr auto chunkKernels = []<uint32_t... Terms>(std::integer_sequence<uint32_t, Terms...>) {
+    return std::array<ChunkKernel, sizeof...(Terms)>{ &stepChunk<Terms>... };
+}(std::make_integer_sequence<uint32_t, FORCE_TERM_COMBINATIONS>());
+
+ParticleSystems::ParticleSystems()
+{
+    positionStream = InstanceStream::create<InstanceOffset>(StreamFrequency::Dynamic);
+    attributeStream = InstanceStream::create<InstanceAttributes>(StreamFrequency::Static);
+
+    LOG_DEBUG("Created particle system registry");
+}
+
+ParticleSystems::~ParticleSystems()
+{
+    LOG_DEBUG("Destroyed particle system registry with {} systems", systems.size());
+}
+
+SystemHandle ParticleSystems::add(
+    const ParticleSystemSettings &settings,
+    const std::vector<glm::vec3> &positions,
+    const std::vector<glm::vec3> &velocities,
+    const std::vector<InstanceAttributes> &attributes)
+{
+    if(velocities.size() != positions.size())
+        throw std::runtime_error(fmt::format("System '{}' has {} positions but {} velocities", settings.name, positions.size(), velocities.size()));
+    if(!attributes.empty() && attributes.size() != positions.size())
+        throw std::runtime_error(fmt::format("System '{}' has {} positions but {} attributes", settings.name, positions.size(), attributes.size()));
+
+    SystemHandle handle = nextHandle++;
+    System &system = systems[handle];
+    system.settings = settings;
+    system.first = this->positions.size();
+    system.count = positions.size();
+
+    this->positions.insert(this->positions.end(), positions.begin(), positions.end());
+    this->velocities.insert(this->velocities.end(), velocities.begin(), velocities.end());
+    accelerations.resize(this->positions.size());
+    if(attributes.empty()) {
+        InstanceAttributes white = { glm::u8vec4(255), 1.0f, 0 };
+        this->attributes.resize(this->positions.size(), white);
+    } else {
+        this->attributes.insert(this->attributes.end(), attributes.begin(), attributes.end());
+    }
+
+    primeAccelerations(system);
+    layoutChanged = true;
+    batchesChanged = true;
+
+    LOG_DEBUG("Added particle system '{}' with {} particles at {}", settings.name, system.count, system.first);
+    return handle;
+}
+
+void ParticleSystems::remove(SystemHandle handle)
+{
+    auto it = systems.find(handle);
+    if(it == systems.end())
+        throw std::runtime_error(fmt::format("No particle system with handle {}", handle));
+
+    size_t first = it->second.first;
+    size_t count = it->second.count;
+    auto erase = [&](auto &values) {
+        values.erase(values.begin() + first, values.begin() + first + count);
+    };
+    erase(positions);
+    erase(velocities);
+    erase(accelerations);
+    erase(attributes);
+
+    systems.erase(it);
+    for(auto &[other, system] : systems) {
+        if(system.first > first)
+            system.first -= count;
+    }
+    layoutChanged = true;
+    batchesChanged = true;
+}
+
+void ParticleSystems::clear()
+{
+    systems.clear();
+    positions.clear();
+    velocities.clear();
+    accelerations.clear();
+    attributes.clear();
+    layoutChanged = true;
+    batchesChanged = true;
+}
+
+void ParticleSystems::setTickRate(SystemHandle handle, float tickRate)
+{
+    systems.at(handle).settings.tickRate = std::max(tickRate, 0.0f);
+}
+
+void ParticleSystems::setGravity(SystemHandle handle, const GravitySettings &gravity)
+{
+    System &system = systems.at(handle);
+    system.settings.gravity = gravity;
+    // The cached accelerations are from the old field
+    primeAccelerations(system);
+}
+
+void ParticleSystems::primeAccelerations(const System &system)
+{
+    const GravitySettings &gravity = system.settings.gravity;
+    bool second = gravity.secondStrength != 0.0f;
+    for(size_t i = system.first; i < system.first + system.count; i++) {
+        accelerations[i] = second
+            ? ForceLaw<FORCE_SECOND_ATTRACTOR>::acceleration(gravity, positions[i])
+            : ForceLaw<0>::acceleration(gravity, positions[i]);
+    }
+}
+
+void ParticleSystems::update(float deltaTime, float timeScale, ThreadPool &pool)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    chunks.clear();
+    stats.systemsTicked = 0;
+    stats.particlesTicked = 0;
+
+    for(auto &[handle, system] : systems) {
+        if(system.settings.tickRate <= 0.0f || system.count == 0)
+            continue;
+
+        double interval = 1.0 / system.settings.tickRate;
+        system.pending += deltaTime;
+        int ticks = (int)std::floor(system.pending / interval);
+        if(ticks == 0)
+            continue;
+        system.pending -= ticks * interval;
+        ticks = std::min(ticks, MAX_TICKS_PER_UPDATE);
+
+        float systemDeltaTime = (float)(interval * timeScale);
+        size_t end = system.first + system.count;
+        for(size_t begin = system.first; begin < end; begin += SYSTEM_CHUNK_SIZE) {
+            chunks.push_back({ &system.settings.gravity, system.tickCount, begin, std::min(begin + SYSTEM_CHUNK_SIZE, end), ticks, systemDeltaTime });
+        }
+        system.tickCount += ticks;
+
+        dirtyRanges.push_back({ system.first, system.count });
+        stats.systemsTicked++;
+        stats.particlesTicked += system.count * ticks;
+    }
+
+    // One loop over every due system, so small ones share the workers
+    // instead of each paying for its own fork and join
+    if(!chunks.empty()) {
+        pool.parallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+            for(size_t c = begin; c < end; c++) {
+                const Chunk &chunk = chunks[c];
+                chunkKernels[activeForceTerms(*chunk.gravity)](
+                    *chunk.gravity, chunk.firstTick, chunk.begin, chunk.end, chunk.ticks, chunk.deltaTime,
+                    positions.data(), velocities.data(), accelerations.data());
+            }
+        });
+    }
+
+    stats.chunks = chunks.size();
+    stats.updateTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ParticleSystems::upload()
+{
+    if(layoutChanged || positionStream->getCount() != positions.size()) {
+        positionStream->upload(positions);
+        attributeStream->upload(attributes);
+        layoutChanged = false;
+        dirtyRanges.clear();
+        return;
+    }
+
+    // Systems sit back to back, so neighbours that both ticked go up together
+    std::sort(dirtyRanges.begin(), dirtyRanges.end());
+    size_t i = 0;
+    while(i < dirtyRanges.size()) {
+        size_t first = dirtyRanges[i].first;
+        size_t end = first + dirtyRanges[i].second;
+        for(i++; i < dirtyRanges.size() && dirtyRanges[i].first <= end; i++) {
+            end = std::max(end, dirtyRanges[i].first + dirtyRanges[i].second);
+        }
+        positionStream->uploadRange(positions.data() + first, first, end - first);
+    }
+    dirtyRanges.clear();
+}
+
+void ParticleSystems::rebuildBatches()
+{
+    std::vector<const System*> sorted;
+    for(const auto &[handle, system] : systems) {
+        if(system.count > 0)
+            sorted.push_back(&system);
+    }
+    // Pool order within each mesh and material, so neighbours merge into
+    // one command
+    std::sort(sorted.begin(), sorted.end(), [](const System *a, const System *b) {
+        return std::make_tuple(a->settings.variant.key(), a->settings.mesh, a->first)
+            < std::make_tuple(b->settings.variant.key(), b->settings.mesh, b->first);
+    });
+
+    batches.clear();
+    for(const System *system : sorted) {
+        uint32_t key = system->settings.variant.key();
+        if(batches.empty() || batches.back().key != key) {
+            ShaderVariant variant = system->settings.variant;
+            variant.indexed = false;
+            batches.push_back({ key, variant, {} });
+        }
+
+        std::vector<Run> &runs = batches.back().runs;
+        MeshHandle mesh = system->settings.mesh;
+        if(!runs.empty() && runs.back().mesh == mesh && runs.back().first + runs.back().count == system->first) {
+            runs.back().count += system->count;
+        } else {
+            runs.push_back({ mesh, system->first, system->count });
+        }
+    }
+    batchesChanged = false;
+}
+
+void ParticleSystems::draw(GeometryArena &geometry, MaterialVariants &materials, const glm::mat4 &projectionView)
+{
+    stats.drawCalls = 0;
+    if(systems.empty())
+        return;
+
+    if(batchesChanged)
+        rebuildBatches();
+
+    geometry.attachStream(*positionStream);
+    geometry.attachStream(*attributeStream);
+
+    for(const Batch &batch : batches) {
+        std::shared_ptr<Material> material = materials.get(batch.variant);
+        material->use();
+        material->uniform4x4("projection_view", projectionView);
+        if(batch.variant.pulling) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, variant::PULL_POSITIONS_BINDING, positionStream->getBuffer());
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, variant::PULL_RECORDS_BINDING, attributeStream->getBuffer());
+        }
+
+        // Every mesh drawn with this material goes in the same call
+        for(const Run &run : batch.runs) {
+            geometry.queueDraw(run.mesh, (GLuint)run.first, (GLuint)run.count);
+        }
+        geometry.drawQueued();
+        stats.drawCalls++;
+    }
+}
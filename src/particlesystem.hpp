@@ -0,0 +1,136 @@
+#pragma once
+
+#include "forcelaw.hpp"
+#include "geometry.hpp"
+#include "instancestream.hpp"
+#include "mesh.hpp"
+#include "shadervariant.hpp"
+#include "threadpool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ParticleSystemSettings {
+    std::string name;
+    MeshHandle mesh = 0;
+    ShaderVariant variant;
+    // Ticks per second of real time, each one advancing timeScale / tickRate
+    float tickRate = 60.0f;
+    GravitySettings gravity;
+};
+
+using SystemHandle = uint32_t;
+
+// Independent particle systems kept back to back in one set of arrays and
+// one pair of instance streams, each system owning a range of them.
+//
+// update() gathers every system whose tick is due into chunks and steps
+// them all in a single parallel loop, and draw() issues one multi-draw per
+// material, with a command per run of neighbouring systems sharing a mesh,
+// so many small systems cost about as much as one large one. Systems are
+// stepped with a shared leapfrog step, without the sub-stepping, sleeping
+// or collisions of the main particles.
+class ParticleSystems {
+public:
+    struct System {
+        ParticleSystemSettings settings;
+        size_t first;
+        size_t count;
+        // Real time not yet ticked
+        double pending = 0.0;
+        uint64_t tickCount = 0;
+    };
+
+    struct Stats {
+        size_t systemsTicked;
+        size_t particlesTicked; // once per tick, so systems that ticked twice count twice
+        size_t chunks;
+        double updateTime;
+        size_t drawCalls;
+    };
+
+    ParticleSystems();
+    ~ParticleSystems();
+
+    // Attributes are optional, systems without them are white
+    SystemHandle add(
+        const ParticleSystemSettings &settings,
+        const std::vector<glm::vec3> &positions,
+        const std::vector<glm::vec3> &velocities,
+        const std::vector<InstanceAttributes> &attributes = {}
+    );
+    // Moves the systems after it down to close the gap
+    void remove(SystemHandle handle);
+    void clear();
+
+    // Runs every system through the ticks due in deltaTime seconds
+    void update(float deltaTime, float timeScale, ThreadPool &pool);
+    // Ticked ranges only, unless systems were added or removed
+    void upload();
+    // Leaves the arena reading instances from this registry's streams
+    void draw(GeometryArena &geometry, MaterialVariants &materials, const glm::mat4 &projectionView);
+
+    void setTickRate(SystemHandle handle, float tickRate);
+    void setGravity(SystemHandle handle, const GravitySettings &gravity);
+
+    const std::map<SystemHandle, System> &getSystems() const { return systems; }
+    size_t getSystemCount() const { return systems.size(); }
+    size_t getInstanceCount() const { return positions.size(); }
+    const Stats &getStats() const { return stats; }
+
+private:
+    struct Chunk {
+        const GravitySettings *gravity;
+        uint64_t firstTick;
+        size_t begin, end;
+        int ticks;
+        float deltaTime;
+    };
+
+    // Contiguous instances of one mesh
+    struct Run {
+        MeshHandle mesh;
+        size_t first;
+        size_t count;
+    };
+
+    // One multi-draw
+    struct Batch {
+        uint32_t key;
+        ShaderVariant variant;
+        std::vector<Run> runs;
+    };
+
+    // Caches the attractor pull at the current positions. Drag, noise and
+    // wrapping are applied once per tick outside the leapfrog step and are
+    // never part of the cached acceleration.
+    void primeAccelerations(const System &system);
+    void rebuildBatches();
+
+    std::map<SystemHandle, System> systems;
+    SystemHandle nextHandle = 0;
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> velocities;
+    std::vector<glm::vec3> accelerations;
+    std::vector<InstanceAttributes> attributes;
+
+    // Reused between updates
+    std::vector<Chunk> chunks;
+    std::vector<std::pair<size_t, size_t>> dirtyRanges;
+    bool layoutChanged = true;
+
+    // Sorted by material, only rebuilt when systems are added or removed
+    std::vector<Batch> batches;
+    bool batchesChanged = true;
+
+    std::unique_ptr<InstanceStream> positionStream;
+    std::unique_ptr<InstanceStream> attributeStream;
+
+    Stats stats = {};
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Buffers a radix sort works in, so callers sorting every frame can keep them
+template<typename Key>
+struct RadixScratch {
+    std::vector<Key> keys;
+    std::vector<uint32_t> values;
+    std::vector<uint32_t> histograms;
+};
+
+constexpr size_t RADIX_CHUNK_SIZE = 65536;
+
+// Stable LSD radix sort on 8-bit digits of the low keyBits of each key.
+// Each chunk builds its own histogram, so the scatter needs no atomics.
+// Returns the number of scatter passes that were needed.
+template<typename Key>
+size_t radixSort(
+    std::vector<Key> &keys,
+    std::vector<uint32_t> &values,
+    RadixScratch<Key> &scratch,
+    ThreadPool &pool,
+    size_t keyBits = sizeof(Key) * 8)
+{
+    size_t count = keys.size();
+    size_t chunkCount = (count + RADIX_CHUNK_SIZE - 1) / RADIX_CHUNK_SIZE;
+    size_t passes = 0;
+
+    scratch.keys.resize(count);
+    scratch.values.resize(count);
+    scratch.histograms.resize(chunkCount * 256);
+
+    for(size_t shift = 0; shift < keyBits; shift += 8) {
+        // The pool may hand out several chunks at once, with one thread
+        // it runs the whole range in one call
+        pool.parallelFor(count, RADIX_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            for(size_t chunk = begin; chunk < end; chunk += RADIX_CHUNK_SIZE) {
+                uint32_t *histogram = &scratch.histograms[chunk / RADIX_CHUNK_SIZE * 256];
+                std::fill(histogram, histogram + 256, 0);
+                for(size_t i = chunk; i < std::min(chunk + RADIX_CHUNK_SIZE, end); i++) {
+                    histogram[(keys[i] >> shift) & 0xff]++;
+                }
+            }
+        });
+
+        // Turn counts into scatter offsets, digit-major then chunk order.
+        // A digit holding every key means this pass would change nothing.
+        bool trivial = false;
+        uint32_t offset = 0;
+        for(size_t digit = 0; digit < 256; digit++) {
+            uint32_t digitStart = offset;
+            for(size_t chunk = 0; chunk < chunkCount; chunk++) {
+                uint32_t &entry = scratch.histograms[chunk * 256 + digit];
+                uint32_t digitCount = entry;
+                entry = offset;
+                offset += digitCount;
+            }
+            if(offset - digitStart == count) trivial = true;
+        }
+        if(trivial)
+            continue;
+
+        pool.parallelFor(count, RADIX_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            for(size_t chunk = begin; chunk < end; chunk += RADIX_CHUNK_SIZE) {
+                uint32_t *cursor = &scratch.histograms[chunk / RADIX_CHUNK_SIZE * 256];
+                for(size_t i = chunk; i < std::min(chunk + RADIX_CHUNK_SIZE, end); i++) {
+                    uint32_t slot = cursor[(keys[i] >> shift) & 0xff]++;
+                    scratch.keys[slot] = keys[i];
+                    scratch.values[slot] = values[i];
+                }
+            }
+        });
+
+        keys.swap(scratch.keys);
+        values.swap(scratch.values);
+        passes++;
+    }
+
+    return passes;
+}
@@ -0,0 +1,74 @@
+#include "readback.hpp"
+#include "log.hpp"
+
+#include <cstring>
+
+BufferReadback::BufferReadback(size_t size) : size(size)
+{
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glCreateBuffers(RING_SIZE, buffers);
+    for(size_t i = 0; i < RING_SIZE; i++) {
+        glNamedBufferStorage(buffers[i], size, nullptr, flags);
+        glClearNamedBufferData(buffers[i], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        mapped[i] = glMapNamedBufferRange(buffers[i], 0, size, flags);
+    }
+
+    LOG_DEBUG("Created readback ring of {} bytes", size);
+}
+
+BufferReadback::~BufferReadback()
+{
+    for(size_t i = 0; i < RING_SIZE; i++) {
+        glDeleteSync(fences[i]);
+        glUnmapNamedBuffer(buffers[i]);
+    }
+    glDeleteBuffers(RING_SIZE, buffers);
+
+    LOG_DEBUG("Destroyed readback ring");
+}
+
+GLuint BufferReadback::begin()
+{
+    frame++;
+    size_t slot = frame % RING_SIZE;
+
+    // Not read in time, its results are dropped
+    glDeleteSync(fences[slot]);
+    fences[slot] = nullptr;
+
+    glClearNamedBufferData(buffers[slot], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    return buffers[slot];
+}
+
+void BufferReadback::end()
+{
+    size_t slot = frame % RING_SIZE;
+
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    glDeleteSync(fences[slot]);
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool BufferReadback::read(void *result)
+{
+    // Newest first, a finished frame makes the older ones stale
+    for(size_t age = 0; age < RING_SIZE; age++) {
+        size_t slot = (frame + RING_SIZE - age) % RING_SIZE;
+        if(!fences[slot])
+            continue;
+
+        GLenum status = glClientWaitSync(fences[slot], 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+
+        std::memcpy(result, mapped[slot], size);
+        for(size_t older = age; older < RING_SIZE; older++) {
+            size_t stale = (frame + RING_SIZE - older) % RING_SIZE;
+            glDeleteSync(fences[stale]);
+            fences[stale] = nullptr;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+// A small buffer the GPU writes every frame, read back a few frames late
+// without stalling. Each frame gets its own persistently mapped buffer
+// from a ring, and a fence tells when its results have landed.
+class BufferReadback {
+public:
+    BufferReadback(size_t size);
+    ~BufferReadback();
+
+    // Zeroes and returns the buffer for this frame's writes
+    GLuint begin();
+    // After the last write of the frame
+    void end();
+
+    // Copies the newest finished frame to result. False if no frame
+    // finished since the last read, leaving result alone.
+    bool read(void *result);
+
+private:
+    static constexpr size_t RING_SIZE = 3;
+
+    size_t size;
+    GLuint buffers[RING_SIZE];
+    const void *mapped[RING_SIZE];
+    GLsync fences[RING_SIZE] = {};
+    size_t frame = 0;
+};
@@ -0,0 +1,136 @@
+#include "rendertarget.hpp"
+#include "shader.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+RenderTarget::RenderTarget()
+{
+    upscaleProgram = MaterialBuilder()
+        .attachShader(shaderFromBinaryFile("shaders/upscale.vert.spv", GL_VERTEX_SHADER))
+        .attachShader(shaderFromBinaryFile("shaders/upscale.frag.spv", GL_FRAGMENT_SHADER))
+        .buildMaterial();
+
+    // The fullscreen triangle comes from gl_VertexID
+    glCreateVertexArrays(1, &emptyVertexArray);
+
+    LOG_DEBUG("Created render target");
+}
+
+RenderTarget::~RenderTarget()
+{
+    release();
+    glDeleteVertexArrays(1, &emptyVertexArray);
+
+    LOG_DEBUG("Destroyed render target");
+}
+
+int RenderTarget::getMaxSamples()
+{
+    GLint maxSamples = 1;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    return maxSamples;
+}
+
+void RenderTarget::release()
+{
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    glDeleteFramebuffers(1, &resolveFramebuffer);
+    glDeleteTextures(1, &resolveTexture);
+
+    framebuffer = colorBuffer = depthBuffer = 0;
+    resolveFramebuffer = resolveTexture = 0;
+}
+
+void RenderTarget::configure(int outputWidth, int outputHeight, float scale, int samples)
+{
+    this->outputWidth = outputWidth;
+    this->outputHeight = outputHeight;
+
+    int newWidth = std::max(1, (int)std::lround(outputWidth * scale));
+    int newHeight = std::max(1, (int)std::lround(outputHeight * scale));
+    // 0 and 1 both mean no multisampling
+    int newSamples = std::clamp(samples, 1, getMaxSamples());
+
+    if(framebuffer != 0 && newWidth == width && newHeight == height && newSamples == this->samples)
+        return;
+
+    release();
+
+    width = newWidth;
+    height = newHeight;
+    this->samples = newSamples;
+
+    GLsizei storageSamples = newSamples > 1 ? newSamples : 0;
+
+    glCreateRenderbuffers(1, &colorBuffer);
+    glNamedRenderbufferStorageMultisample(colorBuffer, storageSamples, GL_RGBA8, width, height);
+    // Same format as the occlusion culler's depth copy, so it can be blitted
+    glCreateRenderbuffers(1, &depthBuffer);
+    glNamedRenderbufferStorageMultisample(depthBuffer, storageSamples, GL_DEPTH24_STENCIL8, width, height);
+
+    glCreateFramebuffers(1, &framebuffer);
+    glNamedFramebufferRenderbuffer(framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glNamedFramebufferRenderbuffer(framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+    if(glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error(fmt::format("Render target {}x{} with {} samples is incomplete", width, height, newSamples));
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &resolveTexture);
+    glTextureStorage2D(resolveTexture, 1, GL_RGBA8, width, height);
+    glTextureParameteri(resolveTexture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(resolveTexture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(resolveTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(resolveTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glCreateFramebuffers(1, &resolveFramebuffer);
+    glNamedFramebufferTexture(resolveFramebuffer, GL_COLOR_ATTACHMENT0, resolveTexture, 0);
+
+    LOG_DEBUG("Created render target {}x{} with {} samples", width, height, newSamples);
+}
+
+void RenderTarget::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+}
+
+void RenderTarget::present(UpscaleFilter filter, float sharpness)
+{
+    // Multisampled blits can't scale or convert formats, so resolve at the
+    // internal size first
+    glBlitNamedFramebuffer(framebuffer, resolveFramebuffer,
+        0, 0, width, height,
+        0, 0, width, height,
+        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, outputWidth, outputHeight);
+
+    bool sameSize = width == outputWidth && height == outputHeight;
+    if(filter == UpscaleFilter::Bilinear || sameSize) {
+        glBlitNamedFramebuffer(resolveFramebuffer, 0,
+            0, 0, width, height,
+            0, 0, outputWidth, outputHeight,
+            GL_COLOR_BUFFER_BIT, sameSize ? GL_NEAREST : GL_LINEAR);
+        return;
+    }
+
+    GLint polygonMode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDisable(GL_DEPTH_TEST);
+
+    upscaleProgram->use();
+    upscaleProgram->uniform1("sharpness", (GLfloat)sharpness);
+    glBindTextureUnit(0, resolveTexture);
+    glBindVertexArray(emptyVertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glEnable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+}
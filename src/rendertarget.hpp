@@ -0,0 +1,48 @@
+#pragma once
+
+#include "material.hpp"
+
+#include <GL/glew.h>
+
+#include <memory>
+
+enum class UpscaleFilter {
+    Bilinear,
+    Sharpen,
+};
+
+// Offscreen multisampled framebuffer the scene is drawn into at a fraction
+// of the window size. present() resolves it and scales it up onto the
+// default framebuffer, so the UI drawn afterwards stays at full resolution.
+class RenderTarget {
+public:
+    RenderTarget();
+    ~RenderTarget();
+
+    // Reallocates only when the internal size or the sample count changes
+    void configure(int outputWidth, int outputHeight, float scale, int samples);
+
+    // Binds the framebuffer and sets the viewport to the internal size
+    void bind();
+    // Leaves the default framebuffer bound with the output viewport
+    void present(UpscaleFilter filter, float sharpness);
+
+    GLuint getFramebuffer() const { return framebuffer; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getSamples() const { return samples; }
+
+    static int getMaxSamples();
+
+private:
+    void release();
+
+    std::shared_ptr<Material> upscaleProgram;
+    GLuint emptyVertexArray = 0;
+
+    GLuint framebuffer = 0, colorBuffer = 0, depthBuffer = 0;
+    GLuint resolveFramebuffer = 0, resolveTexture = 0;
+
+    int width = 0, height = 0, samples = 0;
+    int outputWidth = 0, outputHeight = 0;
+};
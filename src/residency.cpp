@@ -0,0 +1,272 @@
+#include "residency.hpp"
+#include "camera.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+// Seconds between read rate samples
+constexpr double READ_RATE_INTERVAL = 0.5;
+
+static bool insideFrustum(const glm::vec4 planes[6], const dataset::Bounds &bounds)
+{
+    for(int i = 0; i < 6; i++) {
+        glm::vec3 normal(planes[i]);
+        // Corner furthest along the plane normal
+        glm::vec3 corner(
+            normal.x >= 0.0f ? bounds.max.x : bounds.min.x,
+            normal.y >= 0.0f ? bounds.max.y : bounds.min.y,
+            normal.z >= 0.0f ? bounds.max.z : bounds.min.z
+        );
+        if(glm::dot(normal, corner) + planes[i].w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+static float distanceTo(const glm::vec3 &point, const dataset::Bounds &bounds)
+{
+    return glm::length(glm::clamp(point, bounds.min, bounds.max) - point);
+}
+
+ChunkResidency::ChunkResidency(const ChunkedDataset &data, const ResidencySettings &settings, size_t loaderCount) :
+    settings(settings), data(data), chunks(new Chunk[data.getChunkCount()])
+{
+    size_t slotBytes = data.getChunkCapacity() * sizeof(glm::vec3);
+    size_t slotCount = std::clamp<size_t>(settings.gpuBudget / slotBytes, 1, data.getChunkCount());
+
+    slotOwners.assign(slotCount, -1);
+    for(size_t slot = slotCount; slot-- > 0;) {
+        freeSlots.push_back(slot);
+    }
+
+    lastRateTime = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < std::max<size_t>(loaderCount, 1); i++) {
+        loaders.emplace_back(&ChunkResidency::loaderThread, this);
+    }
+
+    LOG_DEBUG("Created chunk residency with {} GPU slots and {} loaders", slotCount, loaders.size());
+}
+
+ChunkResidency::~ChunkResidency()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+
+    for(std::thread &loader : loaders) {
+        loader.join();
+    }
+
+    LOG_DEBUG("Destroyed chunk residency");
+}
+
+void ChunkResidency::loaderThread()
+{
+    while(true) {
+        uint32_t index;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this] { return stopping || !loadQueue.empty(); });
+            if(stopping)
+                return;
+
+            index = loadQueue.front();
+            loadQueue.pop_front();
+            chunks[index].host = HOST_LOADING;
+        }
+
+        size_t bytes = data.prefetch(index);
+        hostBytes += bytes;
+        bytesRead += bytes;
+        chunks[index].host.store(HOST_RESIDENT, std::memory_order_release);
+    }
+}
+
+void ChunkResidency::update(const glm::vec3 &cameraPosition, const glm::vec3 &cameraDirection, const glm::mat4 &projectionView)
+{
+    frame++;
+
+    glm::vec4 planes[6];
+    extractFrustumPlanes(projectionView, planes);
+
+    // Groups that are neither visible nor close rule out all their chunks
+    candidates.clear();
+    for(size_t g = 0; g < data.getGroupCount(); g++) {
+        dataset::Bounds groupBounds = data.getGroupBounds(g);
+        bool groupVisible = insideFrustum(planes, groupBounds);
+        if(!groupVisible && distanceTo(cameraPosition, groupBounds) > settings.prefetchDistance)
+            continue;
+
+        const dataset::GroupEntry &group = data.getGroup(g);
+        for(uint32_t c = group.firstChunk; c < group.firstChunk + group.chunkCount; c++) {
+            if(data.getChunk(c).count == 0)
+                continue;
+
+            dataset::Bounds bounds = data.getChunkBounds(c);
+            bool visible = groupVisible && insideFrustum(planes, bounds);
+            float distance = distanceTo(cameraPosition, bounds);
+            if(!visible && distance > settings.prefetchDistance)
+                continue;
+
+            float score = distance;
+            if(!visible) {
+                glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+                bool ahead = glm::dot(center - cameraPosition, cameraDirection) > 0.0f;
+                score += settings.prefetchDistance * (ahead ? 1.0f : 2.0f);
+            }
+
+            candidates.push_back({ c, score, visible });
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.score < b.score;
+    });
+
+    size_t hostSlots = std::max<size_t>(settings.hostBudget / dataset::chunkBytes(data.getChunkCapacity()), 1);
+    size_t hostWantedCount = std::min(candidates.size(), hostSlots);
+    gpuWantedCount = std::min(candidates.size(), slotOwners.size());
+
+    for(size_t i = 0; i < hostWantedCount; i++) {
+        chunks[candidates[i].chunk].hostWanted = frame;
+    }
+    for(size_t i = 0; i < gpuWantedCount; i++) {
+        chunks[candidates[i].chunk].gpuWanted = frame;
+    }
+
+    // The queue is rebuilt in rank order, so loads the camera moved away
+    // from are dropped before anyone gets to them
+    size_t pending;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        for(uint32_t index : loadQueue) {
+            chunks[index].host = HOST_NONE;
+        }
+        loadQueue.clear();
+
+        for(size_t i = 0; i < hostWantedCount; i++) {
+            Chunk &chunk = chunks[candidates[i].chunk];
+            if(chunk.slot >= 0 || chunk.host != HOST_NONE)
+                continue;
+            chunk.host = HOST_QUEUED;
+            loadQueue.push_back(candidates[i].chunk);
+        }
+        pending = loadQueue.size();
+    }
+    if(pending > 0)
+        queueCondition.notify_all();
+
+    trimHost();
+
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - lastRateTime).count();
+    if(elapsed >= READ_RATE_INTERVAL) {
+        size_t read = bytesRead;
+        stats.readRate = (read - lastBytesRead) / elapsed;
+        lastBytesRead = read;
+        lastRateTime = now;
+    }
+
+    stats.wantedChunks = hostWantedCount;
+    stats.pendingLoads = pending;
+}
+
+void ChunkResidency::trimHost()
+{
+    if(hostBytes <= settings.hostBudget)
+        return;
+
+    // Chunks nobody wants any more go first, oldest first. After them the
+    // ones already copied to the GPU, which don't need their pages.
+    std::vector<uint32_t> evictable;
+    std::vector<uint32_t> uploaded;
+    for(uint32_t c = 0; c < data.getChunkCount(); c++) {
+        const Chunk &chunk = chunks[c];
+        if(chunk.host.load(std::memory_order_acquire) != HOST_RESIDENT)
+            continue;
+        if(chunk.hostWanted < frame)
+            evictable.push_back(c);
+        else if(chunk.slot >= 0)
+            uploaded.push_back(c);
+    }
+    std::sort(evictable.begin(), evictable.end(), [this](uint32_t a, uint32_t b) {
+        return chunks[a].hostWanted < chunks[b].hostWanted;
+    });
+    evictable.insert(evictable.end(), uploaded.begin(), uploaded.end());
+
+    for(uint32_t c : evictable) {
+        if(hostBytes <= settings.hostBudget)
+            break;
+
+        data.release(c);
+        hostBytes -= data.getMappedSize(c);
+        chunks[c].host = HOST_NONE;
+    }
+}
+
+int32_t ChunkResidency::takeSlot()
+{
+    if(!freeSlots.empty()) {
+        int32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    // Least recently wanted slot that isn't wanted this frame
+    int32_t victim = -1;
+    for(size_t slot = 0; slot < slotOwners.size(); slot++) {
+        const Chunk &owner = chunks[slotOwners[slot]];
+        if(owner.gpuWanted < frame && (victim < 0 || owner.gpuWanted < chunks[slotOwners[victim]].gpuWanted))
+            victim = slot;
+    }
+    if(victim < 0)
+        return -1;
+
+    uint32_t owner = slotOwners[victim];
+    chunks[owner].slot = -1;
+    gpuPoints -= data.getChunk(owner).count;
+    evictions++;
+    return victim;
+}
+
+void ChunkResidency::upload(InstanceStream &stream)
+{
+    size_t capacity = data.getChunkCapacity();
+    if(stream.getCount() != getInstanceCapacity())
+        stream.upload(nullptr, getInstanceCapacity());
+
+    size_t uploaded = 0;
+    for(size_t i = 0; i < gpuWantedCount && uploaded < settings.uploadBudget; i++) {
+        uint32_t c = candidates[i].chunk;
+        Chunk &chunk = chunks[c];
+        if(chunk.slot >= 0 || chunk.host.load(std::memory_order_acquire) != HOST_RESIDENT)
+            continue;
+
+        int32_t slot = takeSlot();
+        if(slot < 0)
+            break;
+
+        chunk.slot = slot;
+        slotOwners[slot] = c;
+        stream.uploadRange(data.getChunkData(c), slot * capacity, data.getChunk(c).count);
+        uploaded += data.getChunkSize(c);
+        gpuPoints += data.getChunk(c).count;
+    }
+
+    draws.clear();
+    for(const Candidate &candidate : candidates) {
+        int32_t slot = chunks[candidate.chunk].slot;
+        if(candidate.visible && slot >= 0)
+            draws.push_back({ (uint32_t)(slot * capacity), data.getChunk(candidate.chunk).count });
+    }
+
+    stats.hostBytes = hostBytes;
+    stats.gpuChunks = slotOwners.size() - freeSlots.size();
+    stats.gpuPoints = gpuPoints;
+    stats.visibleChunks = draws.size();
+    stats.uploadedBytes = uploaded;
+    stats.evictions = evictions;
+}
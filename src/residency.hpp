@@ -0,0 +1,126 @@
+#pragma once
+
+#include "dataset.hpp"
+#include "instancestream.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ResidencySettings {
+    // Mapped chunk pages kept in memory
+    size_t hostBudget = 1ull << 30;
+    // Size of the GPU instance buffer, fixed at creation
+    size_t gpuBudget = 256ull << 20;
+    // Chunks this close are loaded even when they're off screen
+    float prefetchDistance = 500.0f;
+    // Chunk data handed to the GPU per frame
+    size_t uploadBudget = 16ull << 20;
+};
+
+// Keeps the part of a ChunkedDataset around the camera in memory and on
+// the GPU.
+//
+// Every frame the chunks near the camera are ranked: visible ones by
+// distance, ones in front of the camera behind those, and the rest last.
+// Background threads fault the best ranked chunks in from the mapping,
+// and the least recently wanted ones are dropped once the host budget is
+// exceeded. Loaded chunks are copied into fixed slots of one GPU buffer,
+// a few per frame, evicting the least recently wanted slot when full.
+class ChunkResidency {
+public:
+    struct Draw {
+        uint32_t firstInstance;
+        uint32_t count;
+    };
+
+    struct Stats {
+        size_t hostBytes;
+        size_t gpuChunks;
+        size_t gpuPoints;
+        size_t visibleChunks;
+        size_t wantedChunks;
+        size_t pendingLoads;
+        size_t uploadedBytes; // last frame
+        size_t evictions;
+        double readRate;      // bytes per second
+    };
+
+    ChunkResidency(const ChunkedDataset &data, const ResidencySettings &settings, size_t loaderCount = 2);
+    ~ChunkResidency();
+
+    // Ranks the chunks for this camera, queues loads and trims host memory
+    void update(const glm::vec3 &cameraPosition, const glm::vec3 &cameraDirection, const glm::mat4 &projectionView);
+    // Moves loaded chunks into GPU slots and collects this frame's draws
+    void upload(InstanceStream &stream);
+
+    // Visible chunks that are on the GPU, as instance ranges of the stream
+    const std::vector<Draw> &getDraws() const { return draws; }
+
+    size_t getSlotCount() const { return slotOwners.size(); }
+    size_t getInstanceCapacity() const { return slotOwners.size() * data.getChunkCapacity(); }
+    const Stats &getStats() const { return stats; }
+
+    // gpuBudget is only read at creation
+    ResidencySettings settings;
+
+private:
+    enum HostState : uint8_t {
+        HOST_NONE,
+        HOST_QUEUED,
+        HOST_LOADING,
+        HOST_RESIDENT,
+    };
+
+    struct Chunk {
+        std::atomic<uint8_t> host = HOST_NONE;
+        int32_t slot = -1;
+        uint64_t hostWanted = 0;
+        uint64_t gpuWanted = 0;
+    };
+
+    struct Candidate {
+        uint32_t chunk;
+        float score;
+        bool visible;
+    };
+
+    void loaderThread();
+    void trimHost();
+    int32_t takeSlot();
+
+    const ChunkedDataset &data;
+    std::unique_ptr<Chunk[]> chunks;
+    std::vector<int32_t> slotOwners;
+    std::vector<int32_t> freeSlots;
+
+    uint64_t frame = 0;
+    std::vector<Candidate> candidates;
+    // Ranked prefix of candidates that gets GPU slots
+    size_t gpuWantedCount = 0;
+    std::vector<Draw> draws;
+
+    std::vector<std::thread> loaders;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<uint32_t> loadQueue;
+    bool stopping = false;
+
+    size_t gpuPoints = 0;
+    size_t evictions = 0;
+
+    std::atomic<size_t> hostBytes = 0;
+    std::atomic<size_t> bytesRead = 0;
+    size_t lastBytesRead = 0;
+    std::chrono::steady_clock::time_point lastRateTime;
+
+    Stats stats = {};
+};
@@ -0,0 +1,74 @@
+#include "resolution.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr double GPU_TIME_SMOOTHING = 0.2;
+// Inside this band around the target the scale is left alone
+constexpr double TARGET_TOLERANCE = 0.1;
+
+ResolutionController::ResolutionController()
+{
+    glGenQueries(QUERY_RING_SIZE * 2, &queries[0][0]);
+
+    LOG_DEBUG("Created resolution controller");
+}
+
+ResolutionController::~ResolutionController()
+{
+    glDeleteQueries(QUERY_RING_SIZE * 2, &queries[0][0]);
+}
+
+void ResolutionController::beginFrame()
+{
+    // The slot was last used QUERY_RING_SIZE frames back. If it still isn't
+    // done the GPU is far behind; skip the sample rather than stall on it.
+    if(frame >= QUERY_RING_SIZE) {
+        GLuint *slot = queries[frame % QUERY_RING_SIZE];
+
+        GLint available = 0;
+        glGetQueryObjectiv(slot[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(slot[0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(slot[1], GL_QUERY_RESULT, &end);
+
+            double elapsed = (end - start) * 1e-9;
+            gpuTime = measured ? gpuTime + (elapsed - gpuTime) * GPU_TIME_SMOOTHING : elapsed;
+            measured = true;
+        }
+    }
+
+    glQueryCounter(queries[frame % QUERY_RING_SIZE][0], GL_TIMESTAMP);
+}
+
+void ResolutionController::endFrame()
+{
+    glQueryCounter(queries[frame % QUERY_RING_SIZE][1], GL_TIMESTAMP);
+    frame++;
+}
+
+float ResolutionController::update(float scale)
+{
+    float minScale = std::min(settings.minScale, settings.maxScale);
+    float clamped = std::clamp(scale, minScale, settings.maxScale);
+
+    // Measurements lag by the ring size, wait for ones taken at this scale
+    if(!settings.dynamic || !measured || frame - lastChange < QUERY_RING_SIZE * 2 || gpuTime <= 0.0)
+        return clamped;
+
+    double target = settings.targetMs * 1e-3;
+    if(std::abs(gpuTime - target) <= target * TARGET_TOLERANCE)
+        return clamped;
+
+    // Move halfway to the estimate to damp the noise
+    float wanted = clamped * (float)std::sqrt(target / gpuTime);
+    float next = clamped + (wanted - clamped) * 0.5f;
+    next = std::round(next / SCALE_STEP) * SCALE_STEP;
+    next = std::clamp(next, minScale, settings.maxScale);
+
+    if(next != clamped)
+        lastChange = frame;
+    return next;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+struct ResolutionSettings {
+    bool dynamic = true;
+    // Below 16.6ms, so vsync has some slack
+    float targetMs = 14.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+};
+
+// Picks the render scale from measured GPU times. Fill cost goes with the
+// pixel count, so the scale moves by the square root of the ratio between
+// the target and the measured time. Changes are quantized and spaced out
+// by the query latency, so the render target isn't reallocated every frame
+// and the controller doesn't chase its own stale measurements.
+class ResolutionController {
+public:
+    ResolutionController();
+    ~ResolutionController();
+
+    // Wrap the GL work whose time should hold the budget. Timestamps are
+    // used so this nests inside the benchmark's elapsed time query.
+    void beginFrame();
+    void endFrame();
+
+    // Returns the scale to render the next frame at
+    float update(float scale);
+
+    // Smoothed GPU time of the wrapped work, in seconds
+    double getGpuTime() const { return gpuTime; }
+
+    ResolutionSettings settings;
+
+private:
+    static constexpr size_t QUERY_RING_SIZE = 4;
+    static constexpr float SCALE_STEP = 0.05f;
+
+    GLuint queries[QUERY_RING_SIZE][2];
+    size_t frame = 0;
+
+    double gpuTime = 0.0;
+    bool measured = false;
+    size_t lastChange = 0;
+};
@@ -3,6 +3,10 @@
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
 #include "fileutil.hpp"
 
 Shader::Shader(GLenum shaderType)
@@ -37,14 +41,87 @@ std::shared_ptr<Shader> shaderFromGlslFile(std::string path, GLenum shaderType)
     return result;
 }
 
-std::shared_ptr<Shader> shaderFromBinaryFile(std::string path, GLenum shaderType)
+// SPIR-V opcodes and decorations the reflection needs
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+constexpr uint32_t SPIRV_HEADER_WORDS = 5;
+constexpr uint32_t OP_NAME = 5;
+constexpr uint32_t OP_DECORATE = 71;
+constexpr uint32_t OP_VARIABLE = 59;
+constexpr uint32_t DECORATION_SPEC_ID = 1;
+constexpr uint32_t DECORATION_LOCATION = 30;
+constexpr uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+
+struct SpirvReflection {
+    std::map<std::string, GLint> uniformLocations;
+    std::vector<GLuint> specializationIds;
+};
+
+static SpirvReflection reflectSpirv(const std::vector<uint8_t> &binary)
+{
+    const uint32_t *words = (const uint32_t*)binary.data();
+    size_t wordCount = binary.size() / sizeof(uint32_t);
+    if(wordCount < SPIRV_HEADER_WORDS || words[0] != SPIRV_MAGIC)
+        throw std::runtime_error("Shader binary is not SPIR-V");
+
+    std::map<uint32_t, std::string> names;
+    std::map<uint32_t, GLint> locations;
+    std::vector<uint32_t> uniforms;
+    SpirvReflection reflection;
+
+    for(size_t i = SPIRV_HEADER_WORDS; i < wordCount;) {
+        uint32_t length = words[i] >> 16;
+        uint32_t opcode = words[i] & 0xffff;
+        if(length == 0 || i + length > wordCount)
+            throw std::runtime_error("Shader binary has a truncated instruction");
+
+        const uint32_t *operands = words + i + 1;
+        if(opcode == OP_NAME && length > 2) {
+            const char *name = (const char*)(operands + 1);
+            names[operands[0]] = std::string(name, strnlen(name, (length - 2) * sizeof(uint32_t)));
+        } else if(opcode == OP_DECORATE && length > 3) {
+            if(operands[1] == DECORATION_LOCATION)
+                locations[operands[0]] = operands[2];
+            else if(operands[1] == DECORATION_SPEC_ID)
+                reflection.specializationIds.push_back(operands[2]);
+        } else if(opcode == OP_VARIABLE && length > 3 && operands[2] == STORAGE_UNIFORM_CONSTANT) {
+            uniforms.push_back(operands[1]);
+        }
+
+        i += length;
+    }
+
+    for(uint32_t id : uniforms) {
+        if(names.count(id) && locations.count(id))
+            reflection.uniformLocations[names[id]] = locations[id];
+    }
+
+    return reflection;
+}
+
+std::shared_ptr<Shader> shaderFromBinaryFile(std::string path, GLenum shaderType, const std::vector<SpecializationConstant> &constants)
+{
+    return shaderFromBinary(utils::readFileBinary(path), shaderType, constants);
+}
+
+std::shared_ptr<Shader> shaderFromBinary(const std::vector<uint8_t> &binary, GLenum shaderType, const std::vector<SpecializationConstant> &constants)
 {
-    std::vector<uint8_t> binary = utils::readFileBinary(path);
+    SpirvReflection reflection = reflectSpirv(binary);
+
+    // Naming a constant the module doesn't have fails specialization
+    std::vector<GLuint> ids;
+    std::vector<GLuint> values;
+    for(const SpecializationConstant &constant : constants) {
+        if(std::find(reflection.specializationIds.begin(), reflection.specializationIds.end(), constant.id) == reflection.specializationIds.end())
+            continue;
+        ids.push_back(constant.id);
+        values.push_back(constant.value);
+    }
 
     std::shared_ptr<Shader> result = std::make_shared<Shader>(shaderType);
+    result->uniformLocations = std::move(reflection.uniformLocations);
 
     glShaderBinary(1, &result->shader, GL_SHADER_BINARY_FORMAT_SPIR_V, binary.data(), binary.size());
-    glSpecializeShader(result->shader, "main", 0, nullptr, nullptr);
+    glSpecializeShader(result->shader, "main", ids.size(), ids.data(), values.data());
 
     int success;
 
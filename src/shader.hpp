@@ -2,8 +2,10 @@
 
 #include <GL/glew.h>
 
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 class Shader {
 public:
@@ -15,7 +17,19 @@ public:
     void compile();
 
     GLuint shader;
+    // Explicit uniform locations by name, for SPIR-V where the driver
+    // doesn't have to keep names around
+    std::map<std::string, GLint> uniformLocations;
+};
+
+struct SpecializationConstant {
+    GLuint id;
+    GLuint value;
 };
 
 std::shared_ptr<Shader> shaderFromGlslFile(std::string path, GLenum shaderType);
-std::shared_ptr<Shader> shaderFromBinaryFile(std::string path, GLenum shaderType);
+std::shared_ptr<Shader> shaderFromBinaryFile(std::string path, GLenum shaderType,
+    const std::vector<SpecializationConstant> &constants = {});
+// Constants the module doesn't declare are left out
+std::shared_ptr<Shader> shaderFromBinary(const std::vector<uint8_t> &binary, GLenum shaderType,
+    const std::vector<SpecializationConstant> &constants = {});
@@ -1,12 +1,20 @@
 #version 460 core
 
+// Specialized per variant, see shadervariant.hpp
+layout(constant_id = 1) const uint LOD_LEVEL = 0;
+layout(constant_id = 2) const bool LIGHTING = false;
+
 layout(location = 0) in vec3 vertexPosition;
 layout(location = 1) in vec3 vertexColor;
 layout(location = 2) in vec3 vertexNormal;
 
 layout(location = 0) out vec4 fragColor;
 
+const vec3 LIGHT_DIRECTION = vec3(0.57735026919);
+
 void main() {
-    // vec3 color = vertexColor * clamp(dot(normalize(vec3(1)), normalize(vertexNormal)), 0.02, 1.0);
-    fragColor = vec4(vertexColor, 1.0);
+    vec3 color = vertexColor;
+    if(LIGHTING && LOD_LEVEL == 0u)
+        color *= clamp(dot(LIGHT_DIRECTION, normalize(vertexNormal)), 0.02, 1.0);
+    fragColor = vec4(color, 1.0);
 }
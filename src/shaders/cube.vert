@@ -1,8 +1,26 @@
 #version 460 core
 
+// Specialized per variant, see shadervariant.hpp
+layout(constant_id = 0) const uint INSTANCE_FORMAT = 1; // 0: offset only, 1: color, scale and palette
+layout(constant_id = 1) const uint LOD_LEVEL = 0;       // 0: lit per fragment, 1: lit per vertex
+layout(constant_id = 2) const bool LIGHTING = false;
+layout(constant_id = 3) const bool VERTEX_PULLING = false; // instances from storage buffers, not attributes
+layout(constant_id = 4) const bool INDEXED_INSTANCES = false; // through a list of instance indices
+
 layout(location = 0) in vec3 vPos;
 layout(location = 1) in vec3 vNormal;
 layout(location = 2) in vec3 iOffset;
+layout(location = 3) in vec4 iColor;
+layout(location = 4) in float iScale;
+layout(location = 5) in uint iPalette;
+
+// Pulled instances. vec3 would be padded to 16 bytes in std430, and the
+// records are InstanceAttributes as raw words.
+layout(std430, binding = 0) readonly buffer InstancePositions { float instancePositions[]; };
+layout(std430, binding = 1) readonly buffer InstanceRecords { uint instanceRecords[]; };
+layout(std430, binding = 2) readonly buffer InstanceIndices { uint instanceIndices[]; };
+
+const uint RECORD_WORDS = 3u;
 
 layout(location = 0) uniform mat4 projection_view;
 
@@ -10,22 +28,44 @@ layout(location = 0) out vec3 vertexPosition;
 layout(location = 1) out vec3 vertexColor;
 layout(location = 2) out vec3 vertexNormal;
 
-float rand(vec2 co){
-    return fract(sin(dot(co, vec2(12.9898, 78.233))) * 43758.5453);
-}
+const vec3 palette[4] = vec3[](
+    vec3(1.0, 1.0, 1.0),
+    vec3(0.85, 0.9, 1.0),
+    vec3(1.0, 0.9, 0.85),
+    vec3(0.9, 1.0, 0.9)
+);
 
-vec3 rand3(vec3 co) {
-    return vec3(
-        rand(co.yz + co.zx),
-        rand(co.xz + co.zx),
-        rand(co.xy + co.zy)
-    );
-}
+const vec3 LIGHT_DIRECTION = vec3(0.57735026919);
 
 void main() {
-    vec3 vertPos = vPos * 1.0;
-    gl_Position = projection_view * vec4(vertPos + iOffset, 1.0);
-    vertexColor = normalize(vec3(0.6, 0.6, 1.0) * 2.0 + rand3(iOffset));
-    vertexPosition = vertPos + iOffset;
+    vec3 offset = iOffset;
+    vec4 instanceColor = iColor;
+    float instanceScale = iScale;
+    uint instancePalette = iPalette;
+
+    if(VERTEX_PULLING) {
+        uint instance = uint(gl_InstanceID + gl_BaseInstance);
+        if(INDEXED_INSTANCES)
+            instance = instanceIndices[instance];
+
+        offset = vec3(instancePositions[instance * 3u], instancePositions[instance * 3u + 1u], instancePositions[instance * 3u + 2u]);
+        if(INSTANCE_FORMAT != 0u) {
+            uint record = instance * RECORD_WORDS;
+            instanceColor = unpackUnorm4x8(instanceRecords[record]);
+            instanceScale = uintBitsToFloat(instanceRecords[record + 1u]);
+            instancePalette = instanceRecords[record + 2u];
+        }
+    }
+
+    float scale = INSTANCE_FORMAT != 0u ? instanceScale : 1.0;
+    vec3 color = INSTANCE_FORMAT != 0u ? instanceColor.rgb * palette[instancePalette & 3u] : vec3(1.0);
+
+    if(LIGHTING && LOD_LEVEL > 0u)
+        color *= clamp(dot(LIGHT_DIRECTION, normalize(vNormal)), 0.02, 1.0);
+
+    vec3 vertPos = vPos * scale;
+    gl_Position = projection_view * vec4(vertPos + offset, 1.0);
+    vertexColor = color;
+    vertexPosition = vertPos + offset;
     vertexNormal = vNormal;
 }
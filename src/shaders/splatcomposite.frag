@@ -0,0 +1,18 @@
+#version 460 core
+
+layout(location = 0) in vec2 uv;
+
+layout(location = 0) out vec4 color;
+
+// Resolved splats, depth in alpha
+layout(binding = 0) uniform sampler2D splats;
+
+void main() {
+    vec4 splat = texelFetch(splats, ivec2(gl_FragCoord.xy), 0);
+    if(splat.a >= 1.0)
+        discard;
+
+    // Depth tested against the triangles drawn before
+    gl_FragDepth = splat.a;
+    color = vec4(splat.rgb, 1.0);
+}
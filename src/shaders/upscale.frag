@@ -0,0 +1,29 @@
+#version 460 core
+
+layout(location = 0) in vec2 uv;
+
+layout(location = 0) out vec4 color;
+
+layout(binding = 0) uniform sampler2D source;
+
+// 0 is plain bilinear
+layout(location = 0) uniform float sharpness;
+
+void main() {
+    vec2 texel = 1.0 / vec2(textureSize(source, 0));
+
+    vec3 center = texture(source, uv).rgb;
+    vec3 north = texture(source, uv + vec2(0.0, texel.y)).rgb;
+    vec3 south = texture(source, uv - vec2(0.0, texel.y)).rgb;
+    vec3 east = texture(source, uv + vec2(texel.x, 0.0)).rgb;
+    vec3 west = texture(source, uv - vec2(texel.x, 0.0)).rgb;
+
+    // Sharpen less where there's already a lot of contrast, so edges don't ring
+    vec3 minimum = min(center, min(min(north, south), min(east, west)));
+    vec3 maximum = max(center, max(max(north, south), max(east, west)));
+    vec3 amount = sqrt(clamp(min(minimum, 1.0 - maximum) / max(maximum, 1e-4), 0.0, 1.0));
+    vec3 weight = -amount * mix(0.125, 0.2, sharpness);
+
+    vec3 sharpened = (center + (north + south + east + west) * weight) / (1.0 + 4.0 * weight);
+    color = vec4(clamp(sharpened, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,46 @@
+#include "shadervariant.hpp"
+#include "shader.hpp"
+#include "mesh.hpp"
+#include "fileutil.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+// cube.vert reads pulled records as RECORD_WORDS raw words
+static_assert(sizeof(InstanceAttributes) == 3 * sizeof(GLuint), "Pulled instance records changed size");
+
+MaterialVariants::MaterialVariants(const std::string &vertexPath, const std::string &fragmentPath) :
+    vertexBinary(utils::readFileBinary(vertexPath)), fragmentBinary(utils::readFileBinary(fragmentPath))
+{
+    LOG_DEBUG("Created material variants of {} and {}", vertexPath, fragmentPath);
+}
+
+MaterialVariants::~MaterialVariants()
+{
+    LOG_DEBUG("Destroyed {} material variants", materials.size());
+}
+
+std::shared_ptr<Material> MaterialVariants::get(const ShaderVariant &variant)
+{
+    auto it = materials.find(variant.key());
+    if(it != materials.end())
+        return it->second;
+
+    std::vector<SpecializationConstant> constants = {
+        { variant::INSTANCE_FORMAT_ID, (GLuint)variant.format },
+        { variant::LOD_LEVEL_ID, std::min(variant.lod, variant::MAX_LOD_LEVEL) },
+        { variant::LIGHTING_ID, (GLuint)variant.lighting },
+        { variant::VERTEX_PULLING_ID, (GLuint)variant.pulling },
+        { variant::INDEXED_INSTANCES_ID, (GLuint)(variant.pulling && variant.indexed) },
+    };
+
+    std::shared_ptr<Material> material = MaterialBuilder()
+        .attachShader(shaderFromBinary(vertexBinary, GL_VERTEX_SHADER, constants))
+        .attachShader(shaderFromBinary(fragmentBinary, GL_FRAGMENT_SHADER, constants))
+        .buildMaterial();
+
+    LOG_DEBUG("Linked variant {:#x}", variant.key());
+
+    materials.emplace(variant.key(), material);
+    return material;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "material.hpp"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Specialization constant ids shared by cube.vert and cube.frag
+namespace variant {
+    constexpr GLuint INSTANCE_FORMAT_ID = 0;
+    constexpr GLuint LOD_LEVEL_ID = 1;
+    constexpr GLuint LIGHTING_ID = 2;
+    constexpr GLuint VERTEX_PULLING_ID = 3;
+    constexpr GLuint INDEXED_INSTANCES_ID = 4;
+
+    constexpr uint32_t MAX_LOD_LEVEL = 1;
+
+    // Storage buffer bindings cube.vert pulls instances from
+    constexpr GLuint PULL_POSITIONS_BINDING = 0;
+    constexpr GLuint PULL_RECORDS_BINDING = 1;
+    constexpr GLuint PULL_INDICES_BINDING = 2;
+}
+
+enum class InstanceFormat : uint32_t {
+    Offset = 0,     // positions only
+    Attributes = 1, // plus color, scale and palette
+};
+
+struct ShaderVariant {
+    InstanceFormat format = InstanceFormat::Attributes;
+    // 0 lights per fragment, 1 per vertex
+    uint32_t lod = 0;
+    bool lighting = false;
+    // Instances are read from storage buffers by the shader, optionally
+    // through a list of indices, instead of from vertex attributes
+    bool pulling = false;
+    bool indexed = false;
+
+    uint32_t key() const {
+        return (uint32_t)format | std::min(lod, variant::MAX_LOD_LEVEL) << 4 | (uint32_t)lighting << 8
+            | (uint32_t)pulling << 12 | (uint32_t)(pulling && indexed) << 13;
+    }
+};
+
+// Linked programs for every variant of one vertex/fragment SPIR-V pair.
+// The modules are read once; each variant specializes them on first use,
+// which lets the driver strip the code its feature set doesn't reach.
+class MaterialVariants {
+public:
+    MaterialVariants(const std::string &vertexPath, const std::string &fragmentPath);
+    ~MaterialVariants();
+
+    std::shared_ptr<Material> get(const ShaderVariant &variant);
+
+    size_t getLinkedCount() const { return materials.size(); }
+
+private:
+    std::vector<uint8_t> vertexBinary;
+    std::vector<uint8_t> fragmentBinary;
+
+    std::unordered_map<uint32_t, std::shared_ptr<Material>> materials;
+};
@@ -0,0 +1,206 @@
+#include "sharedfeed.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char FEED_MAGIC[8] = {'G', 'L', 'I', 'F', 'E', 'E', 'D', '1'};
+
+// Rereads of a frame the producer overwrote mid-read before giving up
+static constexpr int MAX_READ_ATTEMPTS = 4;
+
+static size_t alignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// shm_open wants a single leading slash
+static std::string objectName(const std::string &name)
+{
+    return !name.empty() && name[0] == '/' ? name : "/" + name;
+}
+
+size_t shmfeed::slotSize(size_t capacity, size_t stride)
+{
+    return alignUp(sizeof(SlotHeader) + capacity * stride, SLOT_ALIGNMENT);
+}
+
+size_t shmfeed::headerSize()
+{
+    return alignUp(sizeof(RingHeader), SLOT_ALIGNMENT);
+}
+
+FeedProducer::FeedProducer(const std::string &name, size_t capacity, uint32_t slotCount) :
+    name(objectName(name)), capacity(capacity)
+{
+    if(capacity == 0 || slotCount < 2)
+        throw std::runtime_error("A feed needs room for at least one instance and two slots");
+
+    size_t slotSize = shmfeed::slotSize(capacity, sizeof(glm::vec3));
+    mappingSize = shmfeed::headerSize() + slotSize * slotCount;
+
+    // Left over from a producer that didn't exit cleanly
+    shm_unlink(this->name.c_str());
+
+    fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0)
+        throw std::runtime_error(fmt::format("Failed to create shared memory {}: {}", this->name, std::strerror(errno)));
+
+    if(ftruncate(fd, mappingSize) != 0) {
+        close(fd);
+        shm_unlink(this->name.c_str());
+        throw std::runtime_error(fmt::format("Failed to size shared memory {}: {}", this->name, std::strerror(errno)));
+    }
+
+    void *address = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(address == MAP_FAILED) {
+        close(fd);
+        shm_unlink(this->name.c_str());
+        throw std::runtime_error(fmt::format("Failed to map shared memory {}: {}", this->name, std::strerror(errno)));
+    }
+    mapping = (uint8_t*)address;
+
+    // ftruncate zero-fills, so every slot starts with an even sequence
+    header = new (mapping) shmfeed::RingHeader {};
+    header->version = shmfeed::VERSION;
+    header->format = shmfeed::FORMAT_VEC3;
+    header->stride = sizeof(glm::vec3);
+    header->slotCount = slotCount;
+    header->capacity = capacity;
+    header->slotSize = slotSize;
+    header->published.store(0, std::memory_order_relaxed);
+    std::memcpy(header->magic, FEED_MAGIC, sizeof(FEED_MAGIC));
+
+    LOG_DEBUG("Created feed {} ({} instances, {} slots, {} MB)", this->name, capacity, slotCount, mappingSize >> 20);
+}
+
+FeedProducer::~FeedProducer()
+{
+    munmap(mapping, mappingSize);
+    close(fd);
+    shm_unlink(name.c_str());
+    LOG_DEBUG("Removed feed {}", name);
+}
+
+glm::vec3 *FeedProducer::beginFrame()
+{
+    uint8_t *slot = mapping + shmfeed::headerSize() + (frame % header->slotCount) * header->slotSize;
+    writing = (shmfeed::SlotHeader*)slot;
+
+    // Odd while writing; the fence keeps the data writes after it
+    uint64_t sequence = writing->sequence.load(std::memory_order_relaxed);
+    writing->sequence.store(sequence + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    return (glm::vec3*)(slot + sizeof(shmfeed::SlotHeader));
+}
+
+void FeedProducer::endFrame(size_t count)
+{
+    if(!writing)
+        throw std::runtime_error("endFrame() without beginFrame()");
+
+    writing->frame = frame;
+    writing->count = std::min(count, capacity);
+
+    uint64_t sequence = writing->sequence.load(std::memory_order_relaxed);
+    writing->sequence.store(sequence + 1, std::memory_order_release);
+    header->published.store(++frame, std::memory_order_release);
+    writing = nullptr;
+}
+
+FeedConsumer::FeedConsumer(const std::string &name) : name(objectName(name))
+{
+    fd = shm_open(this->name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+        throw std::runtime_error(fmt::format("No feed named {} ({}); start the producer first", this->name, std::strerror(errno)));
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < shmfeed::headerSize()) {
+        close(fd);
+        throw std::runtime_error(fmt::format("Feed {} is not initialized", this->name));
+    }
+    mappingSize = info.st_size;
+
+    void *address = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    if(address == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error(fmt::format("Failed to map feed {}: {}", this->name, std::strerror(errno)));
+    }
+    mapping = (const uint8_t*)address;
+    header = (const shmfeed::RingHeader*)mapping;
+
+    const char *problem = nullptr;
+    if(std::memcmp(header->magic, FEED_MAGIC, sizeof(FEED_MAGIC)) != 0 || header->version != shmfeed::VERSION)
+        problem = "is not an instance feed";
+    else if(header->format != shmfeed::FORMAT_VEC3 || header->stride != sizeof(glm::vec3))
+        problem = "has an unsupported instance format";
+    else if(header->slotSize < shmfeed::slotSize(header->capacity, header->stride) ||
+        shmfeed::headerSize() + header->slotSize * header->slotCount > mappingSize)
+        problem = "is smaller than its header claims";
+
+    if(problem) {
+        munmap((void*)mapping, mappingSize);
+        close(fd);
+        throw std::runtime_error(fmt::format("Feed {} {}", this->name, problem));
+    }
+
+    LOG_DEBUG("Attached to feed {} ({} instances, {} slots)", this->name, header->capacity, header->slotCount);
+}
+
+FeedConsumer::~FeedConsumer()
+{
+    munmap((void*)mapping, mappingSize);
+    close(fd);
+    LOG_DEBUG("Detached from feed {}", name);
+}
+
+bool FeedConsumer::read(const std::function<void(const void *data, size_t count)> &upload)
+{
+    for(int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        uint64_t published = header->published.load(std::memory_order_acquire);
+        if(published == 0 || published == lastPublished)
+            return false;
+
+        uint64_t frame = published - 1;
+        const uint8_t *slot = mapping + shmfeed::headerSize() + (frame % header->slotCount) * header->slotSize;
+        const shmfeed::SlotHeader *slotHeader = (const shmfeed::SlotHeader*)slot;
+
+        uint64_t before = slotHeader->sequence.load(std::memory_order_acquire);
+        if(before & 1) {
+            tornReads++;
+            continue;
+        }
+
+        // Straight from the mapping. The producer may overwrite the slot
+        // meanwhile, which the check afterwards catches.
+        size_t count = std::min<size_t>(slotHeader->count, header->capacity);
+        upload(slot + sizeof(shmfeed::SlotHeader), count);
+
+        // Anything read above must have happened before this check
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slotHeader->sequence.load(std::memory_order_relaxed) != before) {
+            tornReads++;
+            continue;
+        }
+
+        if(lastPublished > 0 && frame > lastFrame)
+            skippedFrames += frame - lastFrame - 1;
+        lastPublished = published;
+        lastFrame = frame;
+        lastCount = count;
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Shared memory instance feed.
+//
+// A producer process owns a POSIX shared memory object holding a ring
+// header followed by a ring of frame slots. Each slot is guarded by a
+// sequence counter that is odd while the producer writes to it (a
+// seqlock), so readers can tell when a frame was overwritten while
+// they read it. Readers never write to the mapping.
+namespace shmfeed {
+    constexpr uint32_t VERSION = 1;
+    constexpr uint32_t FORMAT_VEC3 = 1; // tightly packed float x, y, z
+    constexpr size_t SLOT_ALIGNMENT = 4096;
+
+    struct RingHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t format;
+        uint32_t stride;
+        uint32_t slotCount;
+        uint64_t capacity; // instances per slot
+        uint64_t slotSize; // bytes per slot, SlotHeader included
+        alignas(64) std::atomic<uint64_t> published; // frames published so far
+    };
+
+    struct alignas(64) SlotHeader {
+        std::atomic<uint64_t> sequence;
+        uint64_t frame;
+        uint64_t count;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared atomics must be lock free");
+
+    size_t slotSize(size_t capacity, size_t stride);
+    size_t headerSize();
+}
+
+// Creates the shared memory object and publishes frames into it.
+// The object is unlinked again on destruction.
+class FeedProducer {
+public:
+    FeedProducer(const std::string &name, size_t capacity, uint32_t slotCount = 3);
+    ~FeedProducer();
+
+    // Slot to fill with up to getCapacity() positions
+    glm::vec3 *beginFrame();
+    void endFrame(size_t count);
+
+    size_t getCapacity() const { return capacity; }
+    uint64_t getFrameCount() const { return frame; }
+
+private:
+    std::string name;
+    int fd = -1;
+    uint8_t *mapping = nullptr;
+    size_t mappingSize = 0;
+
+    size_t capacity;
+    shmfeed::RingHeader *header;
+    shmfeed::SlotHeader *writing = nullptr;
+    uint64_t frame = 0;
+};
+
+// Attaches read-only to a producer's ring and hands out its newest
+// frame, copied out of the mapping and checked to be whole.
+class FeedConsumer {
+public:
+    FeedConsumer(const std::string &name);
+    ~FeedConsumer();
+
+    // Calls upload(data, count) with the newest frame, straight from the
+    // mapping. Only a true return means what was uploaded is whole, so
+    // upload into a buffer that is used only after that. Returns false if
+    // nothing new was published since the last read, or the producer kept
+    // overwriting the frame while it was read.
+    bool read(const std::function<void(const void *data, size_t count)> &upload);
+
+    const std::string &getName() const { return name; }
+    size_t getCapacity() const { return header->capacity; }
+    size_t getLastCount() const { return lastCount; }
+    uint64_t getLastFrame() const { return lastFrame; }
+    uint64_t getSkippedFrames() const { return skippedFrames; }
+    uint64_t getTornReads() const { return tornReads; }
+
+private:
+    std::string name;
+    int fd = -1;
+    const uint8_t *mapping = nullptr;
+    size_t mappingSize = 0;
+    const shmfeed::RingHeader *header;
+
+    uint64_t lastPublished = 0;
+    uint64_t lastFrame = 0;
+    size_t lastCount = 0;
+    uint64_t skippedFrames = 0;
+    uint64_t tornReads = 0;
+};
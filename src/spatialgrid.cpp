@@ -0,0 +1,137 @@
+#include "spatialgrid.hpp"
+#include "log.hpp"
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+
+static constexpr size_t GRID_CHUNK_SIZE = 16384;
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+SpatialGrid::SpatialGrid(float cellSize) : cellSize(cellSize)
+{
+    LOG_DEBUG("Created spatial grid with cell size {}", cellSize);
+}
+
+void SpatialGrid::build(const std::vector<glm::vec3> &positions, ThreadPool &pool)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    size_t count = positions.size();
+
+    // Roughly two buckets per particle keeps collisions rare
+    bucketCount = 1024;
+    while(bucketCount < count * 2) bucketCount <<= 1;
+
+    bucketStart.resize(bucketCount + 1);
+    sortKeys.resize(count);
+    sortedIndices.resize(count);
+
+    pool.parallelFor(count, GRID_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            sortKeys[i] = bucketOf(cellOf(positions[i]));
+            sortedIndices[i] = (uint32_t)i;
+        }
+    });
+
+    // Stable, so the order inside a bucket and with it the collision
+    // results don't depend on the scheduling
+    radixSort(sortKeys, sortedIndices, sortScratch, pool, std::bit_width(bucketCount - 1));
+
+    // Each bucket starts where the sorted keys first reach it. Whoever
+    // sees a key change fills in the buckets it stepped over, so every
+    // entry is written exactly once.
+    pool.parallelFor(count, GRID_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for(size_t k = begin; k < end; k++) {
+            uint32_t first = k == 0 ? 0 : sortKeys[k - 1] + 1;
+            for(uint32_t bucket = first; bucket <= sortKeys[k]; bucket++) {
+                bucketStart[bucket] = (uint32_t)k;
+            }
+        }
+    });
+    uint32_t last = count == 0 ? 0 : sortKeys[count - 1] + 1;
+    for(uint32_t bucket = last; bucket <= bucketCount; bucket++) {
+        bucketStart[bucket] = (uint32_t)count;
+    }
+
+    lastBuildTime = secondsSince(start);
+}
+
+size_t SpatialGrid::resolveCollisions(
+    std::vector<glm::vec3> &positions,
+    std::vector<glm::vec3> &velocities,
+    float radius, float restitution,
+    ThreadPool &pool,
+    ActivityTracker *activity)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    size_t count = positions.size();
+    positionDeltas.resize(count);
+    velocityDeltas.resize(count);
+
+    float contactDistance = radius * 2.0f;
+    std::atomic<size_t> contacts = 0;
+
+    // Every particle only writes its own deltas, so pairs need no locking.
+    // Each side takes half of the correction.
+    pool.parallelFor(count, GRID_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        size_t localContacts = 0;
+
+        for(size_t i = begin; i < end; i++) {
+            const glm::vec3 &position = positions[i];
+            const glm::vec3 &velocity = velocities[i];
+            glm::vec3 positionDelta(0.0f);
+            glm::vec3 velocityDelta(0.0f);
+
+            forEachNeighbor(position, [&](uint32_t j) {
+                if(j == i) return;
+
+                glm::vec3 offset = position - positions[j];
+                float distanceSquared = glm::dot(offset, offset);
+                if(distanceSquared >= contactDistance * contactDistance || distanceSquared == 0.0f)
+                    return;
+
+                float distance = std::sqrt(distanceSquared);
+                glm::vec3 normal = offset / distance;
+                positionDelta += normal * (contactDistance - distance) * 0.5f;
+
+                float approach = glm::dot(velocity - velocities[j], normal);
+                if(approach < 0.0f)
+                    velocityDelta -= normal * approach * (1.0f + restitution) * 0.5f;
+
+                localContacts++;
+            });
+
+            positionDeltas[i] = positionDelta;
+            velocityDeltas[i] = velocityDelta;
+        }
+
+        contacts += localContacts;
+    });
+
+    pool.parallelFor(count, GRID_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            if(positionDeltas[i] == glm::vec3(0.0f) && velocityDeltas[i] == glm::vec3(0.0f))
+                continue;
+
+            positions[i] += positionDeltas[i];
+            velocities[i] += velocityDeltas[i];
+
+            if(activity) {
+                activity->wake(i);
+                activity->markDirty(i);
+            }
+        }
+    });
+
+    lastQueryTime = secondsSince(start);
+
+    // Every contact was seen from both sides
+    return contacts / 2;
+}
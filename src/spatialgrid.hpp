@@ -0,0 +1,97 @@
+#pragma once
+
+#include "threadpool.hpp"
+#include "activity.hpp"
+#include "radixsort.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Uniform grid over unbounded space, hashed into a fixed number of buckets.
+// Rebuilt from scratch every tick with a radix sort on the bucket, so
+// particles of one bucket end up contiguous in getSortedIndices(), in
+// index order whatever the thread count.
+class SpatialGrid {
+public:
+    SpatialGrid(float cellSize);
+
+    void build(const std::vector<glm::vec3> &positions, ThreadPool &pool);
+
+    // Calls fn(j) for every particle in the 27 cells around `position`.
+    // Hash collisions may report particles from far away cells, so
+    // callers must still check distances.
+    template<typename F>
+    void forEachNeighbor(const glm::vec3 &position, F &&fn) const;
+
+    // Pushes overlapping spheres of `radius` apart and exchanges
+    // velocity along the contact normal. Returns the number of contacts.
+    // Particles that get pushed are woken and marked dirty in `activity`.
+    size_t resolveCollisions(
+        std::vector<glm::vec3> &positions,
+        std::vector<glm::vec3> &velocities,
+        float radius, float restitution,
+        ThreadPool &pool,
+        ActivityTracker *activity = nullptr
+    );
+
+    void setCellSize(float size) { cellSize = size; }
+    float getCellSize() const { return cellSize; }
+
+    const std::vector<uint32_t> &getSortedIndices() const { return sortedIndices; }
+
+    double getLastBuildTime() const { return lastBuildTime; }
+    double getLastQueryTime() const { return lastQueryTime; }
+
+private:
+    glm::ivec3 cellOf(const glm::vec3 &position) const {
+        return glm::ivec3(glm::floor(position / cellSize));
+    }
+    uint32_t bucketOf(const glm::ivec3 &cell) const {
+        uint32_t hash = ((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u) ^ ((uint32_t)cell.z * 83492791u);
+        return hash & (bucketCount - 1);
+    }
+
+    float cellSize;
+    uint32_t bucketCount = 0;
+
+    std::vector<uint32_t> bucketStart;
+    std::vector<uint32_t> sortedIndices;
+    std::vector<uint32_t> sortKeys;
+    RadixScratch<uint32_t> sortScratch;
+
+    // Collision scratch space
+    std::vector<glm::vec3> positionDeltas;
+    std::vector<glm::vec3> velocityDeltas;
+
+    double lastBuildTime = 0.0;
+    double lastQueryTime = 0.0;
+};
+
+template<typename F>
+void SpatialGrid::forEachNeighbor(const glm::vec3 &position, F &&fn) const
+{
+    glm::ivec3 center = cellOf(position);
+
+    uint32_t visited[27];
+    int visitedCount = 0;
+
+    for(int z = -1; z <= 1; z++)
+    for(int y = -1; y <= 1; y++)
+    for(int x = -1; x <= 1; x++) {
+        uint32_t bucket = bucketOf(center + glm::ivec3(x, y, z));
+
+        // Neighbouring cells may share a bucket
+        bool seen = false;
+        for(int i = 0; i < visitedCount; i++) {
+            if(visited[i] == bucket) { seen = true; break; }
+        }
+        if(seen) continue;
+        visited[visitedCount++] = bucket;
+
+        for(uint32_t k = bucketStart[bucket]; k < bucketStart[bucket + 1]; k++) {
+            fn(sortedIndices[k]);
+        }
+    }
+}
@@ -0,0 +1,166 @@
+#include "splatting.hpp"
+#include "camera.hpp"
+#include "shader.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static bool hasExtension(const char *name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for(GLint i = 0; i < count; i++) {
+        const char *extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if(extension && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+PointSplatter::PointSplatter() : statsReadback(sizeof(Stats))
+{
+    wide = hasExtension("GL_ARB_gpu_shader_int64") && hasExtension("GL_NV_shader_atomic_int64");
+
+    splatProgram = MaterialBuilder()
+        .attachShader(shaderFromBinaryFile(wide ? "shaders/splat64.comp.spv" : "shaders/splat.comp.spv", GL_COMPUTE_SHADER))
+        .buildMaterial();
+    resolveProgram = MaterialBuilder()
+        .attachShader(shaderFromBinaryFile("shaders/splatresolve.comp.spv", GL_COMPUTE_SHADER))
+        .buildMaterial();
+    compositeProgram = MaterialBuilder()
+        .attachShader(shaderFromBinaryFile("shaders/upscale.vert.spv", GL_VERTEX_SHADER))
+        .attachShader(shaderFromBinaryFile("shaders/splatcomposite.frag.spv", GL_FRAGMENT_SHADER))
+        .buildMaterial();
+
+    glCreateVertexArrays(1, &emptyVertexArray);
+
+    glCreateBuffers(1, &nearCommand);
+    glNamedBufferStorage(nearCommand, sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+    LOG_DEBUG("Created point splatter with {}-bit atomics", wide ? 64 : 32);
+}
+
+PointSplatter::~PointSplatter()
+{
+    glDeleteBuffers(1, &nearIndices);
+    glDeleteBuffers(1, &nearCommand);
+    glDeleteBuffers(1, &splatBuffer);
+    glDeleteVertexArrays(1, &emptyVertexArray);
+
+    LOG_DEBUG("Destroyed point splatter");
+}
+
+void PointSplatter::ensureCapacity(size_t instanceCount)
+{
+    if(instanceCount <= capacity)
+        return;
+
+    glDeleteBuffers(1, &nearIndices);
+    capacity = instanceCount;
+    glCreateBuffers(1, &nearIndices);
+    glNamedBufferStorage(nearIndices, capacity * sizeof(GLuint), nullptr, 0);
+
+    LOG_DEBUG("Resized point splatter to {} instances", capacity);
+}
+
+void PointSplatter::ensureTarget(int width, int height)
+{
+    if(width == targetWidth && height == targetHeight)
+        return;
+
+    glDeleteBuffers(1, &splatBuffer);
+    targetWidth = width;
+    targetHeight = height;
+
+    // Color and depth words, all ones is empty. The resolve clears it
+    // again afterwards, so this is the only full clear.
+    glCreateBuffers(1, &splatBuffer);
+    glNamedBufferStorage(splatBuffer, (size_t)width * height * 2 * sizeof(GLuint), nullptr, 0);
+    GLuint empty = 0xFFFFFFFF;
+    glClearNamedBufferData(splatBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
+
+    resolved = Texture::createEmpty(width, height);
+
+    LOG_DEBUG("Created splat target {}x{}", width, height);
+}
+
+void PointSplatter::splat(GLuint positionBuffer, GLuint recordBuffer, size_t instanceCount,
+    const MeshRange &range, const glm::mat4 &projectionView, int width, int height)
+{
+    if(width <= 0 || height <= 0)
+        return;
+
+    ensureCapacity(std::max<size_t>(instanceCount, 1));
+    ensureTarget(width, height);
+
+    // Take the newest finished counters, then reset this frame's
+    statsReadback.read(&stats);
+    GLuint statsBuffer = statsReadback.begin();
+
+    DrawElementsIndirectCommand reset = {
+        range.indexCount, 0,
+        range.firstIndex, range.baseVertex,
+        0
+    };
+    glNamedBufferSubData(nearCommand, 0, sizeof(reset), &reset);
+
+    glm::vec4 planes[6];
+    extractFrustumPlanes(projectionView, planes);
+    // Row 1 of the projection scaled by the rotation, so its length is
+    // the vertical focal length
+    float focal = glm::length(glm::vec3(projectionView[0][1], projectionView[1][1], projectionView[2][1]));
+
+    splatProgram->use();
+    splatProgram->uniform4x4("projection_view", projectionView);
+    splatProgram->uniform4v("frustumPlanes", planes, 6);
+    splatProgram->uniform1("instanceCount", (GLuint)instanceCount);
+    splatProgram->uniform1("boundingRadius", boundingRadius);
+    splatProgram->uniform1("pixelScale", focal * height * 0.5f);
+    splatProgram->uniform1("maxSplatRadius", maxSplatRadius);
+    splatProgram->uniform2("targetSize", glm::vec2(width, height));
+    splatProgram->uniform1("hasRecords", (GLuint)(recordBuffer != 0));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, positionBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, recordBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, splatBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, nearIndices);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, nearCommand);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, statsBuffer);
+
+    GLuint groups = (GLuint)((instanceCount + 255) / 256);
+    splatProgram->uniform1("splatPass", (GLuint)0);
+    glDispatchCompute(groups, 1, 1);
+
+    if(!wide) {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        splatProgram->uniform1("splatPass", (GLuint)1);
+        glDispatchCompute(groups, 1, 1);
+    }
+    statsReadback.end();
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    resolveProgram->use();
+    resolved->bind_image(0, GL_WRITE_ONLY);
+    glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void PointSplatter::composite()
+{
+    if(!resolved)
+        return;
+
+    // Splats are pixels, wireframe or not
+    GLint polygonMode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    compositeProgram->use();
+    resolved->use(0);
+    glBindVertexArray(emptyVertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "material.hpp"
+#include "readback.hpp"
+#include "texture.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <memory>
+
+// Draws instances that cover about a pixel as single points from a compute
+// shader, instead of rasterizing twelve triangles each.
+//
+// Every instance in the frustum is projected. The ones bigger than
+// maxSplatRadius pixels go to a list that is drawn as triangles, the rest
+// are depth tested against each other with atomics into a per-pixel buffer.
+// composite() then merges the splats into the framebuffer with the
+// triangles' depth.
+//
+// 64-bit atomics resolve a splat in one pass where the driver has them;
+// otherwise the nearest depth is found first and its color written after.
+class PointSplatter {
+public:
+    struct Stats {
+        GLuint splatted;
+        GLuint near;
+    };
+
+    PointSplatter();
+    ~PointSplatter();
+
+    // Records are the InstanceAttributes stream, or 0 for plain offsets
+    void splat(GLuint positionBuffer, GLuint recordBuffer, size_t instanceCount,
+        const MeshRange &range, const glm::mat4 &projectionView, int width, int height);
+    // Into the bound framebuffer, after the near instances are drawn
+    void composite();
+
+    // Instances to draw as triangles, for GeometryArena::drawIndirectPulled
+    GLuint getNearIndices() const { return nearIndices; }
+    GLuint getNearCommand() const { return nearCommand; }
+
+    void setMaxSplatRadius(float pixels) { maxSplatRadius = pixels; }
+    float getMaxSplatRadius() const { return maxSplatRadius; }
+    void setBoundingRadius(float radius) { boundingRadius = radius; }
+
+    bool hasWideAtomics() const { return wide; }
+
+    // Counts from a few frames ago, to avoid stalling on the GPU
+    const Stats &getStats() const { return stats; }
+
+private:
+    void ensureCapacity(size_t instanceCount);
+    void ensureTarget(int width, int height);
+
+    std::shared_ptr<Material> splatProgram;
+    std::shared_ptr<Material> resolveProgram;
+    std::shared_ptr<Material> compositeProgram;
+    bool wide = false;
+    GLuint emptyVertexArray = 0;
+
+    size_t capacity = 0;
+    GLuint nearIndices = 0;
+    GLuint nearCommand;
+
+    int targetWidth = 0, targetHeight = 0;
+    GLuint splatBuffer = 0;
+    std::shared_ptr<Texture> resolved;
+
+    BufferReadback statsReadback;
+    Stats stats = {};
+
+    float maxSplatRadius = 1.0f;
+    float boundingRadius = 1.7320508f; // unit cube
+};
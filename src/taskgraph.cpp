@@ -0,0 +1,247 @@
+#include "taskgraph.hpp"
+#include "log.hpp"
+
+#include <stdexcept>
+
+static thread_local size_t currentWorker = SIZE_MAX;
+
+Task Task::promise_type::get_return_object()
+{
+    auto shared = std::make_shared<State>();
+    shared->handle = Handle::from_promise(*this);
+    state = shared.get();
+    return Task(std::move(shared));
+}
+
+void Task::State::pause()
+{
+    auto slice = Clock::now() - sliceStart;
+    busy += std::chrono::duration<double>(slice).count();
+
+    // Counted before anyone can see the task as done, so it lands in the right frame
+    scheduler->busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(slice).count();
+}
+
+void Task::FinalAwaiter::await_suspend(Handle handle) const noexcept
+{
+    State *state = handle.promise().state;
+    state->pause();
+    state->path = state->dependsPath + state->busy;
+
+    std::vector<std::shared_ptr<State>> waiters;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->done = true;
+        waiters.swap(state->waiters);
+    }
+
+    // The scheduler still holds a reference, so the frame outlives this
+    TaskScheduler *scheduler = state->scheduler;
+    for(auto &waiter : waiters) {
+        scheduler->schedule(std::move(waiter));
+    }
+
+    // The main thread may be waiting for exactly this task
+    {
+        std::lock_guard<std::mutex> lock(scheduler->mainMutex);
+    }
+    scheduler->mainCondition.notify_all();
+
+    // The frame goes now rather than with the last copy of the task, taking
+    // the tasks it awaited with it. Otherwise every tick would keep the one
+    // before it alive through its parameters, in a chain that never ends.
+    state->handle = nullptr;
+    handle.destroy();
+}
+
+bool Task::isDone() const
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->done;
+}
+
+// Always goes through await_suspend, which records who is waiting
+bool Task::Awaiter::await_ready() const
+{
+    return false;
+}
+
+bool Task::Awaiter::await_suspend(Handle handle)
+{
+    self = handle.promise().state;
+    self->pause();
+
+    std::lock_guard<std::mutex> lock(dependency->mutex);
+    if(dependency->done)
+        return false;
+
+    dependency->waiters.push_back(self->shared_from_this());
+    return true;
+}
+
+void Task::Awaiter::await_resume()
+{
+    self->sliceStart = Clock::now();
+    self->dependsPath = std::max(self->dependsPath, dependency->path);
+
+    if(dependency->exception)
+        std::rethrow_exception(dependency->exception);
+}
+
+TaskScheduler::TaskScheduler(size_t workerCount)
+{
+    workerCount = std::max<size_t>(workerCount, 1);
+
+    for(size_t i = 0; i < workerCount; i++) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for(size_t i = 0; i < workerCount; i++) {
+        threads.emplace_back(&TaskScheduler::worker, this, i);
+    }
+
+    LOG_DEBUG("Created task scheduler with {} workers", workerCount);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+
+    LOG_DEBUG("Destroyed task scheduler");
+}
+
+Task TaskScheduler::spawn(const char *name, Affinity affinity, Task task)
+{
+    if(!task.valid())
+        throw std::runtime_error(fmt::format("Spawning empty task '{}'", name));
+
+    task.state->name = name;
+    task.state->affinity = affinity;
+    task.state->scheduler = this;
+    tasksSpawned++;
+    schedule(task.state);
+
+    return task;
+}
+
+void TaskScheduler::schedule(StatePtr state)
+{
+    if(state->affinity == Affinity::Main) {
+        {
+            std::lock_guard<std::mutex> lock(mainMutex);
+            mainTasks.push_back(std::move(state));
+        }
+        mainCondition.notify_one();
+        return;
+    }
+
+    // Workers keep what they make ready, everyone else spreads it out
+    size_t index = currentWorker != SIZE_MAX ? currentWorker : nextQueue++ % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(state));
+    }
+    queued++;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeCondition.notify_one();
+}
+
+void TaskScheduler::execute(const StatePtr &state)
+{
+    state->handle.resume();
+}
+
+TaskScheduler::StatePtr TaskScheduler::take(size_t index)
+{
+    {
+        WorkerQueue &own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty()) {
+            StatePtr state = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued--;
+            return state;
+        }
+    }
+
+    for(size_t offset = 1; offset < queues.size(); offset++) {
+        WorkerQueue &victim = *queues[(index + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()) {
+            StatePtr state = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued--;
+            return state;
+        }
+    }
+
+    return nullptr;
+}
+
+void TaskScheduler::worker(size_t index)
+{
+    currentWorker = index;
+
+    while(true) {
+        if(StatePtr state = take(index)) {
+            execute(state);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeCondition.wait(lock, [this] { return stopping || queued > 0; });
+        if(stopping)
+            return;
+    }
+}
+
+void TaskScheduler::runMainUntil(const Task &task)
+{
+    while(true) {
+        StatePtr state;
+        {
+            std::unique_lock<std::mutex> lock(mainMutex);
+            mainCondition.wait(lock, [&] { return !mainTasks.empty() || task.isDone(); });
+            if(mainTasks.empty())
+                break;
+
+            state = std::move(mainTasks.front());
+            mainTasks.pop_front();
+        }
+        execute(state);
+    }
+
+    if(task.state->exception)
+        std::rethrow_exception(task.state->exception);
+}
+
+void TaskScheduler::beginFrame()
+{
+    frameStart = Task::Clock::now();
+    busyNanoseconds = 0;
+    tasksSpawned = 0;
+}
+
+TaskScheduler::FrameStats TaskScheduler::endFrame(const Task &last, double extraBusyTime)
+{
+    FrameStats stats;
+    stats.wallTime = std::chrono::duration<double>(Task::Clock::now() - frameStart).count();
+    stats.criticalPath = last.getPathLength();
+    stats.busyTime = busyNanoseconds * 1e-9 + extraBusyTime;
+    stats.taskCount = tasksSpawned;
+
+    size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    stats.utilization = stats.wallTime > 0.0 ? (float)(stats.busyTime / (stats.wallTime * cores)) : 0.0f;
+
+    return stats;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskScheduler;
+
+enum class Affinity {
+    Workers, // any worker thread
+    Main,    // the thread that owns the GL context
+};
+
+// A unit of frame work written as a coroutine. It starts suspended and
+// runs once spawned on a TaskScheduler. Other tasks `co_await` it to
+// depend on it. Copies refer to the same task.
+//
+//     Task Application::uploadTask(Task tick)
+//     {
+//         co_await tick;
+//         ...
+//     }
+//
+// Awaiting a task that was never spawned never resumes.
+class Task {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+    using Clock = std::chrono::steady_clock;
+
+    struct State : std::enable_shared_from_this<State> {
+        ~State() { if(handle) handle.destroy(); }
+
+        // Ends the current slice of running time
+        void pause();
+
+        Handle handle;
+        TaskScheduler *scheduler = nullptr;
+        Affinity affinity = Affinity::Workers;
+        const char *name = "";
+
+        std::mutex mutex;
+        bool done = false;
+        std::vector<std::shared_ptr<State>> waiters;
+        std::exception_ptr exception;
+
+        Clock::time_point sliceStart;
+        double busy = 0.0;       // seconds spent running
+        double dependsPath = 0.0; // longest path through the awaited tasks
+        double path = 0.0;       // dependsPath + busy, set when done
+    };
+
+    struct InitialAwaiter {
+        State *state;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle) const noexcept {}
+        void await_resume() const noexcept { state->sliceStart = Clock::now(); }
+    };
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle handle) const noexcept;
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type {
+        Task get_return_object();
+        InitialAwaiter initial_suspend() noexcept { return InitialAwaiter { state }; }
+        FinalAwaiter final_suspend() noexcept { return FinalAwaiter {}; }
+        void return_void() {}
+        void unhandled_exception() { state->exception = std::current_exception(); }
+
+        State *state = nullptr;
+    };
+
+    struct Awaiter {
+        std::shared_ptr<State> dependency;
+
+        bool await_ready() const;
+        bool await_suspend(Handle handle);
+        void await_resume();
+
+        State *self = nullptr;
+    };
+
+    Task() = default;
+
+    bool valid() const { return state != nullptr; }
+    bool isDone() const;
+    // Seconds along the longest chain of tasks ending in this one
+    double getPathLength() const { return state->path; }
+
+    Awaiter operator co_await() const { return Awaiter { state }; }
+
+private:
+    friend class TaskScheduler;
+    explicit Task(std::shared_ptr<State> state) : state(std::move(state)) {}
+
+    std::shared_ptr<State> state;
+};
+
+// Runs tasks on a set of work-stealing worker threads, plus a queue the
+// main thread drains for GL work.
+//
+// Each worker owns a deque; it pushes and pops at the back, and idle
+// workers steal from the front of the others. Tasks made ready by a
+// worker go on its own deque, so dependent work tends to stay on the
+// same core.
+class TaskScheduler {
+public:
+    struct FrameStats {
+        double wallTime;
+        double criticalPath;
+        double busyTime;
+        // busyTime / (wallTime * cores)
+        float utilization;
+        size_t taskCount;
+    };
+
+    TaskScheduler(size_t workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    ~TaskScheduler();
+
+    Task spawn(const char *name, Affinity affinity, Task task);
+
+    // Runs main-affine tasks on the calling thread until `task` is done.
+    // Rethrows anything the task threw.
+    void runMainUntil(const Task &task);
+
+    void beginFrame();
+    // `last` is the task that ends the frame; extraBusyTime is work done
+    // on threads the scheduler doesn't own
+    FrameStats endFrame(const Task &last, double extraBusyTime = 0.0);
+
+    size_t getWorkerCount() const { return threads.size(); }
+
+private:
+    friend class Task;
+    using StatePtr = std::shared_ptr<Task::State>;
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<StatePtr> tasks;
+    };
+
+    void schedule(StatePtr state);
+    void execute(const StatePtr &state);
+    void worker(size_t index);
+    StatePtr take(size_t index);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextQueue = 0;
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<size_t> queued = 0;
+    bool stopping = false;
+
+    std::mutex mainMutex;
+    std::condition_variable mainCondition;
+    std::deque<StatePtr> mainTasks;
+
+    Task::Clock::time_point frameStart;
+    std::atomic<uint64_t> busyNanoseconds = 0;
+    std::atomic<size_t> tasksSpawned = 0;
+};
@@ -0,0 +1,126 @@
+#include "threadpool.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+ThreadPool::ThreadPool(size_t threadCount) : nextChunk(0), activeWorkers(0)
+{
+    startThreads(threadCount);
+    LOG_DEBUG("Created thread pool with {} threads", getThreadCount());
+}
+
+ThreadPool::~ThreadPool()
+{
+    stopThreads();
+    LOG_DEBUG("Destroyed thread pool");
+}
+
+void ThreadPool::setThreadCount(size_t threadCount)
+{
+    std::lock_guard<std::mutex> call(callMutex);
+    if(std::max<size_t>(threadCount, 1) == getThreadCount())
+        return;
+
+    stopThreads();
+    startThreads(threadCount);
+    LOG_DEBUG("Thread pool now has {} threads", getThreadCount());
+}
+
+void ThreadPool::startThreads(size_t threadCount)
+{
+    if(threadCount == 0)
+        threadCount = 1;
+
+    stopping = false;
+    for(size_t i = 0; i < threadCount - 1; i++) {
+        // Jobs that ran before the thread existed aren't its business
+        threads.emplace_back(&ThreadPool::worker, this, generation);
+    }
+}
+
+void ThreadPool::stopThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)> &fn)
+{
+    if(count == 0)
+        return;
+    if(chunkSize == 0)
+        chunkSize = 1;
+
+    // Not worth waking anyone up
+    if(threads.empty() || count <= chunkSize) {
+        fn(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> call(callMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        jobChunkSize = chunkSize;
+        nextChunk = 0;
+        activeWorkers = threads.size();
+        generation++;
+    }
+    wakeCondition.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return activeWorkers == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::runChunks()
+{
+    size_t chunkCount = (jobCount + jobChunkSize - 1) / jobChunkSize;
+
+    for(size_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+        size_t begin = chunk * jobChunkSize;
+        size_t end = std::min(begin + jobChunkSize, jobCount);
+        (*job)(begin, end);
+    }
+}
+
+void ThreadPool::worker(size_t seenGeneration)
+{
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if(stopping)
+                return;
+            seenGeneration = generation;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        runChunks();
+        busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if(--activeWorkers == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            doneCondition.notify_one();
+        }
+    }
+}
+
+double ThreadPool::takeWorkerBusyTime()
+{
+    return busyNanoseconds.exchange(0) * 1e-9;
+}
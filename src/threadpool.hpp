@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops.
+// The calling thread takes part in the work and blocks until it's done.
+class ThreadPool {
+public:
+    ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    // Runs fn(begin, end) over [0, count) in chunks of chunkSize
+    void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)> &fn);
+
+    size_t getThreadCount() const { return threads.size() + 1; }
+    // Replaces the threads, waiting for a running job first
+    void setThreadCount(size_t threadCount);
+
+    // Seconds the pool's own threads spent on chunks since the last call
+    double takeWorkerBusyTime();
+
+private:
+    void startThreads(size_t threadCount);
+    void stopThreads();
+    void worker(size_t seenGeneration);
+    void runChunks();
+
+    std::vector<std::thread> threads;
+
+    // Callers may be on different threads, but only one job runs at a time
+    std::mutex callMutex;
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    bool stopping = false;
+    size_t generation = 0;
+
+    // Current job
+    const std::function<void(size_t, size_t)> *job = nullptr;
+    size_t jobCount = 0;
+    size_t jobChunkSize = 1;
+    std::atomic<size_t> nextChunk;
+    std::atomic<size_t> activeWorkers;
+    std::atomic<uint64_t> busyNanoseconds = 0;
+};
@@ -0,0 +1,338 @@
+#include "trajectory.hpp"
+#include "log.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static constexpr char FILE_MAGIC[8] = {'G', 'L', 'I', 'T', 'R', 'A', 'J', '1'};
+static constexpr char FRAME_MAGIC[4] = {'F', 'R', 'A', 'M'};
+static constexpr uint32_t FORMAT_VERSION = 1;
+
+static size_t roundUpToBlock(size_t size)
+{
+    return (size + trajectory::BLOCK_SIZE - 1) / trajectory::BLOCK_SIZE * trajectory::BLOCK_SIZE;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+size_t trajectory::compressBound(size_t size)
+{
+    return size + size / 128 + 1;
+}
+
+// Control byte 0..127 is followed by that many plus one literal bytes,
+// 128..255 by one byte repeated (control - 126) times
+size_t trajectory::compress(const uint8_t *src, size_t size, uint8_t *dst)
+{
+    size_t out = 0;
+    size_t literalStart = 0;
+    size_t i = 0;
+
+    auto flushLiterals = [&](size_t end) {
+        while(literalStart < end) {
+            size_t length = std::min<size_t>(end - literalStart, 128);
+            dst[out++] = (uint8_t)(length - 1);
+            std::memcpy(dst + out, src + literalStart, length);
+            out += length;
+            literalStart += length;
+        }
+    };
+
+    while(i < size) {
+        size_t run = 1;
+        while(i + run < size && run < 129 && src[i + run] == src[i]) run++;
+
+        if(run >= 3) {
+            flushLiterals(i);
+            dst[out++] = (uint8_t)(run + 126);
+            dst[out++] = src[i];
+            i += run;
+            literalStart = i;
+        } else {
+            i += run;
+        }
+    }
+    flushLiterals(size);
+
+    return out;
+}
+
+bool trajectory::decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t dstSize)
+{
+    size_t in = 0, out = 0;
+
+    while(in < size) {
+        uint8_t control = src[in++];
+        if(control < 128) {
+            size_t length = control + 1;
+            if(in + length > size || out + length > dstSize) return false;
+            std::memcpy(dst + out, src + in, length);
+            in += length;
+            out += length;
+        } else {
+            size_t length = control - 126;
+            if(in >= size || out + length > dstSize) return false;
+            std::memset(dst + out, src[in++], length);
+            out += length;
+        }
+    }
+
+    return out == dstSize;
+}
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string &path, size_t particleCount,
+    float quantization, size_t ringSize, uint32_t keyframeInterval) :
+    path(path), particleCount(particleCount), quantization(quantization),
+    keyframeInterval(std::max<uint32_t>(keyframeInterval, 1))
+{
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    directIo = fd >= 0;
+    if(fd < 0) {
+        // Some filesystems (tmpfs) don't do direct I/O
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if(fd < 0)
+        throw std::runtime_error(fmt::format("Failed to open {} for recording: {}", path, std::strerror(errno)));
+
+    size_t valueCount = particleCount * 3;
+    previous.resize(valueCount);
+    deltas.resize(valueCount);
+    shuffled.resize(valueCount * sizeof(uint32_t));
+
+    writeBufferSize = roundUpToBlock(sizeof(trajectory::FrameHeader) + trajectory::compressBound(shuffled.size()));
+    writeBuffer = (uint8_t*)std::aligned_alloc(trajectory::BLOCK_SIZE, writeBufferSize);
+    if(!writeBuffer)
+        throw std::runtime_error("Failed to allocate recording buffer");
+
+    std::memset(writeBuffer, 0, trajectory::BLOCK_SIZE);
+    trajectory::FileHeader header = {};
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FORMAT_VERSION;
+    header.particleCount = particleCount;
+    header.quantization = quantization;
+    header.keyframeInterval = this->keyframeInterval;
+    std::memcpy(writeBuffer, &header, sizeof(header));
+    writeBlocks(writeBuffer, trajectory::BLOCK_SIZE);
+
+    slots.resize(std::max<size_t>(ringSize, 2));
+    for(Slot &slot : slots) {
+        slot.positions.resize(particleCount);
+    }
+
+    thread = std::thread(&TrajectoryRecorder::writerThread, this);
+
+    LOG_DEBUG("Recording {} particles to {}{}", particleCount, path, directIo ? " (direct I/O)" : "");
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    stopping = true;
+    wakeCondition.notify_all();
+    thread.join();
+
+    close(fd);
+    std::free(writeBuffer);
+
+    LOG_DEBUG("Stopped recording to {}: {} frames, {} dropped", path, recordedFrames.load(), droppedFrames.load());
+}
+
+bool TrajectoryRecorder::submit(const std::vector<glm::vec3> &positions, uint64_t tick, double time)
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    if(positions.size() != particleCount || h - tail.load(std::memory_order_acquire) >= slots.size()) {
+        droppedFrames++;
+        return false;
+    }
+
+    Slot &slot = slots[h % slots.size()];
+    std::copy(positions.begin(), positions.end(), slot.positions.begin());
+    slot.tick = tick;
+    slot.time = time;
+
+    head.store(h + 1, std::memory_order_release);
+    wakeCondition.notify_one();
+    return true;
+}
+
+void TrajectoryRecorder::writerThread()
+{
+    while(true) {
+        size_t t = tail.load(std::memory_order_relaxed);
+
+        if(t == head.load(std::memory_order_acquire)) {
+            // Only stop once everything queued is on disk
+            if(stopping)
+                break;
+
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCondition.wait_for(lock, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        encodeAndWrite(slots[t % slots.size()]);
+        tail.store(t + 1, std::memory_order_release);
+    }
+}
+
+void TrajectoryRecorder::encodeAndWrite(const Slot &slot)
+{
+    size_t valueCount = particleCount * 3;
+    const float *values = &slot.positions[0].x;
+    float scale = 1.0f / quantization;
+    bool keyframe = framesSinceKeyframe == 0;
+
+    for(size_t k = 0; k < valueCount; k++) {
+        float scaled = std::clamp(values[k] * scale, -2147483520.0f, 2147483520.0f);
+        int32_t quantized = std::isnan(scaled) ? 0 : (int32_t)std::lround(scaled);
+
+        // Wrapping arithmetic, undone the same way when reading
+        int32_t delta = keyframe ? quantized : (int32_t)((uint32_t)quantized - (uint32_t)previous[k]);
+        previous[k] = quantized;
+        deltas[k] = zigzag(delta);
+    }
+
+    // Small deltas leave the upper byte planes mostly zero
+    for(size_t k = 0; k < valueCount; k++) {
+        uint32_t value = deltas[k];
+        shuffled[k] = value & 0xff;
+        shuffled[valueCount + k] = (value >> 8) & 0xff;
+        shuffled[valueCount * 2 + k] = (value >> 16) & 0xff;
+        shuffled[valueCount * 3 + k] = value >> 24;
+    }
+
+    trajectory::FrameHeader header = {};
+    std::memcpy(header.magic, FRAME_MAGIC, sizeof(FRAME_MAGIC));
+    header.flags = keyframe ? trajectory::FRAME_KEYFRAME : 0;
+    header.tick = slot.tick;
+    header.time = slot.time;
+    header.rawSize = shuffled.size();
+    header.payloadSize = trajectory::compress(shuffled.data(), shuffled.size(),
+        writeBuffer + sizeof(header));
+    std::memcpy(writeBuffer, &header, sizeof(header));
+
+    size_t used = sizeof(header) + header.payloadSize;
+    size_t total = roundUpToBlock(used);
+    std::memset(writeBuffer + used, 0, total - used);
+
+    writeBlocks(writeBuffer, total);
+
+    framesSinceKeyframe = (framesSinceKeyframe + 1) % keyframeInterval;
+    recordedFrames++;
+    rawBytes += valueCount * sizeof(float);
+}
+
+void TrajectoryRecorder::writeBlocks(const uint8_t *data, size_t size)
+{
+    while(size > 0) {
+        ssize_t written = write(fd, data, size);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            LOG_ERROR("Failed to write to {}: {}", path, std::strerror(errno));
+            return;
+        }
+        data += written;
+        size -= written;
+        bytesWritten += written;
+    }
+}
+
+TrajectoryReader::TrajectoryReader(const std::string &path)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error(fmt::format("Failed to open {} for playback: {}", path, std::strerror(errno)));
+
+    if(pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+        header.version != FORMAT_VERSION) {
+        close(fd);
+        throw std::runtime_error(fmt::format("{} is not a trajectory recording", path));
+    }
+
+    // Index the frames; a torn frame at the end is ignored
+    uint64_t offset = trajectory::BLOCK_SIZE;
+    trajectory::FrameHeader frameHeader;
+    while(pread(fd, &frameHeader, sizeof(frameHeader), offset) == sizeof(frameHeader)) {
+        if(std::memcmp(frameHeader.magic, FRAME_MAGIC, sizeof(FRAME_MAGIC)) != 0)
+            break;
+
+        frames.push_back(FrameInfo { offset, frameHeader.flags, frameHeader.payloadSize, frameHeader.time });
+        offset += roundUpToBlock(sizeof(frameHeader) + frameHeader.payloadSize);
+    }
+
+    current.resize(header.particleCount * 3);
+    shuffled.resize(current.size() * sizeof(uint32_t));
+
+    LOG_DEBUG("Opened recording {} with {} frames of {} particles", path, frames.size(), header.particleCount);
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+    close(fd);
+}
+
+void TrajectoryReader::readFrame(size_t index, std::vector<glm::vec3> &positions)
+{
+    if(index >= frames.size())
+        throw std::runtime_error(fmt::format("Frame {} is out of range", index));
+
+    if(index != currentIndex) {
+        bool continues = currentIndex != SIZE_MAX && index == currentIndex + 1;
+        size_t start = index;
+        if(!continues) {
+            while(start > 0 && !(frames[start].flags & trajectory::FRAME_KEYFRAME)) start--;
+        }
+        for(size_t i = start; i <= index; i++) {
+            decodeFrame(i);
+        }
+    }
+
+    positions.resize(header.particleCount);
+    float *values = &positions[0].x;
+    for(size_t k = 0; k < current.size(); k++) {
+        values[k] = current[k] * header.quantization;
+    }
+}
+
+void TrajectoryReader::decodeFrame(size_t index)
+{
+    const FrameInfo &frame = frames[index];
+
+    payload.resize(frame.payloadSize);
+    if(pread(fd, payload.data(), payload.size(), frame.offset + sizeof(trajectory::FrameHeader)) != (ssize_t)payload.size() ||
+        !trajectory::decompress(payload.data(), payload.size(), shuffled.data(), shuffled.size())) {
+        throw std::runtime_error(fmt::format("Frame {} of the recording is corrupt", index));
+    }
+
+    size_t valueCount = current.size();
+    bool keyframe = frame.flags & trajectory::FRAME_KEYFRAME;
+    for(size_t k = 0; k < valueCount; k++) {
+        uint32_t value = shuffled[k]
+            | (uint32_t)shuffled[valueCount + k] << 8
+            | (uint32_t)shuffled[valueCount * 2 + k] << 16
+            | (uint32_t)shuffled[valueCount * 3 + k] << 24;
+        int32_t delta = unzigzag(value);
+        current[k] = keyframe ? delta : (int32_t)((uint32_t)current[k] + (uint32_t)delta);
+    }
+
+    currentIndex = index;
+}
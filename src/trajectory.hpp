@@ -0,0 +1,144 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// On-disk trajectory format.
+//
+// A 4 KiB file header is followed by frames, each padded to 4 KiB so
+// they can be written with O_DIRECT. A frame holds positions quantized to
+// a fixed step, zigzag-encoded as deltas against the previous recorded
+// frame (or against zero for keyframes). The bytes are shuffled into
+// planes and then run-length compressed.
+namespace trajectory {
+    constexpr size_t BLOCK_SIZE = 4096;
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t particleCount;
+        float quantization;
+        uint32_t keyframeInterval;
+    };
+
+    struct FrameHeader {
+        char magic[4];
+        uint32_t flags;
+        uint64_t tick;
+        double time;
+        uint32_t payloadSize;
+        uint32_t rawSize;
+    };
+
+    constexpr uint32_t FRAME_KEYFRAME = 1;
+
+    size_t compressBound(size_t size);
+    size_t compress(const uint8_t *src, size_t size, uint8_t *dst);
+    bool decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t dstSize);
+}
+
+// Takes snapshots from the simulation thread without ever blocking it.
+// Snapshots go into a fixed ring of preallocated slots. A background
+// thread encodes and writes them. When the ring is full the snapshot
+// is dropped and counted.
+class TrajectoryRecorder {
+public:
+    TrajectoryRecorder(const std::string &path, size_t particleCount,
+        float quantization = 0.001f, size_t ringSize = 8, uint32_t keyframeInterval = 64);
+    ~TrajectoryRecorder();
+
+    // Returns false if the snapshot had to be dropped
+    bool submit(const std::vector<glm::vec3> &positions, uint64_t tick, double time);
+
+    size_t getRecordedFrames() const { return recordedFrames; }
+    size_t getDroppedFrames() const { return droppedFrames; }
+    size_t getQueueDepth() const { return head - tail; }
+    size_t getRingSize() const { return slots.size(); }
+    size_t getBytesWritten() const { return bytesWritten; }
+    size_t getRawBytes() const { return rawBytes; }
+    bool isDirectIo() const { return directIo; }
+    const std::string &getPath() const { return path; }
+
+private:
+    struct Slot {
+        std::vector<glm::vec3> positions;
+        uint64_t tick;
+        double time;
+    };
+
+    void writerThread();
+    void encodeAndWrite(const Slot &slot);
+    void writeBlocks(const uint8_t *data, size_t size);
+
+    std::string path;
+    int fd = -1;
+    bool directIo = false;
+
+    size_t particleCount;
+    float quantization;
+    uint32_t keyframeInterval;
+
+    // Single producer, single consumer
+    std::vector<Slot> slots;
+    std::atomic<size_t> head = 0; // next slot to fill
+    std::atomic<size_t> tail = 0; // next slot to write
+
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<bool> stopping = false;
+    std::thread thread;
+
+    // Writer thread state
+    std::vector<int32_t> previous;
+    std::vector<uint32_t> deltas;
+    std::vector<uint8_t> shuffled;
+    uint8_t *writeBuffer = nullptr;
+    size_t writeBufferSize = 0;
+    uint32_t framesSinceKeyframe = 0;
+
+    std::atomic<size_t> recordedFrames = 0;
+    std::atomic<size_t> droppedFrames = 0;
+    std::atomic<size_t> bytesWritten = 0;
+    std::atomic<size_t> rawBytes = 0;
+};
+
+// Random access to recorded frames. Decoding resumes from the last
+// decoded frame when reading forward, otherwise from the nearest keyframe.
+class TrajectoryReader {
+public:
+    TrajectoryReader(const std::string &path);
+    ~TrajectoryReader();
+
+    size_t getParticleCount() const { return header.particleCount; }
+    size_t getFrameCount() const { return frames.size(); }
+    double getFrameTime(size_t index) const { return frames[index].time; }
+
+    void readFrame(size_t index, std::vector<glm::vec3> &positions);
+
+private:
+    struct FrameInfo {
+        uint64_t offset;
+        uint32_t flags;
+        uint32_t payloadSize;
+        double time;
+    };
+
+    void decodeFrame(size_t index);
+
+    int fd = -1;
+    trajectory::FileHeader header;
+    std::vector<FrameInfo> frames;
+
+    std::vector<int32_t> current;
+    size_t currentIndex = SIZE_MAX;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> shuffled;
+};
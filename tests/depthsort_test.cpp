@@ -0,0 +1,69 @@
+#include "depthsort.hpp"
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// A pool without threads hands the whole range to one call. Sorting twice
+// with it, with fewer instances visible the second time, must not pick up
+// the first frame's per-chunk counts.
+
+static int failures = 0;
+
+static void check(bool condition, const char *what)
+{
+    if(!condition) {
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static void sortAndCheck(DepthSorter &sorter, const std::vector<glm::vec3> &positions, size_t expectedVisible, ThreadPool &pool)
+{
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 1000.0f);
+    sorter.settings.boundingRadius = 0.0f;
+    sorter.sort(positions, view, projection * view, 0.1f, 1000.0f, pool);
+
+    check(sorter.getVisibleCount() == expectedVisible, "visible count");
+
+    std::vector<glm::vec3> sorted;
+    sorter.gather(positions, sorted, pool);
+    check(sorted.size() == expectedVisible, "gathered count");
+    for(size_t i = 1; i < sorted.size(); i++) {
+        if(sorted[i].z > sorted[i - 1].z) {
+            check(false, "front to back");
+            break;
+        }
+    }
+}
+
+int main()
+{
+    ThreadPool pool(1);
+    DepthSorter sorter;
+    sorter.settings.incremental = false;
+
+    // Several radix chunks, every instance in front of the camera
+    size_t count = RADIX_CHUNK_SIZE * 3 + 100;
+    std::vector<glm::vec3> positions(count);
+    for(size_t i = 0; i < count; i++) {
+        positions[i] = glm::vec3(0.0f, 0.0f, -1.0f - (float)(i % 997));
+    }
+    sortAndCheck(sorter, positions, count, pool);
+
+    // Every other instance moves behind it
+    size_t visible = count;
+    for(size_t i = 0; i < count; i += 2) {
+        positions[i].z = 10.0f;
+        visible--;
+    }
+    sortAndCheck(sorter, positions, visible, pool);
+
+    if(failures == 0)
+        std::printf("depthsort_test passed\n");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}